@@ -0,0 +1,331 @@
+/*
+ * amf.cpp
+ *
+ * Source code for the parts of the AMF library shared by AMF0 and AMF3.
+ *
+ * @author sconley
+ * Copyright 2017
+ *********************************************************************
+ */
+
+#include "amf.hpp"
+
+using namespace Tigerdile;
+
+/*****************************************************************************
+ * Known key Definitions
+ ****************************************************************************/
+
+static constexpr const char* knownKeyNames[] = {
+#   define TDAMF_KNOWN_KEY_NAME(id, name) name,
+    TDAMF_KNOWN_KEYS(TDAMF_KNOWN_KEY_NAME)
+#   undef TDAMF_KNOWN_KEY_NAME
+};
+
+static const uint32_t knownKeyCount =
+    sizeof(knownKeyNames) / sizeof(knownKeyNames[0]);
+
+static constexpr uint32_t knownKeyLength(const char* name)
+{
+    return *name ? 1 + knownKeyLength(name + 1) : 0;
+}
+
+/*
+ * Which of knownKeyNames hashes to 'slot', or knownKeyCount if none do.
+ */
+static constexpr uint32_t knownKeyIn(uint32_t slot, uint32_t i = 0)
+{
+    return (i == knownKeyCount) ? i :
+           (knownKeyHash(knownKeyNames[i],
+                         knownKeyLength(knownKeyNames[i])) == slot) ? i :
+           knownKeyIn(slot, i + 1);
+}
+
+static constexpr const char* knownKeySlotName(uint32_t slot)
+{
+    return (knownKeyIn(slot) == knownKeyCount) ? NULL :
+           knownKeyNames[knownKeyIn(slot)];
+}
+
+static constexpr uint32_t knownKeySlotLength(uint32_t slot)
+{
+    return (knownKeyIn(slot) == knownKeyCount) ? 0 :
+           knownKeyLength(knownKeyNames[knownKeyIn(slot)]);
+}
+
+/*
+ * If two keys share a slot, only one of them is found by knownKeyIn.
+ */
+static constexpr uint32_t knownKeySlotsUsed(uint32_t slot = 0)
+{
+    return (slot == AMF::KNOWN_KEY_SLOTS) ? 0 :
+           (knownKeyIn(slot) != knownKeyCount) + knownKeySlotsUsed(slot + 1);
+}
+
+static_assert(knownKeySlotsUsed() == knownKeyCount,
+              "Known keys collide; knownKeyHash needs a new multiplier");
+static_assert(AMF::KNOWN_KEY_SLOTS == 128,
+              "knownKeyHash and the table below are for 128 slots");
+
+#define KNOWN_KEY_SLOT(n)   { knownKeySlotName(n), knownKeySlotLength(n) }
+#define KNOWN_KEY_SLOTS4(n) KNOWN_KEY_SLOT(n), KNOWN_KEY_SLOT(n + 1), \
+                            KNOWN_KEY_SLOT(n + 2), KNOWN_KEY_SLOT(n + 3)
+#define KNOWN_KEY_SLOTS16(n) KNOWN_KEY_SLOTS4(n), KNOWN_KEY_SLOTS4(n + 4), \
+                             KNOWN_KEY_SLOTS4(n + 8), KNOWN_KEY_SLOTS4(n + 12)
+#define KNOWN_KEY_SLOTS64(n) KNOWN_KEY_SLOTS16(n), KNOWN_KEY_SLOTS16(n + 16), \
+                             KNOWN_KEY_SLOTS16(n + 32), \
+                             KNOWN_KEY_SLOTS16(n + 48)
+
+/*
+ * This is all worked out by the compiler; there's nothing to set up at
+ * run time.
+ */
+const AMF::Value AMF::knownKeys[AMF::KNOWN_KEY_SLOTS] = {
+    KNOWN_KEY_SLOTS64(0), KNOWN_KEY_SLOTS64(64)
+};
+
+#undef KNOWN_KEY_SLOTS64
+#undef KNOWN_KEY_SLOTS16
+#undef KNOWN_KEY_SLOTS4
+#undef KNOWN_KEY_SLOT
+
+/*****************************************************************************
+ * Result Definitions
+ ****************************************************************************/
+
+/*
+ * Each Status stands for one of the exceptions the throwing calls use.
+ */
+void AMF::raise(const Result& result)
+{
+    switch(result.status) {
+        case OK:
+            return;
+        case NEED_MORE_DATA:
+            TDAMF_THROW(std::underflow_error(result.message));
+        case NEED_MORE_ROOM:
+            TDAMF_THROW(std::overflow_error(result.message));
+        case BAD_REFERENCE:
+            TDAMF_THROW(std::out_of_range(result.message));
+        default:
+            TDAMF_THROW(std::runtime_error(result.message));
+    }
+}
+
+/*****************************************************************************
+ * PropertyMap Definitions
+ ****************************************************************************/
+
+/*
+ * Free our memory, unless it belongs to an arena.
+ */
+AMF::PropertyMap::~PropertyMap()
+{
+    this->release(this->entries);
+    this->release(this->index);
+}
+
+/*
+ * Get memory from the arena if we have one, or the heap if we don't.
+ */
+void* AMF::PropertyMap::allocate(size_t size)
+{
+    if(this->arena) {
+        return this->arena->allocate(size);
+    }
+
+    return ::operator new(size);
+}
+
+/*
+ * Give memory back.  Arena memory is left for the arena to deal with.
+ */
+void AMF::PropertyMap::release(void* ptr)
+{
+    if(!this->arena) {
+        ::operator delete(ptr);
+    }
+}
+
+/*
+ * FNV-1a.  Keys are short so this is plenty good.  Known keys already
+ * have a perfect hash, so we just spread that over the index.
+ */
+uint32_t AMF::PropertyMap::hash(const Value& key, const Value* known)
+{
+    uint32_t result = 2166136261u;
+
+    if(known) {
+        return (uint32_t)(known - AMF::knownKeys) * 2654435761u;
+    }
+
+    for(uint32_t i = 0; i < key.len; i++) {
+        result = (result ^ (unsigned char)key.val[i]) * 16777619u;
+    }
+
+    return result;
+}
+
+/*
+ * (Re)build the hash index with 'size' slots, which must be a power of 2
+ * and larger than count.
+ */
+void AMF::PropertyMap::buildIndex(uint32_t size)
+{
+    if(size != this->indexSize) {
+        this->release(this->index);
+
+        this->index = (uint32_t*)this->allocate(size * sizeof(uint32_t));
+        this->indexSize = size;
+    }
+
+    memset(this->index, 0, size * sizeof(uint32_t));
+
+    for(uint32_t i = 0; i < this->count; i++) {
+        const Value&    key = this->entries[i].first;
+        int             id = AMF::knownKeyId(key);
+        uint32_t        slot = hash(key, id < 0 ? NULL : &AMF::knownKeys[id]) &
+                               (size - 1);
+
+        while(this->index[slot]) {
+            slot = (slot + 1) & (size - 1);
+        }
+
+        this->index[slot] = i + 1;
+    }
+}
+
+/*
+ * Make room for at least n entries.
+ */
+void AMF::PropertyMap::reserve(uint32_t n)
+{
+    if(n <= this->capacity) {
+        return;
+    }
+
+    Entry* entries = (Entry*)this->allocate(n * sizeof(Entry));
+
+    if(this->count) {
+        memcpy((void*)entries, this->entries, this->count * sizeof(Entry));
+    }
+
+    this->release(this->entries);
+    this->entries = entries;
+    this->capacity = n;
+}
+
+/*
+ * Look up a key.  Returns end() if not found.
+ */
+AMF::PropertyMap::iterator AMF::PropertyMap::find(const Value& key)
+{
+    return this->lookup(key, AMF::knownKey(key.val, key.len));
+}
+
+/*
+ * Known keys are always stored as our copy of them (see insert), so if
+ * the key is one of those, comparing pointers is enough.
+ */
+static inline bool sameKey(const AMF::Value& entry, const AMF::Value& key,
+                           const AMF::Value* known)
+{
+    if(known) {
+        return entry.val == known->val;
+    }
+
+    return (entry.len == key.len) && !memcmp(entry.val, key.val, key.len);
+}
+
+/*
+ * find, once we know whether key is a known key.
+ */
+AMF::PropertyMap::iterator AMF::PropertyMap::lookup(const Value& key,
+                                                    const Value* known)
+{
+    if(this->count > INDEX_THRESHOLD) {
+        uint32_t slot = hash(key, known) & (this->indexSize - 1);
+
+        while(this->index[slot]) {
+            Entry& entry = this->entries[this->index[slot] - 1];
+
+            if(sameKey(entry.first, key, known)) {
+                return &entry;
+            }
+
+            slot = (slot + 1) & (this->indexSize - 1);
+        }
+
+        return this->end();
+    }
+
+    for(Entry* entry = this->entries; entry != this->end(); entry++) {
+        if(sameKey(entry->first, key, known)) {
+            return entry;
+        }
+    }
+
+    return this->end();
+}
+
+/*
+ * Like std::map::insert, this will NOT overwrite a key that is already
+ * present.
+ */
+std::pair<AMF::PropertyMap::iterator, bool>
+AMF::PropertyMap::insert(const Entry& entry)
+{
+    const Value*    known = AMF::knownKey(entry.first.val, entry.first.len);
+    iterator        existing = this->lookup(entry.first, known);
+
+    if(existing != this->end()) {
+        return std::pair<iterator, bool>(existing, false);
+    }
+
+    if(this->count == this->capacity) {
+        this->reserve(this->capacity ? this->capacity * 2 : 8);
+    }
+
+    new (&this->entries[this->count]) Entry(entry);
+
+    if(known) {
+        this->entries[this->count].first.val = known->val;
+    }
+
+    this->count++;
+
+    // The index only exists past the threshold, and is kept at most
+    // half full.  It's stale after a clear(), so it is rebuilt every
+    // time we cross the threshold.
+    if(this->count > INDEX_THRESHOLD) {
+        if((this->count == INDEX_THRESHOLD + 1) ||
+           (this->count * 2 > this->indexSize)) {
+            uint32_t size = MAX(this->indexSize, 64);
+
+            while(size < this->count * 2) {
+                size *= 2;
+            }
+
+            this->buildIndex(size);
+        } else {
+            uint32_t slot = hash(entry.first, known) &
+                            (this->indexSize - 1);
+
+            while(this->index[slot]) {
+                slot = (slot + 1) & (this->indexSize - 1);
+            }
+
+            this->index[slot] = this->count;
+        }
+    }
+
+    return std::pair<iterator, bool>(&this->entries[this->count - 1], true);
+}
+
+/*
+ * Remove all entries but keep our memory.
+ */
+void AMF::PropertyMap::clear()
+{
+    this->count = 0;
+}
@@ -21,21 +21,616 @@
 #define __AMF_HPP__
 
 #include <map>
+#include <functional>
+#include <initializer_list>
+#include <new>
 #include <vector>
+#include <utility>
+#include <cstddef>
 #include <cstring>
 #include <cstdint>
+#include <cstdlib>
 #include <stdexcept>
+#include <string>
 
 #include <arpa/inet.h>
 #include <sys/param.h>
+#include <sys/uio.h>
 
 #include <iostream>
 
 #include "endian.hpp"
 
 
+/*
+ * Everything we throw goes through here.  Built without exceptions
+ * (-fno-exceptions, which is what TDAMF_NO_EXCEPTIONS does in our CMake),
+ * what would have been thrown is printed and we abort instead; so use
+ * the try* calls, which return an AMF::Result, for anything that can go
+ * wrong in the normal course of things.
+ */
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS)
+#   define TDAMF_THROW(e) throw e
+#else
+#   define TDAMF_THROW(e) Tigerdile::abortWith(e)
+#endif
+
+
 namespace Tigerdile
 {
+    /*
+     * What TDAMF_THROW does without exceptions.
+     */
+    template<typename E>
+    [[noreturn]] inline void abortWith(const E& e)
+    {
+        std::cerr << "tdamf: " << e.what() << std::endl;
+        abort();
+    }
+
+/*****************************************************************************
+ * Arena
+ *
+ * A simple bump allocator.  Memory is handed out of large slabs and is
+ * never freed individually; instead, the whole arena is reset in one go.
+ * This is meant for decoding RTMP messages, where we decode a message,
+ * look at it, and throw the whole thing away.
+ *
+ * Slabs are kept across resets, so once an arena has grown to fit your
+ * largest message, decoding into it does not touch the heap at all.
+ *****************************************************************************/
+
+    class Arena
+    {
+        public:
+            /*
+             * slabSize is the size of each chunk of memory we get from
+             * the heap.  Allocations larger than this get a slab of
+             * their own.
+             */
+            Arena(size_t slabSize = 8192);
+
+            /*
+             * Frees all slabs.  Anything allocated out of this arena
+             * is invalid after this.
+             */
+            ~Arena();
+
+            /*
+             * Get 'size' bytes of memory aligned to 'align', which must
+             * be a power of 2.  This never returns NULL; it will throw
+             * std::bad_alloc if the heap is exhausted.
+             */
+            inline void* allocate(size_t size,
+                                  size_t align = alignof(std::max_align_t))
+            {
+                uintptr_t p = ((uintptr_t)this->cur + (align - 1))
+                                & ~((uintptr_t)align - 1);
+
+                if(this->cur && (p + size <= (uintptr_t)this->end)) {
+                    this->cur = (char*)(p + size);
+                    return (void*)p;
+                }
+
+                return this->allocateSlow(size, align);
+            }
+
+            /*
+             * Construct a T inside the arena.  Note that destructors
+             * are NOT run on reset, so T should either be trivial or
+             * only own memory that also came from this arena.
+             */
+            template<typename T, typename... Args>
+            inline T* create(Args&&... args)
+            {
+                return new (this->allocate(sizeof(T), alignof(T)))
+                            T(std::forward<Args>(args)...);
+            }
+
+            /*
+             * Rewind the arena.  Every allocation made so far becomes
+             * invalid, but the slabs are kept for re-use.
+             */
+            void reset();
+
+            /*
+             * Total bytes held by the arena across all slabs.
+             */
+            size_t capacity() const;
+
+        private:
+            struct Slab
+            {
+                Slab*   next;
+                size_t  size;   // usable bytes following this header
+            };
+
+            void* allocateSlow(size_t size, size_t align);
+
+            Slab*   first = NULL;
+            Slab*   current = NULL;
+            char*   cur = NULL;
+            char*   end = NULL;
+            size_t  slabSize;
+
+            Arena(const Arena&) = delete;
+            Arena& operator=(const Arena&) = delete;
+    };
+
+    /*
+     * STL allocator that pulls from an Arena.  If no arena is set, it
+     * falls back to the regular heap, so containers using it behave
+     * exactly like normal containers unless you ask otherwise.
+     *
+     * deallocate is a no-op for arena memory; it goes away on reset.
+     */
+    template<typename T>
+    class ArenaAllocator
+    {
+        public:
+            typedef T value_type;
+
+            Arena*  arena;
+
+            ArenaAllocator(Arena* arena = NULL) : arena(arena) { }
+
+            template<typename U>
+            ArenaAllocator(const ArenaAllocator<U>& o) : arena(o.arena) { }
+
+            T* allocate(size_t n)
+            {
+                if(this->arena) {
+                    return (T*)this->arena->allocate(n * sizeof(T),
+                                                     alignof(T));
+                }
+
+                return (T*)::operator new(n * sizeof(T));
+            }
+
+            void deallocate(T* p, size_t)
+            {
+                if(!this->arena) {
+                    ::operator delete(p);
+                }
+            }
+    };
+
+    template<typename T, typename U>
+    inline bool operator==(const ArenaAllocator<T>& a,
+                           const ArenaAllocator<U>& b)
+    {
+        return a.arena == b.arena;
+    }
+
+    template<typename T, typename U>
+    inline bool operator!=(const ArenaAllocator<T>& a,
+                           const ArenaAllocator<U>& b)
+    {
+        return a.arena != b.arena;
+    }
+
+/*****************************************************************************
+ * Writer
+ *
+ * Where encode puts its bytes.  The encoder asks for room, writes into
+ * it, and commits what it wrote:
+ *
+ *   char* p = out.reserve(9);
+ *   p[0] = AMF0::Types::NUMBER;
+ *   AMF::encodeNumber(val, &p[1]);
+ *   out.commit(9);
+ *
+ * That's all inline and is just a pointer compare when there's room.
+ * When there isn't, the writer's flush() makes room -- or throws, for a
+ * fixed buffer.  Big blocks (strings) go through append() instead, which
+ * doesn't need them to fit all at once.
+ *
+ * FixedWriter     - your buffer, which we write straight into.  Throws
+ *                   overflow_error if it's too small, just like
+ *                   encode(buf, size) always has.
+ * GrowableWriter  - a buffer we own, which doubles as needed.  No size
+ *                   pass needed.
+ * VectorWriter    - appends to a std::vector<char> of yours, growing it
+ *                   as needed.
+ * CountingWriter  - writes nothing, just counts.  Encoding into one gives
+ *                   the exact size of a message, references and all,
+ *                   which encodedSize can't.  Given a buffer, it writes
+ *                   there until something doesn't fit, then counts.
+ * CallbackWriter  - hands the bytes to a function of yours in blocks,
+ *                   e.g. to write them to a socket.
+ * IovecWriter     - builds an iovec list for writev / sendmsg.  Big
+ *                   strings aren't copied at all.
+ *****************************************************************************/
+
+    class Writer
+    {
+        public:
+            virtual ~Writer() { }
+
+            /*
+             * Get room for n contiguous bytes.  Write into it and then
+             * commit however many you actually used.
+             */
+            char* reserve(uint32_t n)
+            {
+                if(n > (size_t)(this->end - this->cur)) {
+                    this->flush(n);
+                }
+
+                return this->cur;
+            }
+
+            void commit(uint32_t n)
+            {
+                this->cur += n;
+            }
+
+            /*
+             * Write n bytes from data.
+             */
+            void append(const char* data, uint32_t n)
+            {
+                if((n > this->copyLimit) ||
+                   (n > (size_t)(this->end - this->cur))) {
+                    this->appendSlow(data, n);
+                    return;
+                }
+
+                memcpy(this->cur, data, n);
+                this->cur += n;
+            }
+
+            /*
+             * Room left at cur.  Anything up to this can be reserved
+             * without a flush.
+             */
+            uint32_t available() const
+            {
+                return this->end - this->cur;
+            }
+
+            /*
+             * Total bytes written so far.
+             */
+            uint32_t size() const
+            {
+                return this->flushed + (this->cur - this->start);
+            }
+
+        protected:
+            // Our current window: start is where it begins, cur is
+            // where the next byte goes.
+            char*       start = NULL;
+            char*       cur = NULL;
+            char*       end = NULL;
+
+            // Bytes that were written before 'start'.
+            uint32_t    flushed = 0;
+
+            // append sends anything bigger than this to appendSlow,
+            // even if it fits.
+            uint32_t    copyLimit = UINT32_MAX;
+
+            /*
+             * Make at least 'need' bytes of room at cur, or throw.
+             */
+            virtual void flush(uint32_t need) = 0;
+
+            /*
+             * append() for when data doesn't fit.  By default we make
+             * room for all of it.
+             */
+            virtual void appendSlow(const char* data, uint32_t n);
+    };
+
+    class FixedWriter : public Writer
+    {
+        public:
+            FixedWriter(char* buf, uint32_t size)
+            {
+                this->start = this->cur = buf;
+                this->end = buf + size;
+            }
+
+        protected:
+            void flush(uint32_t need);
+    };
+
+    class GrowableWriter : public Writer
+    {
+        public:
+            /*
+             * Nothing is allocated until the first write.
+             */
+            GrowableWriter(uint32_t initialSize = 256)
+            {
+                this->initialSize = initialSize;
+            }
+
+            ~GrowableWriter();
+
+            /*
+             * What we've written so far; size() bytes of it.
+             */
+            const char* data() const
+            {
+                return this->start;
+            }
+
+            /*
+             * Start over, but keep our buffer.
+             */
+            void clear()
+            {
+                this->cur = this->start;
+            }
+
+        protected:
+            uint32_t    initialSize;
+
+            void flush(uint32_t need);
+
+        private:
+            GrowableWriter(const GrowableWriter&) = delete;
+            GrowableWriter& operator=(const GrowableWriter&) = delete;
+    };
+
+    class VectorWriter : public Writer
+    {
+        public:
+            /*
+             * We append to 'out', starting at its current size.
+             */
+            VectorWriter(std::vector<char>& out);
+
+            /*
+             * finish(), if it hasn't been.
+             */
+            ~VectorWriter();
+
+            /*
+             * Trim 'out' down to what we wrote; we grow it ahead of
+             * what we need.  Call this when you're done, before using
+             * 'out'.
+             */
+            void finish();
+
+        protected:
+            std::vector<char>&  out;
+            size_t              base;
+
+            void flush(uint32_t need);
+
+        private:
+            VectorWriter(const VectorWriter&) = delete;
+            VectorWriter& operator=(const VectorWriter&) = delete;
+    };
+
+    class CountingWriter : public Writer
+    {
+        public:
+            /*
+             * Nothing is allocated until something is reserved.
+             */
+            CountingWriter()
+            {
+                this->copyLimit = 0;
+            }
+
+            /*
+             * Write into buf until something doesn't fit; from then on,
+             * just count.  Running out of room never throws.
+             */
+            CountingWriter(char* buf, uint32_t size)
+            {
+                this->start = this->cur = buf;
+                this->end = buf + size;
+            }
+
+            ~CountingWriter();
+
+            /*
+             * Whether we ran out of buf (or never had one), so buf
+             * doesn't hold everything.  size() is still the whole size.
+             */
+            bool overflowed() const
+            {
+                return this->counting;
+            }
+
+        protected:
+            // Where reserved bytes go, to be thrown away, once we're
+            // counting.
+            char*       scratch = NULL;
+            uint32_t    scratchSize = 0;
+            bool        counting = false;
+
+            void flush(uint32_t need);
+            void appendSlow(const char* data, uint32_t n);
+
+        private:
+            CountingWriter(const CountingWriter&) = delete;
+            CountingWriter& operator=(const CountingWriter&) = delete;
+    };
+
+    class CallbackWriter : public Writer
+    {
+        public:
+            typedef std::function<void(const char* data, uint32_t size)>
+                    Callback;
+
+            /*
+             * Bytes are collected in a blockSize buffer and passed to
+             * callback whenever it fills up.  Big strings are passed
+             * straight through without copying.
+             */
+            CallbackWriter(Callback callback, uint32_t blockSize = 4096);
+            ~CallbackWriter();
+
+            /*
+             * Pass along whatever is left.  Call this when you're done.
+             */
+            void finish();
+
+        protected:
+            Callback    callback;
+            uint32_t    blockSize;
+
+            void flush(uint32_t need);
+            void appendSlow(const char* data, uint32_t n);
+
+        private:
+            CallbackWriter(const CallbackWriter&) = delete;
+            CallbackWriter& operator=(const CallbackWriter&) = delete;
+    };
+
+    class IovecWriter : public Writer
+    {
+        public:
+            /*
+             * Strings longer than copyLimit are referenced where they
+             * are, in their own iovec; so, like decoded Values, they
+             * need to stay around until you've sent them.  Everything
+             * else is copied into blocks of blockSize bytes that we
+             * own.
+             */
+            IovecWriter(uint32_t copyLimit = 256, uint32_t blockSize = 4096);
+
+            /*
+             * Free our blocks.
+             */
+            ~IovecWriter();
+
+            /*
+             * Close off the last iovec.  Call this when you're done,
+             * before using iov().
+             */
+            void finish();
+
+            /*
+             * The result, for writev.  Valid until clear() or until
+             * we're destroyed.
+             */
+            const struct iovec* iov() const
+            {
+                return this->segments.data();
+            }
+
+            int iovcnt() const
+            {
+                return this->segments.size();
+            }
+
+            /*
+             * Start over, keeping our memory.
+             */
+            void clear();
+
+        protected:
+            // Blocks we copy into, kept across clear().  blocks[used]
+            // on are free.
+            std::vector<std::pair<char*, uint32_t> >    blocks;
+            size_t                                      used = 0;
+            uint32_t                                    blockSize;
+
+            std::vector<struct iovec>   segments;
+
+            void flush(uint32_t need);
+            void appendSlow(const char* data, uint32_t n);
+
+        private:
+            /*
+             * Add what's been written since 'start' as an iovec.
+             */
+            void closeSegment();
+
+            IovecWriter(const IovecWriter&) = delete;
+            IovecWriter& operator=(const IovecWriter&) = delete;
+    };
+
+/*****************************************************************************
+ * Known keys
+ *
+ * The object keys that RTMP commands and FLV metadata use over and over.
+ * When one of these is decoded, its key is pointed at a static copy
+ * instead of the buffer, so lookups can compare pointers rather than
+ * bytes.  See AMF::knownKey.
+ *
+ * The hash is perfect for this list.  If you add to it, a static_assert
+ * in amf.cpp will tell you if two keys collide, in which case the
+ * multiplier in knownKeyHash needs to be searched for again.
+ *****************************************************************************/
+
+#define TDAMF_KNOWN_KEYS(X) \
+    X(APP, "app")                                     \
+    X(FLASH_VER, "flashVer")                          \
+    X(SWF_URL, "swfUrl")                              \
+    X(TC_URL, "tcUrl")                                \
+    X(FPAD, "fpad")                                   \
+    X(CAPABILITIES, "capabilities")                   \
+    X(AUDIO_CODECS, "audioCodecs")                    \
+    X(VIDEO_CODECS, "videoCodecs")                    \
+    X(VIDEO_FUNCTION, "videoFunction")                \
+    X(PAGE_URL, "pageUrl")                            \
+    X(OBJECT_ENCODING, "objectEncoding")              \
+    X(TYPE, "type")                                   \
+    X(LEVEL, "level")                                 \
+    X(CODE, "code")                                   \
+    X(DESCRIPTION, "description")                     \
+    X(DETAILS, "details")                             \
+    X(CLIENTID, "clientid")                           \
+    X(DATA, "data")                                   \
+    X(FMS_VER, "fmsVer")                              \
+    X(MODE, "mode")                                   \
+    X(DURATION, "duration")                           \
+    X(WIDTH, "width")                                 \
+    X(HEIGHT, "height")                               \
+    X(VIDEODATARATE, "videodatarate")                 \
+    X(FRAMERATE, "framerate")                         \
+    X(VIDEOCODECID, "videocodecid")                   \
+    X(AUDIODATARATE, "audiodatarate")                 \
+    X(AUDIOSAMPLERATE, "audiosamplerate")             \
+    X(AUDIOSAMPLESIZE, "audiosamplesize")             \
+    X(STEREO, "stereo")                               \
+    X(AUDIOCODECID, "audiocodecid")                   \
+    X(FILESIZE, "filesize")                           \
+    X(ENCODER, "encoder")                             \
+    X(HAS_VIDEO, "hasVideo")                          \
+    X(HAS_AUDIO, "hasAudio")                          \
+    X(HAS_METADATA, "hasMetadata")                    \
+    X(HAS_KEYFRAMES, "hasKeyframes")                  \
+    X(HAS_CUE_POINTS, "hasCuePoints")                 \
+    X(CAN_SEEK_TO_END, "canSeekToEnd")                \
+    X(LASTTIMESTAMP, "lasttimestamp")                 \
+    X(LASTKEYFRAMETIMESTAMP, "lastkeyframetimestamp") \
+    X(KEYFRAMES, "keyframes")                         \
+    X(TIMES, "times")                                 \
+    X(FILEPOSITIONS, "filepositions")                 \
+    X(CREATIONDATE, "creationdate")                   \
+    X(METADATACREATOR, "metadatacreator")             \
+    X(DATASIZE, "datasize")                           \
+    X(VIDEOSIZE, "videosize")                         \
+    X(AUDIOSIZE, "audiosize")                         \
+    X(AUDIODELAY, "audiodelay")                       \
+    X(MAJOR_BRAND, "major_brand")                     \
+    X(MINOR_VERSION, "minor_version")                 \
+    X(COMPATIBLE_BRANDS, "compatible_brands")         \
+    X(TRACKINFO, "trackinfo")                         \
+    X(NAME, "name")                                  
+
+    /*
+     * Slot in AMF::knownKeys for a key.  Only the length and the first and
+     * last two bytes are hashed, so known keys still need a compare.
+     */
+    constexpr uint32_t knownKeyHash(const char* key, uint32_t len)
+    {
+        return len < 2 ? 0 :
+               (uint32_t)(((len << 24) |
+                           ((unsigned char)key[0] << 16) |
+                           ((unsigned char)key[len - 2] << 8) |
+                           (unsigned char)key[len - 1]) * 0x4dc3b87du) >> 25;
+    }
+
 /*****************************************************************************
  * AMF
  *
@@ -80,93 +675,288 @@ namespace Tigerdile
                         return false;
                     }
 
+                    // Known keys and the like share storage.
+                    if(o.val == val) {
+                        return true;
+                    }
+
                     // Do actual compare.
                     return !strncmp(val, o.val, len);
                 }
             };
 
-            struct Property
+            /*
+             * Ids for the known keys (see TDAMF_KNOWN_KEYS), which are
+             * their slots in knownKeys.  For example:
+             *
+             * switch(AMF::knownKeyId(kv.first)) {
+             *     case AMF::KEY_APP:
+             *     ...
+             */
+            enum KnownKey
             {
-                union
-                {
-                    double  number;
-                    Value   value;
-                    AMF*    object;
-                } property;
-
-                unsigned char    type;
+#               define TDAMF_KNOWN_KEY_ID(id, name) \
+                    KEY_##id = knownKeyHash(name, sizeof(name) - 1),
+                TDAMF_KNOWN_KEYS(TDAMF_KNOWN_KEY_ID)
+#               undef TDAMF_KNOWN_KEY_ID
             };
 
+            static const uint32_t KNOWN_KEY_SLOTS = 128;
+
             /*
-             * PRIMITIVE DECODERS
-             *
-             * TODO: Improve (or remove) decodeInt24 which is needed for RTMP
-             * timestamp processing with its awful, awkward 3 byte integers.
+             * The known keys, by id.  Unused slots are NULL.
+             */
+            static const Value knownKeys[KNOWN_KEY_SLOTS];
+
+            /*
+             * Our copy of a key, if it is a known key, or NULL.
+             */
+            static inline const Value* knownKey(const char* key, uint32_t len)
+            {
+                const Value* slot = &knownKeys[knownKeyHash(key, len)];
+
+                if((slot->len == len) && slot->val &&
+                   ((slot->val == key) || !memcmp(slot->val, key, len))) {
+                    return slot;
+                }
+
+                return NULL;
+            }
+
+            /*
+             * The KnownKey id of a key that points at our copy, as
+             * decoded keys do; -1 for anything else.  This doesn't look
+             * at the bytes, so it's just a hash and a pointer compare.
+             */
+            static inline int knownKeyId(const Value& key)
+            {
+                uint32_t slot = knownKeyHash(key.val, key.len);
+
+                return ((knownKeys[slot].val == key.val) &&
+                        (knownKeys[slot].len == key.len) && key.val) ?
+                       (int)slot : -1;
+            }
+
+            struct Property
+            {
+                union
+                {
+                    double  number;
+                    Value   value;
+                    AMF*    object;
+                } property;
+
+                unsigned char    type;
+            };
+
+            /*
+             * How a tryDecode or tryEncode went.  Each error is what the
+             * throwing call would have thrown:
+             *
+             * NEED_MORE_DATA - underflow_error; the message is cut short,
+             *                  which on a socket usually just means the
+             *                  rest hasn't arrived yet.
+             * NEED_MORE_ROOM - overflow_error; the buffer is too small.
+             * BAD_DATA       - runtime_error; bad or unsupported data, or
+             *                  over a limit.
+             * BAD_REFERENCE  - out_of_range; a REFERENCE to something
+             *                  that isn't in the reference table.
+             */
+            enum Status : unsigned char
+            {
+                OK = 0, NEED_MORE_DATA, NEED_MORE_ROOM, BAD_DATA,
+                BAD_REFERENCE
+            };
+
+            /*
+             * bytes is what was consumed or written when status is OK.
+             * For NEED_MORE_DATA, it's how big the buffer has to be
+             * before we can get any further (the whole message may need
+             * more than that); for NEED_MORE_ROOM, how big it has to be
+             * to encode into.  Otherwise it's 0.
+             *
+             * message is what the exception would have said.
+             */
+            struct Result
+            {
+                Status      status;
+                uint32_t    bytes;
+                const char* message;
+
+                Result() : status(OK), bytes(0), message(NULL) { }
+            };
+
+            /*
+             * Throw the exception that 'result' stands for; does
+             * nothing if it's OK.
+             */
+            static void raise(const Result& result);
+
+            /*
+             * Container for the properties of an object.
+             *
+             * Objects are almost always small, so this is a flat array
+             * of key/value pairs kept in insertion order (which is also
+             * the order they were on the wire).  Small maps are searched
+             * linearly; once a map grows past INDEX_THRESHOLD keys, we
+             * add an open-addressing hash index on the side.
+             *
+             * It looks enough like std::map for the way we use it --
+             * iterate over it with kv.first / kv.second, insert pairs,
+             * find by key -- but note that it does not sort, and that
+             * iterators are just pointers that are invalidated by insert.
+             *
+             * Known keys (see TDAMF_KNOWN_KEYS) are stored pointing at
+             * AMF::knownKeys rather than wherever they came from, so
+             * looking one up is a pointer compare per entry.
+             *
+             * If an arena is provided, all memory comes from it and is
+             * never freed by us.
+             */
+            class PropertyMap
+            {
+                public:
+                    typedef std::pair<Value, Property>  Entry;
+                    typedef Entry*                      iterator;
+                    typedef const Entry*                const_iterator;
+
+                    /*
+                     * Number of keys after which we build a hash index.
+                     */
+                    static const uint32_t INDEX_THRESHOLD = 8;
+
+                    PropertyMap(Arena* arena = NULL) : arena(arena) { }
+                    ~PropertyMap();
+
+                    iterator        begin()         { return this->entries; }
+                    iterator        end()
+                    {
+                        return this->entries + this->count;
+                    }
+                    const_iterator  begin() const   { return this->entries; }
+                    const_iterator  end() const
+                    {
+                        return this->entries + this->count;
+                    }
+
+                    uint32_t        size() const    { return this->count; }
+                    bool            empty() const   { return !this->count; }
+
+                    /*
+                     * Make room for at least n entries.
+                     */
+                    void reserve(uint32_t n);
+
+                    /*
+                     * Like std::map::insert, this will NOT overwrite a
+                     * key that is already present.  Returns the entry
+                     * for the key and whether or not we inserted it.
+                     */
+                    std::pair<iterator, bool> insert(const Entry& entry);
+
+                    /*
+                     * Look up a key.  Returns end() if not found.
+                     */
+                    iterator find(const Value& key);
+
+                    const_iterator find(const Value& key) const
+                    {
+                        return const_cast<PropertyMap*>(this)->find(key);
+                    }
+
+                    /*
+                     * Remove all entries but keep our memory.
+                     */
+                    void clear();
+
+                private:
+                    Entry*      entries = NULL;
+                    uint32_t    count = 0;
+                    uint32_t    capacity = 0;
+
+                    // Hash index; each slot is an entry index + 1, or 0
+                    // if empty.  indexSize is always a power of 2.
+                    uint32_t*   index = NULL;
+                    uint32_t    indexSize = 0;
+
+                    Arena*      arena;
+
+                    static uint32_t hash(const Value& key, const Value* known);
+                    iterator lookup(const Value& key, const Value* known);
+                    void* allocate(size_t size);
+                    void release(void* ptr);
+                    void buildIndex(uint32_t size);
+
+                    PropertyMap(const PropertyMap&) = delete;
+                    PropertyMap& operator=(const PropertyMap&) = delete;
+
+                    // Its key set hashes the same way.
+                    friend class AMF0Builder;
+            };
+
+            /*
+             * Container for list-style properties.  This uses
+             * ArenaAllocator, which acts like the normal heap allocator
+             * unless you give it an arena.
+             */
+            typedef std::vector<Property, ArenaAllocator<Property>>
+                                                            PropertyList;
+
+            /*
+             * Clean out properties -- see the subclasses.
+             */
+            virtual ~AMF() { }
+
+            /*
+             * PRIMITIVE DECODERS
+             *
+             * TODO: Improve (or remove) decodeInt24 which is needed for RTMP
+             * timestamp processing with its awful, awkward 3 byte integers.
              * decodeInt24 is not used by AMF.  This should maybe just be moved
              * to the RTMP server.
              *
              * TODO: decodeInt32LE - there's *one* integer in RTMP protocol
              * that is randomly little endian which kind of screws everything
-             * up.  There's no native C code to massage the byte order to
-             * little endian.  This is, again, not used by AMF and should
-             * possibly be moved.
+             * up.  This is, again, not used by AMF and should possibly be
+             * moved.
+             *
+             * These are all thin wrappers over Endian, which is safe to use
+             * on any address.
              */
             static inline uint32_t decodeInt24(const char* data)
             {
-                return (data[0] << 16) | (data[1] << 8) | data[2];
+                return Endian::loadBE24(data);
             }
 
             static inline uint32_t decodeInt32LE(const char* data)
             {
-#               if __BYTE_ORDER == __BIG_ENDIAN
-                    return (data[3] << 24) | (data[2] << 16) |
-                           (data[1] << 8) | data[0];
-#               else
-                    return (*((uint32_t*)data));
-#               endif
+                return Endian::loadLE32(data);
             }
 
             static inline uint16_t decodeInt16(const char* data)
             {
-                return ntohs(*((uint16_t*)data));
+                return Endian::loadBE16(data);
             }
 
             static inline uint32_t decodeInt32(const char* data)
             {
-                return ntohl(*((uint32_t*)data));
+                return Endian::loadBE32(data);
             }
 
             /*
-             * This method is shamelessly ripped off verbatim from
-             * librtmp -- I couldn't figure out a way to implement
-             * it any better.
-             *
-             * Doing a simple byte-flip can be done a number of
-             * ways ... but librtmp seems to have gone out of its
-             * way to figure out every byte order case for a double
-             * which is the "best" solution of the many bad solutions
-             * I've seen.
+             * Doubles are sent big endian, so this is one 8 byte swap --
+             * except on the odd machine whose doubles are in a different
+             * order from its integers, for which we still have the byte
+             * shuffles we got from librtmp.
              */
             static inline double decodeNumber(const char* data)
             {
 #               if __FLOAT_WORD_ORDER == __BYTE_ORDER
-#                   if __BYTE_ORDER == __BIG_ENDIAN
-                        return (*((double*)data));
-#                   elif __BYTE_ORDER == __LITTLE_ENDIAN
-                        double ret;
-                        unsigned char *ci, *co;
-                        ci = (unsigned char *)data;
-                        co = (unsigned char *)&ret;
-                        co[0] = ci[7];
-                        co[1] = ci[6];
-                        co[2] = ci[5];
-                        co[3] = ci[4];
-                        co[4] = ci[3];
-                        co[5] = ci[2];
-                        co[6] = ci[1];
-                        co[7] = ci[0];
-                        return ret;
-#                   endif
+                    uint64_t    bits = Endian::loadBE64(data);
+                    double      ret;
+
+                    memcpy(&ret, &bits, 8);
+                    return ret;
 #               else
 #                   if __BYTE_ORDER == __LITTLE_ENDIAN
                         /* __FLOAT_WORD_ORER == __BIG_ENDIAN */
@@ -211,291 +1001,2163 @@ namespace Tigerdile
              */
             static inline void encodeInt16(uint16_t val, char* data)
             {
-                (*((uint16_t*)data)) = htons(val);
+                Endian::storeBE16(val, data);
+            }
+
+            static inline void encodeInt32(uint32_t val, char* data)
+            {
+                Endian::storeBE32(val, data);
+            }
+
+            /*
+             * See decodeNumber.
+             */
+            static inline void encodeNumber(double val, char *data)
+            {
+#               if __FLOAT_WORD_ORDER == __BYTE_ORDER
+                    uint64_t bits;
+
+                    memcpy(&bits, &val, 8);
+                    Endian::storeBE64(bits, data);
+#               else
+#                   if __BYTE_ORDER == __LITTLE_ENDIAN
+                        /* __FLOAT_WORD_ORER == __BIG_ENDIAN */
+                        unsigned char *ci, *co;
+                        ci = (unsigned char *)&val;
+                        co = (unsigned char *)data;
+                        co[0] = ci[3];
+                        co[1] = ci[2];
+                        co[2] = ci[1];
+                        co[3] = ci[0];
+                        co[4] = ci[7];
+                        co[5] = ci[6];
+                        co[6] = ci[5];
+                        co[7] = ci[4];
+#                   else
+    /* __BYTE_ORDER == __BIG_ENDIAN && __FLOAT_WORD_ORER == __LITTLE_ENDIAN */
+                        unsigned char *ci, *co;
+                        ci = (unsigned char *)&val;
+                        co = (unsigned char *)data;
+                        co[0] = ci[4];
+                        co[1] = ci[5];
+                        co[2] = ci[6];
+                        co[3] = ci[7];
+                        co[4] = ci[0];
+                        co[5] = ci[1];
+                        co[6] = ci[2];
+                        co[7] = ci[3];
+#                   endif
+#               endif
+            }
+
+            /*
+             * Batch versions, for 'count' doubles back to back (as in
+             * AMF3 vectors).  Each is the same single swap as above, in
+             * a loop the compiler is free to unroll or vectorize.
+             */
+            static inline void decodeNumbers(const char* data, double* out,
+                                             uint32_t count)
+            {
+                for(uint32_t i = 0; i < count; i++) {
+                    out[i] = decodeNumber(&data[i * 8]);
+                }
+            }
+
+            static inline void encodeNumbers(const double* val,
+                                             uint32_t count, char* data)
+            {
+                for(uint32_t i = 0; i < count; i++) {
+                    encodeNumber(val[i], &data[i * 8]);
+                }
+            }
+
+            /*
+             * This has to be defined by the individual type of AMF
+             * call.
+             *
+             * This will process some buffer of data and load it into
+             * this AMF object.
+             *
+             * Note that the buffer is NOT! owned by the AMF object,
+             * but WILL be used by it.  The goal of this class is to
+             * alloc as little memory as possible and to re-use th
+             * buffer where available.
+             *
+             * Decode will throw an underflow_error if there is not
+             * enough data to decode, or a runtime_error if there
+             * is a problem.
+             *
+             * Returns the number of bytes consumed from the buffer.
+             */
+            virtual uint32_t decode(const char* buf, uint32_t size)
+            {
+                TDAMF_THROW(std::runtime_error("Needs definition"));
+            }
+
+            /*
+             * Return size of buffer required to encode this object.
+             * How this buffer is alloc'd is up to the caller.  The
+             * resulting buffer will not be larger than this.
+             *
+             * It iterates over all items and child items, so therefore
+             * this is a potentially expensive call.
+             *
+             * This method will not necessarily take into account
+             * compression due to use of references, so the resulting
+             * buffer used could be smaller than this size, but will
+             * never be larger.
+             */
+            virtual uint32_t  encodedSize()
+            {
+                TDAMF_THROW(std::runtime_error("Needs definition"));
+            }
+
+            /*
+             * Method to produce a size (in bytes) to encode a given
+             * Property.  For complex objects, this will run encodedSize
+             * on those objects.  encodedSize, in turn, calls this to
+             * size its component properties.
+             */
+            virtual uint32_t  propertySize(const Property& prop)
+            {
+                TDAMF_THROW(std::runtime_error("Needs definition"));
+            }
+
+            /*
+             * This encodes the object into an AMF data stream suitable
+             * for transmission or storage to file system.
+             *
+             * Requires a buffer that we will write to, with a size
+             * parameter to say how much buffer is provided.  It will
+             * return how many bytes of that buffer we actually consumed.
+             *
+             * You can use the "encodedSize" call to figure out the
+             * minimum buffer size required to encode an object.
+             */
+            virtual uint32_t encode(char* buf, uint32_t size)
+            {
+                TDAMF_THROW(std::runtime_error("Needs definition"));
+            }
+
+            /*
+             * Same, but into a Writer, which may grow as needed; so
+             * there's no need to run encodedSize first.
+             */
+            virtual uint32_t encode(Writer&)
+            {
+                TDAMF_THROW(std::runtime_error("Needs definition"));
+            }
+
+            /*
+             * Properties may be either a map or a vector, depending on
+             * if we have names or not.
+             */
+            union Properties {
+                PropertyMap*    propMap;
+                PropertyList*   propList;
+                Properties() {
+                    memset(this, 0, sizeof(Properties));
+                }
+            };
+
+            Properties  properties;
+            bool        isMap;
+            Value       name;           // This is for "typed" objects.
+
+            /*
+             * If set, this object, its property container and all of
+             * its children live in this arena.  They are not freed by
+             * the destructor; resetting the arena frees them instead.
+             */
+            Arena*      arena = NULL;
+
+            /*
+             * The object we are nested in, if it made us (i.e. we came
+             * from decode).  Objects you build by hand don't get one
+             * unless you set it.
+             */
+            AMF*        parent = NULL;
+
+            /*
+             * An object decoded with AMF0::KEEP_SOURCE remembers the
+             * bytes it was decoded from, and encode just copies those if
+             * it hasn't changed.
+             *
+             * That means if you change such an object's properties, you
+             * have to call this on it.  It marks that object and all of
+             * its parents as changed, so that they get encoded again.
+             * If you built the tree by hand without setting parent,
+             * you'll need to call it on each parent yourself.  Objects
+             * that don't remember their source don't need it.
+             */
+            void invalidate()
+            {
+                for(AMF* node = this; node; node = node->parent) {
+                    node->source = NULL;
+                }
+            }
+
+        protected:
+
+            /*
+             * Record an error in 'result' rather than throwing it.  For
+             * NEED_MORE_DATA, 'bytes' is how much buffer we need, from
+             * the start of whatever we were given.  Returns 0, so the
+             * decode cores can just return fail(...).
+             */
+            static uint32_t fail(Result& result, Status status,
+                                 const char* message, uint64_t bytes = 0)
+            {
+                result.status = status;
+                result.message = message;
+                result.bytes = (uint32_t)MIN(bytes, (uint64_t)UINT32_MAX);
+
+                return 0;
+            }
+
+            /*
+             * Something we started 'offset' bytes into our buffer failed;
+             * make what it needs count from our start.  Returns 0.
+             */
+            static uint32_t failedAt(Result& result, uint32_t offset)
+            {
+                if(result.status == NEED_MORE_DATA) {
+                    result.bytes = (uint32_t)MIN((uint64_t)result.bytes +
+                                                 offset,
+                                                 (uint64_t)UINT32_MAX);
+                }
+
+                return 0;
+            }
+
+            // The bytes we were decoded from (our body, without our
+            // type byte or header), if we haven't been changed since.
+            // sourceComplex is the number of complex objects in there,
+            // which encode needs to keep reference numbers right.
+            const char* source = NULL;
+            uint32_t    sourceSize = 0;
+            uint32_t    sourceComplex = 0;
+
+            /*
+             * Make a child node for a nested object.  If we're in an
+             * arena, the child goes in the same arena.
+             */
+            template<typename T>
+            T* createChild(const char* name = NULL, uint32_t nameSize = 0)
+            {
+                T* child;
+
+                if(this->arena) {
+                    child = this->arena->create<T>(name, nameSize);
+                    child->arena = this->arena;
+                } else {
+                    child = new T(name, nameSize);
+                }
+
+                child->parent = this;
+
+                return child;
+            }
+
+            /*
+             * Make sure we have a property container of the right type,
+             * allocating from the arena if we have one.
+             */
+            void initProperties(bool isMap)
+            {
+                this->isMap = isMap;
+
+                if(this->properties.propMap) {
+                    return;
+                }
+
+                if(isMap) {
+                    this->properties.propMap = this->arena ?
+                        this->arena->create<PropertyMap>(this->arena) :
+                        new PropertyMap();
+                } else {
+                    this->properties.propList = this->arena ?
+                        this->arena->create<PropertyList>(
+                            PropertyList::allocator_type(this->arena)) :
+                        new PropertyList();
+                }
+            }
+
+            /*
+             * Add a decoded value to our map or list.
+             */
+            void addProperty(const Value& name, const Property& prop)
+            {
+                if(this->isMap) {
+                    this->properties.propMap->insert(
+                        std::pair<Value, Property>(name, prop)
+                    );
+                } else {
+                    this->properties.propList->push_back(prop);
+                }
+            }
+    };
+
+/*****************************************************************************
+ * AMF0
+ *
+ * Version 0 of AMF
+ *****************************************************************************/
+
+    class AMF0 : public AMF
+    {
+        public:
+            enum Types : unsigned char
+                              { NUMBER = 0, BOOLEAN, STRING, OBJECT, MOVIECLIP,
+                                NILL, UNDEFINED, REFERENCE, ECMA_ARRAY,
+                                OBJECT_END, STRICT_ARRAY, DATE, LONG_STRING,
+                                UNSUPPORTED, RECORDSET, XML_DOC, TYPED_OBJECT,
+                                AVMPLUS, INVALID = 0xff };
+
+            /*
+             * Constructor to initialize 'name'.  'name' is used by
+             * AMF TypedObjects.
+             */
+            AMF0(const char* name = NULL, uint32_t nameSize = 0)
+            {
+                this->name.val = name;
+                this->name.len = nameSize;
+            }
+
+            /*
+             * This will process some buffer of data and load it into
+             * this AMF object.
+             *
+             * Note that the buffer is NOT! owned by the AMF object,
+             * but WILL be used by it.  The goal of this class is to
+             * alloc as little memory as possible and to re-use th
+             * buffer where available.
+             *
+             * Decode will throw an underflow_error if there is not
+             * enough data to decode, or a runtime_error if there
+             * is a problem.
+             *
+             * This is the top level decode and will loop over
+             * decodeProperty / decodeObject as necessary.
+             *
+             * Returns the number of bytes consumed from the buffer.
+             */
+            uint32_t decode(const char* buf, uint32_t size);
+
+            /*
+             * Flags to change how decode works.
+             *
+             * LAZY - nested objects and arrays are not decoded right
+             *        away.  We only check that they are well formed and
+             *        remember where they are in the buffer; they get
+             *        decoded the first time you call load() on them.
+             *        This is a big win if you only look at a couple of
+             *        top level fields.  Subtrees that contain references
+             *        or AMF3 data are always decoded right away.
+             *
+             * DENSE_NUMBERS - a STRICT_ARRAY that holds nothing but
+             *        NUMBERs (like the keyframe times and positions in
+             *        onMetaData) is decoded into a plain array of doubles
+             *        instead of a Property per element.  See numbers().
+             *
+             * KEEP_SOURCE - remember the bytes each object was decoded
+             *        from, so encode can copy the objects that haven't
+             *        changed instead of walking them.  The buffer has to
+             *        outlive the encode, and if you change anything you
+             *        MUST call invalidate() on what you changed, or encode
+             *        sends the old bytes.  Objects with a REFERENCE or
+             *        AVMPLUS in them are always encoded the long way, and
+             *        so is the top level if the decode appended to it.
+             */
+            enum DecodeFlags : uint32_t { LAZY = 0x01, DENSE_NUMBERS = 0x02,
+                                          KEEP_SOURCE = 0x04 };
+
+            /*
+             * Decode with DecodeFlags.  Otherwise identical to
+             * decode(buf, size).
+             */
+            uint32_t decode(const char* buf, uint32_t size, uint32_t flags);
+
+            /*
+             * The deepest objects can be nested.  decode and skipValue
+             * don't recurse, so this is just the size of the stack they
+             * keep; but our destructor and encode do.
+             */
+            static const uint32_t MAX_DEPTH = 32;
+
+            /*
+             * Limits for decoding messages from someone you don't trust,
+             * so a bad one is turned away before we spend much time or
+             * memory on it.  Going over any of them is a runtime_error.
+             *
+             * maxDepth - how deep objects can be nested; 0 means the
+             *            message can't have any objects in it.  Anything
+             *            over MAX_DEPTH is the same as MAX_DEPTH.
+             * maxNodes - how many values, at every level, we will decode.
+             *            A DENSE_NUMBERS array counts each of its NUMBERs.
+             *
+             * The AMF3 in an AVMPLUS value counts against maxDepth and
+             * maxNodes too, the same as if it were AMF0; each element of
+             * an AMF3 VECTOR is a value.
+             * maxBytes - how big the message can be.
+             *
+             * Whatever the limits, a STRICT_ARRAY whose count couldn't
+             * fit in what's left of the buffer is an underflow_error,
+             * before any of it is decoded.
+             *
+             * With LAZY, depth is checked up front, but values are only
+             * counted once loaded; load() doesn't count them against
+             * anything.
+             */
+            struct Limits
+            {
+                uint32_t    maxDepth;
+                uint32_t    maxNodes;
+                uint32_t    maxBytes;
+
+                Limits() : maxDepth(MAX_DEPTH), maxNodes(UINT32_MAX),
+                           maxBytes(UINT32_MAX) { }
+            };
+
+            /*
+             * Decode with Limits.  Otherwise identical to
+             * decode(buf, size, flags).
+             */
+            uint32_t decode(const char* buf, uint32_t size,
+                            const Limits& limits, uint32_t flags = 0);
+
+            /*
+             * Same as above, but every node, property container and the
+             * reference table come out of the provided arena.  Tearing
+             * the result down is just arena.reset(); this object should
+             * not be used after that until it is decoded into again.
+             *
+             * Any properties this object already had are dropped (not
+             * freed), so only use this on a fresh object or one that
+             * was previously decoded into an arena.
+             */
+            uint32_t decode(const char* buf, uint32_t size, Arena& arena,
+                            uint32_t flags = 0);
+
+            uint32_t decode(const char* buf, uint32_t size, Arena& arena,
+                            const Limits& limits, uint32_t flags = 0);
+
+            /*
+             * The same decodes, but errors come back in the Result
+             * instead of being thrown; on OK, bytes is what decode would
+             * have returned.  This is for a network loop, where a message
+             * that hasn't all arrived yet (NEED_MORE_DATA) is routine;
+             * the check costs the same as it does in decode, with no
+             * unwinding.
+             *
+             * The top level has no end marker, so a buffer cut between
+             * two values is just a shorter message; decode the whole
+             * message once its length (from the RTMP header, say) has
+             * arrived, or use AMF0Decoder to decode as it comes in.
+             *
+             * After an error, this object holds whatever was decoded
+             * before it, just as after decode throws; clear() it or
+             * decode into it again.  Running out of memory is still a
+             * bad_alloc, which, these being noexcept, ends the program.
+             */
+            Result tryDecode(const char* buf, uint32_t size,
+                             uint32_t flags = 0) noexcept;
+
+            Result tryDecode(const char* buf, uint32_t size,
+                             const Limits& limits,
+                             uint32_t flags = 0) noexcept;
+
+            Result tryDecode(const char* buf, uint32_t size, Arena& arena,
+                             uint32_t flags = 0) noexcept;
+
+            Result tryDecode(const char* buf, uint32_t size, Arena& arena,
+                             const Limits& limits,
+                             uint32_t flags = 0) noexcept;
+
+            /*
+             * Decode a message that is spread over several buffers, such
+             * as the RTMP chunks it arrived in, without gluing them
+             * together first.
+             *
+             * Just like decode(buf, size), values point right into your
+             * buffers, so keep them around.  The exception is a key or
+             * string that is split between two buffers; those are copied
+             * into a side buffer that belongs to this object, as is an
+             * AVMPLUS value split between them.  LAZY isn't supported
+             * here.
+             *
+             * Returns the number of bytes consumed across all buffers.
+             */
+            uint32_t decode(const struct iovec* iov, int iovcnt);
+
+            /*
+             * Same, but everything -- including split strings -- comes
+             * out of arena.  See decode(buf, size, arena).
+             */
+            uint32_t decode(const struct iovec* iov, int iovcnt,
+                            Arena& arena);
+
+            /*
+             * The same, with errors in the Result like tryDecode(buf,
+             * size).  As the iovec is the whole message, one that's cut
+             * short is NEED_MORE_DATA here too.
+             */
+            Result tryDecode(const struct iovec* iov, int iovcnt) noexcept;
+
+            Result tryDecode(const struct iovec* iov, int iovcnt,
+                             Arena& arena) noexcept;
+
+            /*
+             * Find where the value at the start of buf ends, without
+             * decoding it.  buf starts at the type byte, so this is the
+             * way to step over the command name, transaction ID and so
+             * on of an RTMP command.
+             *
+             * This does all the same checks as decode, including nested
+             * objects and reference indexes, and throws the same errors
+             * for bad data.  It never allocates, except to keep the
+             * traits of any AVMPLUS (AMF3) objects.
+             *
+             * References are numbered across the whole message, so when
+             * stepping through a message value by value, pass the same
+             * complexCount (starting at 0) to every call.  The version
+             * without it assumes this is the first value.
+             *
+             * Returns the number of bytes the value takes up.
+             */
+            static uint32_t skipValue(const char* buf, uint32_t size);
+            static uint32_t skipValue(const char* buf, uint32_t size,
+                                      uint32_t& complexCount);
+
+            /*
+             * Same, for a whole message: returns the number of bytes
+             * decode(buf, size) would consume.
+             */
+            static uint32_t measure(const char* buf, uint32_t size);
+
+            /*
+             * One step of a path to a value in an encoded message: a
+             * key in an object or ECMA array, or an index in a list
+             * (the message itself, or a STRICT_ARRAY).
+             *
+             * So { 1, "duration" } is the duration in an onMetaData
+             * message; { 1 } is the transaction ID of a command.
+             */
+            struct PathStep
+            {
+                const char* key;
+                uint32_t    index;
+
+                PathStep(const char* key) : key(key), index(0) { }
+                PathStep(int index) : key(NULL), index(index) { }
+            };
+
+            typedef std::initializer_list<PathStep> Path;
+
+            /*
+             * Replace the value at 'path' in an encoded message with
+             * 'value', without decoding it.  If they're the same size
+             * (a NUMBER, BOOLEAN, or a same length STRING) it's
+             * overwritten in place; if not, the rest of the message is
+             * moved over to fit.  So buf has to have room: capacity is
+             * the size of the buffer, and size the size of the message.
+             *
+             * Both the old and new values have to be simple -- NUMBER,
+             * BOOLEAN, STRING, NILL, DATE, LONG_STRING or XML_DOC --
+             * because replacing objects would throw off references.
+             * That's a runtime_error, as is bad data.  If there's nothing
+             * at 'path', you get an out_of_range, and if there's not
+             * enough room, an overflow_error.
+             *
+             * Returns the new size of the message.
+             */
+            static uint32_t patch(char* buf, uint32_t size,
+                                  uint32_t capacity, Path path,
+                                  const Property& value);
+
+            /*
+             * Same, resizing 'message' as needed.
+             */
+            static void patch(std::vector<char>& message, Path path,
+                              const Property& value);
+
+            /*
+             * Write a STRICT_ARRAY of NUMBERs straight from an array of
+             * doubles, without making a Property for each.  Keyframe
+             * indexes written when finishing an FLV file are what this
+             * is for.  The byte swapping is done in bulk.
+             *
+             * This is a value on its own; if you write it into the
+             * middle of a message, it's up to you to keep REFERENCE
+             * numbers right (it takes up one).  AMF0Builder::addNumbers
+             * puts one in a message you're building.
+             *
+             * Returns the number of bytes written.
+             */
+            static uint32_t encodeStrictArray(Writer& out,
+                                              const double* numbers,
+                                              uint32_t count);
+
+            /*
+             * When decoded with LAZY, nested objects start out unloaded,
+             * and their properties aren't there until load() is called:
+             * properties.propMap (or propList) is NULL, or an empty
+             * container kept by clear().  Calling load() on something that
+             * is already loaded does nothing, so it's always safe to call
+             * before looking at properties.
+             *
+             * encode and encodedSize load whatever they need on their own.
+             *
+             * load will throw the same errors as decode, though it is
+             * unlikely as the buffer has already been checked.  Like
+             * decode, the original buffer must still be around.
+             */
+            void load();
+
+            bool isLoaded() const
+            {
+                return !this->lazyBuf;
+            }
+
+            /*
+             * A STRICT_ARRAY decoded with DENSE_NUMBERS keeps its NUMBERs
+             * here, in order, and its property list is left empty.  For
+             * anything else, numbers() is NULL; so check isDense() before
+             * looking at the list of a STRICT_ARRAY if you decode with
+             * DENSE_NUMBERS.
+             */
+            bool isDense() const
+            {
+                return this->dense != NULL;
+            }
+
+            const double* numbers() const
+            {
+                return this->dense;
+            }
+
+            uint32_t numberCount() const
+            {
+                return this->denseCount;
+            }
+
+            /*
+             * Return size of buffer required to encode this object.
+             * How this buffer is alloc'd is up to the caller.  The
+             * resulting buffer will not be larger than this.
+             *
+             * It iterates over all items and child items, so therefore
+             * this is a potentially expensive call; except for objects
+             * kept unchanged since a KEEP_SOURCE decode, which are just
+             * the size they were decoded from.
+             *
+             * Currently, this does not take into account references
+             * @TODO: Take into account references
+             */
+            uint32_t  encodedSize();
+
+            /*
+             * Method to produce a size (in bytes) to encode a given
+             * Property.
+             */
+            uint32_t  propertySize(const Property& prop);
+
+            /*
+             * This encodes the object into an AMF data stream suitable
+             * for transmission or storage to file system.
+             *
+             * Requires a buffer that we will write to, with a size
+             * parameter to say how much buffer is provided.  It will
+             * return how many bytes of that buffer we actually consumed.
+             *
+             * You can use the "encodedSize" call to figure out the
+             * minimum buffer size required to encode an object.
+             * IMPLEMENTATION NOTE: The top level AMF0 object has no
+             * type; it should be treated like a list.  encodeProperty
+             * will use this method, but it will add the window dressing
+             * (any pre-amble or post-amble bytes).
+             *
+             * The point is, only call this on a top-level AMF0 object.
+             */
+            uint32_t encode(char* buf, uint32_t size);
+
+            /*
+             * Encode, appending to 'out'.  'out' is grown as needed (see
+             * VectorWriter), so there's no overflow to worry about and no
+             * need for encodedSize.
+             *
+             * Returns the number of bytes appended.
+             */
+            uint32_t encode(std::vector<char>& out);
+
+            /*
+             * Encode into a Writer.  See the Writer comments for what's
+             * available.  FixedWriter acts just like encode(buf, size);
+             * the others grow as needed, so don't need encodedSize.
+             *
+             * Objects that came from decode(buf, size) and haven't been
+             * invalidate()'d since are copied straight from the buffer
+             * they were decoded from, so re-encoding a decoded message
+             * after changing a little of it mostly costs the change.
+             * That buffer has to still be around, which it does anyway
+             * for the strings in it.  Objects with references or AVMPLUS
+             * data in them are always encoded the long way.
+             *
+             * Returns the number of bytes written.
+             */
+            uint32_t encode(Writer& out);
+
+            /*
+             * encode(buf, size), without throwing.  We size the message
+             * first, so a property with a bad type is BAD_DATA.  If it
+             * doesn't fit, nothing is written and the Result is
+             * NEED_MORE_ROOM with the exact size needed; as encodedSize
+             * is only an upper bound, we count for real before giving up.
+             */
+            Result tryEncode(char* buf, uint32_t size) noexcept;
+
+            /*
+             * Empty this object so it can be decoded into again, while
+             * keeping its memory.  Child nodes, their property containers
+             * and our reference table are kept in a pool that belongs to
+             * this object, and the next decode takes from there before
+             * going to the heap; so decoding the same shapes of message
+             * over and over (as a connection does with its commands)
+             * stops allocating once the pool has warmed up.
+             *
+             * Call this before decoding into an object again, rather
+             * than making a new one.  Anything you had from the old
+             * tree, including child pointers, is invalid after this.
+             *
+             * If we were decoded into an arena, there's nothing to keep;
+             * the properties are just dropped, like decode(arena) does.
+             */
+            void clear();
+
+            /*
+             * Clean out properties
+             */
+            ~AMF0();
+
+        private:
+            /*
+             * These decoders/encoders are protected because they won't work
+             * right without the reference object.
+             */
+
+            uint32_t    refCount = 0;   // How many references we have.
+                                        // If this is > 0, we should
+                                        // not free it yet.
+
+            uint32_t    decodeFlags = 0;    // Inherited by children.
+
+            // If we're LAZY and haven't been loaded yet, this is where
+            // our encoded properties live.  lazyCount is the STRICT_ARRAY
+            // count, if we are one.
+            const char* lazyBuf = NULL;
+            uint32_t    lazySize = 0;
+            uint32_t    lazyCount = 0;
+
+            // Strings that decode(iov, iovcnt) had to stitch together.
+            Arena*      stitched = NULL;
+
+            // Our elements, if we're a dense STRICT_ARRAY.  If they
+            // came from decode without an arena, they're in denseBuffer,
+            // which we own and keep across clear().
+            const double*   dense = NULL;
+            uint32_t        denseCount = 0;
+            double*         denseBuffer = NULL;
+            uint32_t        denseCapacity = 0;
+
+            /*
+             * What clear() keeps for the next decode.  Nodes are kept by
+             * the kind of container they have, so they can be re-used
+             * without swapping it.  Children share the pool of the
+             * object that was cleared, which is the one that frees it.
+             */
+            struct Pool
+            {
+                std::vector<AMF0*>  maps;
+                std::vector<AMF0*>  lists;
+                PropertyList        references;
+            };
+
+            Pool*       pool = NULL;
+            bool        ownsPool = false;
+
+            /*
+             * Make a child for a nested object -- a map (OBJECT,
+             * ECMA_ARRAY or TYPED_OBJECT) or a list (STRICT_ARRAY).  It
+             * gets our arena, pool and decode flags, and comes from the
+             * pool if there's one there.
+             */
+            AMF0* newChild(bool isMap, const char* name = NULL,
+                           uint32_t nameSize = 0);
+
+            /*
+             * The guts of clear(): put our children in the pool, and
+             * empty ourselves.
+             */
+            void recycle();
+
+            /*
+             * Decode a whole message into ourselves, for decode() and
+             * tryDecode().  If arena is NULL, we use the heap (and our
+             * pool, if we have one).
+             */
+            Result decodeTop(const char* buf, uint32_t size, Arena* arena,
+                             const Limits& limits, uint32_t flags);
+
+            /*
+             * The same for an iovec, with AMF0Decoder.
+             */
+            Result decodeTop(const struct iovec* iov, int iovcnt,
+                             Arena* arena);
+
+            /*
+             * Decode an object or list, and everything nested in it.
+             * Nested objects are kept on a stack of our own rather than
+             * recursing, so limits.maxDepth is all it takes to keep a
+             * message from running us out of stack.
+             *
+             * This is the core of both decode and tryDecode, so it
+             * doesn't throw; errors go in 'result' and we return 0.
+             *
+             * Returns number of bytes consumsed from the buffer.
+             */
+            uint32_t decodeObject(const char* buf, uint32_t size, bool isMap,
+                                  PropertyList& references, Result& result,
+                                  uint32_t arraySize = 0,
+                                  const Limits& limits = Limits());
+
+            /*
+             * Get ready to decode our body: make our container, and if
+             * we're a STRICT_ARRAY that can be dense, decode it now.
+             *
+             * Returns the size of the body if it was decoded, or 0 if
+             * it still needs decoding.
+             */
+            uint32_t beginBody(const char* buf, uint32_t size, bool isMap,
+                               uint32_t arraySize);
+
+            /*
+             * Load a LAZY object, using 'references' as the reference
+             * table for its contents.  Errors go in 'result'.
+             */
+            void load(PropertyList& references, Result& result);
+
+            /*
+             * True if the STRICT_ARRAY body at buf is 'count' NUMBERs.
+             * The caller checks there are count * 9 bytes.
+             */
+            static bool isNumberArray(const char* buf, uint32_t count);
+
+            /*
+             * Byte swap the 'count' NUMBERs at buf into out, in bulk.
+             */
+            static void decodeNumberArray(const char* buf, double* out,
+                                          uint32_t count);
+
+            /*
+             * Write 'count' NUMBERs, type bytes and all, in bulk.
+             */
+            static void encodeNumberArray(Writer& out,
+                                          const double* numbers,
+                                          uint32_t count);
+
+            /*
+             * A REFERENCE pointed into a subtree we haven't loaded yet.
+             * Load it and fix up the reference table.  Errors go in
+             * 'result'.
+             */
+            void resolveReference(PropertyList& references, uint32_t index,
+                                  Result& result);
+
+            /*
+             * What skipObject does when it finds a REFERENCE.
+             *
+             * STOP_AT_REFERENCES - give up (return 0).  LAZY uses this,
+             *                      and gives up at AVMPLUS data too, so
+             *                      the AMF3 is decoded with the rest of
+             *                      the message's limits.
+             * SKIP_REFERENCES    - skip over it.
+             * CHECK_REFERENCES   - skip over it, but fail like decode
+             *                      would if it refers to something that
+             *                      isn't in the reference table yet.
+             *                      complexCount must then be the count
+             *                      for the whole message so far.
+             */
+            enum SkipMode : unsigned char {
+                STOP_AT_REFERENCES = 0, SKIP_REFERENCES, CHECK_REFERENCES
+            };
+
+            /*
+             * Walk over an object or list body without decoding it,
+             * using the same rules and bounds checks as decodeObject.
+             * complexCount is incremented for every complex object found
+             * (i.e. everything that goes into the reference table).
+             *
+             * Returns the number of bytes it takes up, or 0 if it
+             * contains something we can't skip over (a REFERENCE or
+             * AMF3 data, if mode is STOP_AT_REFERENCES).  Like
+             * decodeObject, bad data doesn't throw; it goes in 'result'
+             * and we return 0.  Objects nested more than maxDepth deep
+             * inside are BAD_DATA.
+             */
+            static uint32_t skipObject(const char* buf, uint32_t size,
+                                       bool isMap, uint32_t arraySize,
+                                       uint32_t& complexCount,
+                                       SkipMode mode, Result& result,
+                                       uint32_t maxDepth = MAX_DEPTH);
+
+            /*
+             * If buf starts an OBJECT, ECMA_ARRAY, TYPED_OBJECT or
+             * STRICT_ARRAY, check its header and return how long it is,
+             * along with what its body looks like.  Returns 0 for
+             * anything else, or on error.
+             */
+            static uint32_t skipHeader(const char* buf, uint32_t size,
+                                       bool& isMap, uint32_t& arraySize,
+                                       Result& result);
+
+            /*
+             * OBJECT, ECMA_ARRAY, TYPED_OBJECT or STRICT_ARRAY.
+             */
+            static bool isComplex(unsigned char type);
+
+            /*
+             * Skip a single property, starting at its type byte.  Same
+             * rules as skipObject.
+             */
+            static uint32_t skipProperty(const char* buf, uint32_t size,
+                                         uint32_t& complexCount,
+                                         SkipMode mode, Result& result);
+
+            /*
+             * Find the value at path for patch, and check that it and
+             * 'value' can be swapped.  Returns where it is and how big.
+             */
+            static uint32_t findPatch(const char* buf, uint32_t size,
+                                      Path path, const Property& value,
+                                      uint32_t& at);
+
+            /*
+             * Values that can be patched over one another without
+             * changing the reference table.
+             */
+            static bool isSimple(unsigned char type);
+
+            /*
+             * Encode a simple value into exactly valueSize bytes at buf.
+             */
+            static void writePatch(char* buf, uint32_t valueSize,
+                                   const Property& value);
+
+            friend class AMF0Reader;
+            friend class AMF0Decoder;
+            friend class AMF0Builder;
+            friend class AMF0Binding;
+
+            /*
+             * encodedSize and propertySize, with errors (properties of
+             * a type we can't encode) going in 'result' rather than
+             * being thrown.  tryEncode sizes with these, so once they
+             * pass, encode can't fail for anything but room.
+             */
+            uint32_t encodedSize(Result& result);
+            uint32_t propertySize(const Property& prop, Result& result);
+
+            /*
+             * This encodes an individual AMF property into the provided
+             * Writer.
+             *
+             * references maps objects we've already written to their
+             * reference number, and refCounter is the next number.
+             * They're shared by the whole message.
+             */
+            void encodeProperty(Writer& out, const Property& prop,
+                                std::map<AMF*, uint32_t>& references,
+                                uint32_t& refCounter);
+
+            /*
+             * This encodes the object's properties into the Writer,
+             * without its own type or terminator.
+             *
+             * THIS MUST be called by encodeProperty unless its called
+             * on the top level object.  Generally speaking, this
+             * method shouldn't be used by anyone.
+             */
+            void encodeObject(Writer& out,
+                              std::map<AMF*, uint32_t>& references,
+                              uint32_t& refCounter);
+
+            /*
+             * Encode prop, whose object is unchanged since decode, by
+             * copying the bytes it was decoded from.
+             */
+            void encodeSource(Writer& out, const Property& prop,
+                              AMF0* object,
+                              std::map<AMF*, uint32_t>& references,
+                              uint32_t& refCounter);
+
+    };
+
+/*****************************************************************************
+ * AMF0Reader
+ *
+ * A forward-only cursor over an AMF0 buffer.  This never builds AMF0
+ * objects, and only allocates to step over AVMPLUS (AMF3) objects; it
+ * just walks the bytes, with the same checks as AMF0::decode.  It is for
+ * when you want to look at a message (say, to route it) without paying
+ * to decode it.
+ *
+ * Usage looks like:
+ *
+ *   AMF0Reader reader(buf, size);
+ *
+ *   while(reader.next()) {
+ *       if(reader.type() == AMF0::Types::OBJECT) {
+ *           reader.enterObject();
+ *
+ *           while(reader.next()) {
+ *               // reader.key(), reader.type(), reader.number() ...
+ *           }
+ *       }
+ *   }
+ *
+ * next() returns false at the end of an object, and steps back out to
+ * the parent, so the outer loop just carries on.  Objects you don't
+ * enter are skipped over for you.
+ *
+ * Values returned by key() and string() point into the buffer, just
+ * like a decoded AMF0.
+ *
+ * Errors throw like AMF0::decode: underflow_error if the buffer is cut
+ * short, runtime_error for anything else.  Each call that can fail also
+ * comes in a noexcept flavor that takes an AMF::Result, for a network
+ * loop that would rather not throw; after an error those return false,
+ * and the reader acts as though it's at the end of the buffer.
+ *****************************************************************************/
+
+    class AMF0Reader
+    {
+        public:
+            /*
+             * How deep we'll let objects nest.  We keep our stack inline
+             * so we don't have to allocate.
+             */
+            static const uint32_t MAX_DEPTH = 32;
+
+            AMF0Reader(const char* buf, uint32_t size);
+
+            /*
+             * Move to the next value in the current object or list.
+             * Returns false when there isn't one, in which case we have
+             * stepped out to the parent (if there is one).
+             */
+            bool next();
+            bool next(AMF::Result& result) noexcept;
+
+            /*
+             * Type of the current value.  UNDEFINED and UNSUPPORTED are
+             * reported as NILL, like AMF0::decode does.
+             */
+            AMF0::Types type() const
+            {
+                return (AMF0::Types)this->curType;
+            }
+
+            /*
+             * Key of the current value, if we're in an object.  Otherwise
+             * it has a 0 len.
+             */
+            const AMF::Value& key() const
+            {
+                return this->curKey;
+            }
+
+            /*
+             * Value of a NUMBER or DATE.  For a BOOLEAN this is 0 or 1.
+             */
+            double number() const
+            {
+                return this->curNumber;
+            }
+
+            /*
+             * Value of a STRING, LONG_STRING or XML_DOC.  For a
+             * TYPED_OBJECT, this is the type name, and for AVMPLUS, the
+             * AMF3 value after the marker (see AMF3::decode).
+             */
+            const AMF::Value& string() const
+            {
+                return this->curString;
+            }
+
+            /*
+             * The count on the wire for a STRICT_ARRAY or ECMA_ARRAY,
+             * or the index of a REFERENCE.
+             */
+            uint32_t count() const
+            {
+                return this->curCount;
+            }
+
+            /*
+             * Step into the current value, which must be an OBJECT,
+             * ECMA_ARRAY, TYPED_OBJECT or STRICT_ARRAY.  next() will
+             * then go over its members.
+             */
+            void enterObject();
+            bool enterObject(AMF::Result& result) noexcept;
+
+            /*
+             * Skip the rest of the object we're in and step back out to
+             * its parent.
+             */
+            void leaveObject();
+            bool leaveObject(AMF::Result& result) noexcept;
+
+            /*
+             * Skip over the current value.  You don't need to call this
+             * before next(); it's here for when you want the offset of
+             * whatever follows this value.
+             */
+            void skip();
+            bool skip(AMF::Result& result) noexcept;
+
+            /*
+             * How far into the buffer we are.
+             */
+            uint32_t offset() const
+            {
+                return this->buf - this->start;
+            }
+
+            /*
+             * How deep into objects we are.  The top level is 0.
+             */
+            uint32_t depth() const
+            {
+                return this->level;
+            }
+
+            /*
+             * Where the current value starts (its type byte).
+             */
+            uint32_t valueOffset() const
+            {
+                return this->curStart;
+            }
+
+            /*
+             * Move to the value at 'path', starting from the object or
+             * list we're in.  Returns false if there isn't one; we're
+             * then somewhere after where it would have been.
+             */
+            bool find(AMF0::Path path);
+            bool find(AMF0::Path path, AMF::Result& result) noexcept;
+
+        private:
+            struct Frame
+            {
+                uint32_t    remaining;  // for counted lists
+                bool        isMap;
+                bool        counted;    // i.e. STRICT_ARRAY
+            };
+
+            const char*     start;
+            const char*     buf;
+            uint32_t        size;
+
+            unsigned char   curType = AMF0::Types::INVALID;
+            AMF::Value      curKey;
+            AMF::Value      curString;
+            double          curNumber = 0;
+            uint32_t        curCount = 0;
+            uint32_t        curStart = 0;
+
+            // The current value is an object we haven't entered or
+            // skipped yet.
+            bool            pending = false;
+
+            Frame           frames[MAX_DEPTH];
+            uint32_t        level = 0;
+
+            /*
+             * Read the type and whatever else comes before the body of
+             * the value at buf.
+             */
+            bool readHeader(AMF::Result& result);
+
+            /*
+             * Skip a body described by isMap / counted / remaining.
+             */
+            bool skipBody(bool isMap, bool counted, uint32_t remaining,
+                          AMF::Result& result);
+
+            /*
+             * Stop where we are after an error in 'result'.  Returns
+             * false.
+             */
+            bool stop(AMF::Result& result);
+
+            /*
+             * Leave the current frame.
+             */
+            inline void pop()
+            {
+                if(this->level) {
+                    this->level--;
+                }
+            }
+    };
+
+/*****************************************************************************
+ * AMF0Decoder
+ *
+ * A resumable decoder, for when a message arrives in pieces (e.g. RTMP
+ * chunks) and you don't want to glue them back together first.
+ *
+ * You tell it where to decode to and how big the whole message is, then
+ * feed it pieces as they arrive.  Each call decodes as far as it can and
+ * returns NEED_MORE_DATA until the whole message is done.
+ *
+ *   AMF0Decoder decoder;
+ *   AMF0        message;
+ *
+ *   decoder.begin(message, messageLength);
+ *
+ *   // each time a chunk comes in ...
+ *   if(decoder.feed(chunk, chunkSize) == AMF0Decoder::DONE) {
+ *       // message is ready
+ *   }
+ *
+ * Like AMF0::decode, we don't copy your buffers: strings point into the
+ * pieces you fed us, so keep them around as long as the message.  The one
+ * exception is a string (or key) split across two pieces; those get
+ * stitched together into memory owned by the decoder, or by the arena if
+ * you gave us one.  So keep the decoder around as long as the message,
+ * too -- or until you begin() the next one.
+ *
+ * Running out of data is not an error, but bad data still throws just
+ * like AMF0::decode.  So does a message that ends in the middle of a
+ * value, since we know how long it is supposed to be.  Use tryFeed to
+ * get those errors back in an AMF::Result instead.
+ *
+ * AVMPLUS (AMF3) values can only be decoded whole, so one that is split
+ * between pieces is collected into the same memory as split strings.
+ *****************************************************************************/
+
+    class AMF0Decoder
+    {
+        public:
+            enum Status { DONE = 0, NEED_MORE_DATA };
+
+            AMF0Decoder();
+
+            /*
+             * Start decoding a message of messageSize bytes into target.
+             * Like AMF0::decode, properties are appended to whatever
+             * target already has.
+             */
+            void begin(AMF0& target, uint32_t messageSize);
+
+            /*
+             * Same, but target and everything in it goes into arena.
+             * See AMF0::decode(buf, size, arena).
+             */
+            void begin(AMF0& target, uint32_t messageSize, Arena& arena);
+
+            /*
+             * Decode a piece of the message.  Anything beyond the end
+             * of the message is ignored.
+             */
+            Status feed(const char* buf, uint32_t size);
+
+            /*
+             * The same, but errors come back in the Result instead of
+             * being thrown, like AMF0::tryDecode.  OK means the message
+             * is done, and bytes is consumed(); NEED_MORE_DATA means
+             * feed us more, and bytes is how much of the message has
+             * yet to come.
+             *
+             * A message that ends in the middle of a value, which feed
+             * throws as an underflow_error, is BAD_DATA here, as no more
+             * data is coming to fix it.  After any error, the message is
+             * dropped; begin() the next one.
+             */
+            AMF::Result tryFeed(const char* buf, uint32_t size) noexcept;
+
+            /*
+             * Bytes of the message we've taken so far.
+             */
+            uint32_t consumed() const
+            {
+                return this->total;
+            }
+
+        private:
+            enum State : unsigned char
+            {
+                ITEM,       // start of an item (key length, for maps)
+                KEY,        // key bytes
+                TYPE,       // type byte
+                HEADER,     // fixed size part of the value
+                BODY,       // variable size part (string bytes, names)
+                AVMPLUS     // an AMF3 value
+            };
+
+            /*
+             * One of these for every object we are in the middle of.
+             */
+            struct Frame
+            {
+                AMF0*           node;
+                AMF::Property   prop;       // this object, for the parent
+                AMF::Value      key;        // our key in the parent
+                uint32_t        remaining;  // for counted lists
+                bool            isMap;
+                bool            counted;    // i.e. STRICT_ARRAY
+            };
+
+            AMF0*                   target = NULL;
+            uint32_t                messageSize = 0;
+            uint32_t                total = 0;
+
+            std::vector<Frame>      frames;
+            AMF::PropertyList       references;
+
+            // What we are working on.
+            State                   state = ITEM;
+            unsigned char           type = 0;
+            AMF::Value              key;
+            AMF::Property           prop;
+            uint32_t                keyLen = 0;
+            uint32_t                bodyLen = 0;
+
+            // The piece we are reading from.
+            const char*             piece = NULL;
+            uint32_t                pieceLeft = 0;
+
+            // Partial data from the last piece.  Headers go in scratch;
+            // keys and bodies go in stitch, which is kept.
+            char                    scratch[16];
+            char*                   stitch = NULL;
+            uint32_t                partial = 0;
+
+            Arena                   stitchArena;
+            Arena*                  arena = NULL;
+
+            // An AVMPLUS value we're collecting: we have amf3Have bytes
+            // of it, and look again once we have amf3Want.
+            char*                   amf3Buf = NULL;
+            uint32_t                amf3Have = 0;
+            uint32_t                amf3Want = 0;
+
+            // If we're going over what we collected past the end of an
+            // AVMPLUS value, the rest of the piece.
+            const char*             resume = NULL;
+            uint32_t                resumeLeft = 0;
+
+            /*
+             * Reset our state for a new message.  Split strings are
+             * stitched into 'stitch'.
+             */
+            void start(AMF0& target, uint32_t messageSize, Arena& stitch);
+
+            /*
+             * Get n contiguous bytes, or NULL if we don't have them yet.
+             * Keeps any partial data for next time.  If 'keep' is set,
+             * the bytes have to stay valid for the life of the message.
+             */
+            const char* take(uint32_t n, bool keep = false);
+
+            /*
+             * Move on to 'resume', if we have one.
+             */
+            bool nextPiece();
+
+            /*
+             * Get a whole AVMPLUS value, or NULL if we don't have it
+             * yet (or on error).
+             */
+            const char* collectAMF3(uint32_t& len, AMF::Result& result);
+            bool checkAMF3(const AMF::Result& measured,
+                           AMF::Result& result);
+            void growAMF3(uint32_t need);
+
+            /*
+             * Decode the whole AVMPLUS value at data.
+             */
+            void decodeAMF3(const char* data, uint32_t len,
+                            AMF::Result& result);
+
+            /*
+             * The core of feed and tryFeed.  Errors go in result, as
+             * AMF0::tryDecode would have them.
+             */
+            Status decodePiece(const char* buf, uint32_t size,
+                               AMF::Result& result);
+
+            /*
+             * Decode whole scalars from the piece while they're all there.
+             */
+            bool quick(Frame& frame);
+
+            /*
+             * What to return when take(n) fails.
+             */
+            Status more(uint32_t n, AMF::Result& result);
+
+            /*
+             * What to return after an error.
+             */
+            Status abandon();
+
+            /*
+             * Size of the fixed part of a value of 'type'.
+             */
+            uint32_t headerSize(AMF::Result& result);
+
+            /*
+             * Handle the fixed / variable part of the current value.
+             */
+            void header(const char* data, AMF::Result& result);
+            void body(const char* data, AMF::Result& result);
+
+            /*
+             * Make sure a length we just read can possibly fit.
+             */
+            bool checkLength(uint32_t len, AMF::Result& result);
+
+            /*
+             * Add this->prop to the current object.
+             */
+            void emit();
+
+            /*
+             * Just put it in there; emit, or pop for an object, counts
+             * it once it's done.
+             */
+            void attach();
+
+            /*
+             * Start / finish decoding an object.
+             */
+            void push(AMF0* child, bool isMap, bool counted,
+                      uint32_t remaining, AMF::Result& result);
+            void pop();
+
+            friend class AMF0;
+    };
+
+/*****************************************************************************
+ * AMF0Builder
+ *
+ * Builds an AMF0 message to send, without filling in Property unions and
+ * containers by hand.  Everything -- objects, containers, and copies of
+ * your strings -- comes out of one Arena, so there is nothing to free;
+ * just reset the arena once the message has been sent.
+ *
+ * Usage looks like:
+ *
+ *   Arena       arena;
+ *   AMF0Builder message(arena, 4);
+ *
+ *   message.add("onStatus").add(0).addNull();
+ *   message.addObject(3)
+ *          .add("level", "status")
+ *          .add("code", "NetStream.Play.Start")
+ *          .add("description", "Playing");
+ *
+ *   message.get().encode(out);
+ *
+ * A builder is just a handle on one object.  addObject and friends
+ * return a builder for the new child; copying a builder gives you
+ * another handle on the same object.  Add with a key to objects and ECMA
+ * arrays, and without one to lists (the message itself, and strict
+ * arrays).  The 'reserve' arguments are how many things you're going
+ * to add, if you know.
+ *
+ * Keys and strings given as a const char* are copied into the arena.
+ * Keys are interned, so a key used over and over (say, in an array of
+ * objects) is only stored once.  Strings given as a Value are NOT
+ * copied, so they need to be around until you're done encoding; use
+ * that for big payloads.
+ *
+ * Like PropertyMap::insert, adding a key that is already there does
+ * nothing.
+ *****************************************************************************/
+
+    class AMF0Builder
+    {
+        public:
+            /*
+             * Start a new message in arena.
+             */
+            AMF0Builder(Arena& arena, uint32_t reserve = 0);
+
+            /*
+             * Add a value to a list.
+             */
+            AMF0Builder& add(const char* value);
+            AMF0Builder& add(const AMF::Value& value);
+            AMF0Builder& add(double value);
+            AMF0Builder& add(int value);
+            AMF0Builder& add(bool value);
+            AMF0Builder& addNull();
+
+            /*
+             * Add a value to an object or ECMA array.
+             */
+            AMF0Builder& add(const char* key, const char* value);
+            AMF0Builder& add(const char* key, const AMF::Value& value);
+            AMF0Builder& add(const char* key, double value);
+            AMF0Builder& add(const char* key, int value);
+            AMF0Builder& add(const char* key, bool value);
+            AMF0Builder& addNull(const char* key);
+
+            /*
+             * Add a nested object or array, and return its builder.
+             * Leave out the key (or pass NULL) to add it to a list.
+             */
+            AMF0Builder addObject(uint32_t reserve = 0)
+            {
+                return this->addChild(NULL, AMF0::Types::OBJECT, reserve);
+            }
+
+            AMF0Builder addObject(const char* key, uint32_t reserve = 0)
+            {
+                return this->addChild(key, AMF0::Types::OBJECT, reserve);
+            }
+
+            AMF0Builder addEcmaArray(const char* key, uint32_t reserve = 0)
+            {
+                return this->addChild(key, AMF0::Types::ECMA_ARRAY,
+                                      reserve);
+            }
+
+            AMF0Builder addStrictArray(const char* key,
+                                       uint32_t reserve = 0)
+            {
+                return this->addChild(key, AMF0::Types::STRICT_ARRAY,
+                                      reserve);
+            }
+
+            /*
+             * Add a STRICT_ARRAY of NUMBERs from an array of doubles.
+             * Like strings given as a Value, they are NOT copied, and
+             * are encoded in bulk.
+             */
+            AMF0Builder& addNumbers(const double* numbers, uint32_t count)
+            {
+                return this->addNumbers(NULL, numbers, count);
+            }
+
+            AMF0Builder& addNumbers(const char* key, const double* numbers,
+                                    uint32_t count);
+
+            /*
+             * The object we're building, ready to encode.
+             */
+            AMF0& get()
+            {
+                return *this->object;
+            }
+
+        private:
+            /*
+             * Interned keys: an open-addressing table in the arena,
+             * shared by every builder for the message.
+             */
+            struct Keys
+            {
+                AMF::Value* slots;
+                uint32_t    size;   // always a power of 2
+                uint32_t    count;
+            };
+
+            AMF0*   object;
+            Keys*   keys;
+
+            AMF0Builder(AMF0* object, Keys* keys)
+                : object(object), keys(keys) { }
+
+            /*
+             * Copy a string into the arena.
+             */
+            AMF::Value copy(const char* str);
+
+            /*
+             * Find or copy a key.
+             */
+            AMF::Value intern(const char* key);
+
+            /*
+             * The slot key is in, or the empty one it would go in.
+             */
+            AMF::Value* slotFor(const AMF::Value& key);
+
+            /*
+             * Add prop under key, or to the list if key is NULL.
+             */
+            AMF0Builder& put(const char* key, const AMF::Property& prop);
+
+            AMF0Builder addChild(const char* key, unsigned char type,
+                                 uint32_t reserve);
+
+            /*
+             * A STRING, or a LONG_STRING if it's too long for that.
+             */
+            static AMF::Property string(const AMF::Value& value);
+    };
+
+/*****************************************************************************
+ * AMF0Template
+ *
+ * A message that is sent over and over with the same shape -- _result,
+ * onStatus and so on -- where only a few values change.  We encode it
+ * once, and after that each copy is a few memcpy's with the changing
+ * values (the "slots") written in between.  No walking the tree, no
+ * reference table.
+ *
+ * Build a sample message (AMF0Builder is handy for that), and tell us
+ * which of its properties are slots:
+ *
+ *   AMF0Builder sample(arena, 4);
+ *
+ *   sample.add("_result").add(0).addNull();
+ *   sample.addObject(3)
+ *         .add("level", "status")
+ *         .add("code", "NetStream.Play.Start")
+ *         .add("description", "");
+ *
+ *   AMF::PropertyList& top = *sample.get().properties.propList;
+ *   AMF::Value         key = { "description", 11 };
+ *
+ *   AMF0Template result(sample.get(), {
+ *       &top[1],
+ *       &top[3].property.object->properties.propMap->find(key)->second
+ *   });
+ *
+ * Then for each message, fill in one Property per slot, in the same
+ * order, and render:
+ *
+ *   AMF::Property values[2];
+ *
+ *   values[0].property.number = transactionId;
+ *   values[1].property.value = description;
+ *   result.render(out, values);
+ *
+ * Slots can be NUMBER, BOOLEAN, STRING, LONG_STRING or XML_DOC
+ * properties; a slot keeps the type it had in the sample, so the type
+ * of the Property you pass is ignored.  The sample can be thrown away
+ * once we're made, but it can't contain references.
+ *****************************************************************************/
+
+    class AMF0Template
+    {
+        public:
+            /*
+             * Compile 'message'.  Throws a runtime_error if a slot isn't
+             * in the message or isn't one of the types above.
+             */
+            AMF0Template(AMF0& message,
+                         const std::vector<const AMF::Property*>& slots);
+
+            /*
+             * Bytes needed to render with these values.
+             */
+            uint32_t encodedSize(const AMF::Property* values) const;
+
+            /*
+             * Write a message with these values.  Returns the number
+             * of bytes written.  Throws an overflow_error if a STRING
+             * value is over 64K.
+             */
+            uint32_t render(Writer& out, const AMF::Property* values) const;
+
+            /*
+             * Same, into a buffer of 'size' bytes, like
+             * AMF0::encode(buf, size).
+             */
+            uint32_t render(char* buf, uint32_t size,
+                            const AMF::Property* values) const;
+
+        private:
+            struct Slot
+            {
+                uint32_t        offset;     // where it goes in 'bytes'
+                uint32_t        index;      // which value it is
+                unsigned char   type;
+            };
+
+            // The sample encoded, minus the slots' values (but not their
+            // type bytes).
+            std::vector<char>   bytes;
+
+            // In the order they appear.
+            std::vector<Slot>   slots;
+
+            /*
+             * Find where our slots are in object, which is encoded at
+             * 'offset' of the sample.
+             */
+            void locate(AMF0& object, uint32_t offset,
+                        const std::vector<const AMF::Property*>& wanted);
+
+            /*
+             * If prop is a slot, note that it's at 'offset'.
+             */
+            void check(const AMF::Property& prop, uint32_t offset,
+                       const std::vector<const AMF::Property*>& wanted);
+    };
+
+/*****************************************************************************
+ * AMF0Binding
+ *
+ * Decode an AMF0 object straight into a struct of yours, for messages
+ * you see all the time (connect, play, onMetaData ...) where building
+ * AMF0 objects just to pick a few things out of them is a waste.
+ *
+ * Declare the struct, and a table of the fields you want out of the
+ * object:
+ *
+ *   struct ConnectInfo
+ *   {
+ *       AMF::Value  app;
+ *       AMF::Value  tcUrl;
+ *       double      objectEncoding = 0;
+ *       bool        fpad = false;
+ *   };
+ *
+ *   static const AMF0Field connectFields[] = {
+ *       AMF0_FIELD(ConnectInfo, app, AMF0Field::REQUIRED),
+ *       AMF0_FIELD(ConnectInfo, tcUrl, AMF0Field::REQUIRED),
+ *       AMF0_FIELD(ConnectInfo, objectEncoding, 0),
+ *       AMF0_FIELD(ConnectInfo, fpad, 0)
+ *   };
+ *
+ * Then, with buf at the command object (see AMF0::skipValue to step over
+ * the command name and transaction ID):
+ *
+ *   ConnectInfo info;
+ *
+ *   used = AMF0Binding::decode(buf, size, connectFields, info);
+ *
+ * Fields can be double (NUMBER or DATE), bool (BOOLEAN) or AMF::Value
+ * (STRING, LONG_STRING or XML_DOC; this points into buf, like decode).
+ * The key is the member's name, or use AMF0_FIELD_KEY to give one that
+ * isn't a C++ name.  The struct needs to be standard layout, since we
+ * use offsetof.
+ *
+ * Keys that aren't in the table, and values of the wrong type, are
+ * skipped, and those fields are left alone.  If a REQUIRED one isn't
+ * found, we throw a runtime_error naming it.  Bad data throws just like
+ * AMF0::decode.  tryDecode hands those errors back in an AMF::Result
+ * instead, with a missing field being BAD_DATA.
+ *****************************************************************************/
+
+    struct AMF0Field
+    {
+        enum Flags : uint32_t { REQUIRED = 0x01 };
+
+        const char*     key;
+        uint32_t        keyLen;
+        size_t          offset;
+        unsigned char   type;   // NUMBER, BOOLEAN or STRING
+        uint32_t        flags;
+    };
+
+    /*
+     * What AMF0 type goes in a member of type M.  Only the types below
+     * are supported.
+     */
+    template<typename M> struct AMF0FieldType;
+
+    template<> struct AMF0FieldType<double>
+    {
+        static const unsigned char type = AMF0::Types::NUMBER;
+    };
+
+    template<> struct AMF0FieldType<bool>
+    {
+        static const unsigned char type = AMF0::Types::BOOLEAN;
+    };
+
+    template<> struct AMF0FieldType<AMF::Value>
+    {
+        static const unsigned char type = AMF0::Types::STRING;
+    };
+
+#   define AMF0_FIELD_KEY(Struct, member, key, flags) \
+        { key, sizeof(key) - 1, offsetof(Struct, member), \
+          Tigerdile::AMF0FieldType< \
+                decltype(((Struct*)0)->member)>::type, \
+          flags }
+
+#   define AMF0_FIELD(Struct, member, flags) \
+        AMF0_FIELD_KEY(Struct, member, #member, flags)
+
+    class AMF0Binding
+    {
+        public:
+            /*
+             * Fill 'out' from the OBJECT, ECMA_ARRAY or TYPED_OBJECT at
+             * the start of buf.  Returns the number of bytes it takes
+             * up.  No more than 64 fields, please.
+             */
+            template<typename T, size_t N>
+            static uint32_t decode(const char* buf, uint32_t size,
+                                   const AMF0Field (&fields)[N], T& out)
+            {
+                return decodeObject(buf, size, fields, N, (char*)&out);
+            }
+
+            /*
+             * The same, with errors in the Result like
+             * AMF0::tryDecode.  On OK, bytes is what decode would have
+             * returned.
+             */
+            template<typename T, size_t N>
+            static AMF::Result tryDecode(const char* buf, uint32_t size,
+                                         const AMF0Field (&fields)[N],
+                                         T& out) noexcept
+            {
+                return tryDecodeObject(buf, size, fields, N, (char*)&out);
+            }
+
+        private:
+            static uint32_t decodeObject(const char* buf, uint32_t size,
+                                         const AMF0Field* fields,
+                                         uint32_t count, char* out);
+
+            static AMF::Result tryDecodeObject(const char* buf,
+                                               uint32_t size,
+                                               const AMF0Field* fields,
+                                               uint32_t count,
+                                               char* out) noexcept;
+
+            /*
+             * The core of both.  Sets a bit in 'found' for each field
+             * we fill in, and leaves REQUIRED to the caller.
+             */
+            static uint32_t bindObject(const char* buf, uint32_t size,
+                                       const AMF0Field* fields,
+                                       uint32_t count, char* out,
+                                       uint64_t& found,
+                                       AMF::Result& result);
+
+            /*
+             * The first REQUIRED field not in found, or count.
+             */
+            static uint32_t missing(const AMF0Field* fields,
+                                    uint32_t count, uint64_t found);
+
+            /*
+             * Write the value at buf into field, if it's the right
+             * type.  Returns false if not.
+             */
+            static bool store(const char* buf, const AMF0Field& field,
+                              char* out);
+    };
+
+/*****************************************************************************
+ * AMF0Compact
+ *
+ * A read-only decoded message in about a third of the memory of an AMF0
+ * tree, for when you hold on to a lot of them (say, the onMetaData of
+ * every stream on a server).
+ *
+ * Every value is a CompactValue, which is 8 bytes.  A NUMBER is just its
+ * double.  Anything else goes in the payload of a NaN that no NUMBER
+ * uses; the NaNs we decode are all turned into the one standard NaN.
+ * STRINGs are an offset and length into the buffer.  Objects, and the
+ * rarer DATEs, LONG_STRINGs, XML_DOCs and AVMPLUS values, are a pointer
+ * into the arena.
+ * Keys are an offset and length as well, so an entry in an object takes
+ * 16 bytes, where a PropertyMap entry takes 40.
+ *
+ * Usage looks like:
+ *
+ *   Arena               arena;
+ *   const AMF0Compact&  message = AMF0Compact::decode(buf, size, arena);
+ *   const AMF0Compact*  meta = message[1].object();
+ *   const CompactValue* width = meta->find("width");
+ *
+ *   if(width && width->isNumber()) {
+ *       // width->number() ...
+ *   }
+ *
+ * Like decoding an AMF0 into an arena, the buffer has to stay around,
+ * and resetting the arena frees everything.  Errors are the same too,
+ * except that objects can only nest AMF0Reader::MAX_DEPTH deep.  AVMPLUS
+ * (AMF3) values are checked, but kept as their bytes; string() has them,
+ * ready for AMF3::decode.
+ *****************************************************************************/
+
+    class AMF0Compact;
+
+    class CompactValue
+    {
+        public:
+            /*
+             * The AMF0 type.  Like AMF0::decode, UNDEFINED and
+             * UNSUPPORTED come out as NILL, and a REFERENCE as what it
+             * refers to.
+             */
+            AMF0::Types type() const;
+
+            bool isNumber() const
+            {
+                return this->bits < SPECIAL;
+            }
+
+            /*
+             * A NUMBER or DATE.  A BOOLEAN is 0 or 1, like everywhere
+             * else; anything else is 0.
+             */
+            double number() const;
+
+            bool boolean() const
+            {
+                return this->bits ==
+                       (SPECIAL | 0x100 | AMF0::Types::BOOLEAN);
+            }
+
+            /*
+             * An OBJECT, ECMA_ARRAY, STRICT_ARRAY or TYPED_OBJECT, or
+             * NULL for anything else.
+             */
+            const AMF0Compact* object() const
+            {
+                return ((this->bits & TAG) == OBJECT) ?
+                       (const AMF0Compact*)this->pointer() : NULL;
+            }
+
+        private:
+            // Tags are in the top 16 bits.  Every double, but for NaNs
+            // with the sign bit set, is below SPECIAL.
+            static const uint64_t TAG = 0xFFFF000000000000ull;
+            static const uint64_t SPECIAL = 0xFFF9000000000000ull;
+            static const uint64_t STRING = 0xFFFA000000000000ull;
+            static const uint64_t BOXED = 0xFFFB000000000000ull;
+            static const uint64_t OBJECT = 0xFFFC000000000000ull;
+            static const uint64_t NOT_A_NUMBER = 0x7FF8000000000000ull;
+
+            /*
+             * What a BOXED value points at.
+             */
+            struct Box
+            {
+                unsigned char   type;
+                double          number;
+                AMF::Value      value;
+            };
+
+            // SPECIAL:    (BOOLEAN value << 8) | type
+            // STRING:     (offset << 16) | length
+            // BOXED:      Box*
+            // OBJECT:     AMF0Compact*
+            uint64_t    bits;
+
+            const void* pointer() const
+            {
+                return (const void*)(uintptr_t)(this->bits & ~TAG);
+            }
+
+            friend class AMF0Compact;
+    };
+
+    class AMF0Compact
+    {
+        public:
+            /*
+             * Decode a whole message into arena.  The result is a
+             * STRICT_ARRAY of the values in the message.
+             */
+            static const AMF0Compact& decode(const char* buf, uint32_t size,
+                                             Arena& arena);
+
+            /*
+             * OBJECT, ECMA_ARRAY, STRICT_ARRAY or TYPED_OBJECT.
+             */
+            AMF0::Types type() const
+            {
+                return (AMF0::Types)this->kind;
             }
 
-            static inline void encodeInt32(uint32_t val, char* data)
+            bool isMap() const
             {
-                (*((uint32_t*)data)) = htonl(val);
+                return this->kind != AMF0::Types::STRICT_ARRAY;
             }
 
             /*
-             * This was also shamelessly ripped from librtmp
+             * Number of values, which are in wire order.
              */
-            static inline void encodeNumber(double val, char *data)
+            uint32_t size() const
             {
-#               if __FLOAT_WORD_ORDER == __BYTE_ORDER
-#                   if __BYTE_ORDER == __BIG_ENDIAN
-                        (*((double*)data)) = val;
+                return this->count;
+            }
 
-#                   elif __BYTE_ORDER == __LITTLE_ENDIAN
-                        unsigned char *ci, *co;
-                        ci = (unsigned char *)&val;
-                        co = (unsigned char *)data;
-                        co[0] = ci[7];
-                        co[1] = ci[6];
-                        co[2] = ci[5];
-                        co[3] = ci[4];
-                        co[4] = ci[3];
-                        co[5] = ci[2];
-                        co[6] = ci[1];
-                        co[7] = ci[0];
-#                   endif
-#               else
-#                   if __BYTE_ORDER == __LITTLE_ENDIAN
-                        /* __FLOAT_WORD_ORER == __BIG_ENDIAN */
-                        unsigned char *ci, *co;
-                        ci = (unsigned char *)&val;
-                        co = (unsigned char *)data;
-                        co[0] = ci[3];
-                        co[1] = ci[2];
-                        co[2] = ci[1];
-                        co[3] = ci[0];
-                        co[4] = ci[7];
-                        co[5] = ci[6];
-                        co[6] = ci[5];
-                        co[7] = ci[4];
-#                   else
-    /* __BYTE_ORDER == __BIG_ENDIAN && __FLOAT_WORD_ORER == __LITTLE_ENDIAN */
-                        unsigned char *ci, *co;
-                        ci = (unsigned char *)&val;
-                        co = (unsigned char *)data;
-                        co[0] = ci[4];
-                        co[1] = ci[5];
-                        co[2] = ci[6];
-                        co[3] = ci[7];
-                        co[4] = ci[0];
-                        co[5] = ci[1];
-                        co[6] = ci[2];
-                        co[7] = ci[3];
-#                   endif
-#               endif
+            const CompactValue& operator[](uint32_t i) const
+            {
+                return this->values[i];
             }
 
             /*
-             * This has to be defined by the individual type of AMF
-             * call.
-             *
-             * This will process some buffer of data and load it into
-             * this AMF object.
-             *
-             * Note that the buffer is NOT! owned by the AMF object,
-             * but WILL be used by it.  The goal of this class is to
-             * alloc as little memory as possible and to re-use th
-             * buffer where available.
-             *
-             * Decode will throw an underflow_error if there is not
-             * enough data to decode, or a runtime_error if there
-             * is a problem.
-             *
-             * Returns the number of bytes consumed from the buffer.
+             * The key of value i, if we're a map.
              */
-            virtual uint32_t decode(const char* buf, uint32_t size)
+            AMF::Value key(uint32_t i) const
             {
-                throw std::runtime_error("Needs definition");
+                return this->unpack(this->keys[i]);
             }
 
             /*
-             * Return size of buffer required to encode this object.
-             * How this buffer is alloc'd is up to the caller.  The
-             * resulting buffer will not be larger than this.
-             *
-             * It iterates over all items and child items, so therefore
-             * this is a potentially expensive call.
-             *
-             * This method will not necessarily take into account
-             * compression due to use of references, so the resulting
-             * buffer used could be smaller than this size, but will
-             * never be larger.
+             * The class name, if we're a TYPED_OBJECT.
              */
-            virtual uint32_t  encodedSize()
+            AMF::Value name() const
             {
-                throw std::runtime_error("Needs definition");
+                return this->unpack(this->typeName);
             }
 
             /*
-             * Method to produce a size (in bytes) to encode a given
-             * Property.  For complex objects, this will run encodedSize
-             * on those objects.  encodedSize, in turn, calls this to
-             * size its component properties.
+             * The text of a STRING, LONG_STRING or XML_DOC from this
+             * message, or the AMF3 bytes of an AVMPLUS.  Anything else
+             * has a 0 len.
              */
-            virtual uint32_t  propertySize(const Property& prop)
-            {
-                throw std::runtime_error("Needs definition");
-            }
+            AMF::Value string(const CompactValue& value) const;
 
             /*
-             * This encodes the object into an AMF data stream suitable
-             * for transmission or storage to file system.
-             *
-             * Requires a buffer that we will write to, with a size
-             * parameter to say how much buffer is provided.  It will
-             * return how many bytes of that buffer we actually consumed.
-             *
-             * You can use the "encodedSize" call to figure out the
-             * minimum buffer size required to encode an object.
+             * Look up a key, if we're a map.  NULL if it isn't there.
              */
-            virtual uint32_t encode(char* buf, uint32_t size)
+            const CompactValue* find(const AMF::Value& key) const;
+
+            const CompactValue* find(const char* key) const
+            {
+                AMF::Value wanted;
+
+                wanted.val = key;
+                wanted.len = strlen(key);
+
+                return this->find(wanted);
+            }
+
+        private:
+            const char*         base;       // the buffer we came from
+            const uint64_t*     keys;       // (offset << 16) | length
+            const CompactValue* values;
+            uint64_t            typeName;
+            uint32_t            count;
+            unsigned char       kind;
+
+            AMF::Value unpack(uint64_t packed) const
             {
-                throw std::runtime_error("Needs definition");
+                AMF::Value result;
+
+                result.val = this->base + (packed >> 16);
+                result.len = packed & 0xFFFF;
+
+                return result;
             }
 
             /*
-             * Properties may be either a map or a vector, depending on
-             * if we have names or not.
+             * Make a CompactValue pointing at something in the arena.
              */
-            union Properties {
-                std::map<Value, Property>*  propMap;
-                std::vector<Property>*      propList;
-                Properties() {
-                    memset(this, 0, sizeof(Properties));
-                }
-            };
-
-            Properties  properties;
-            bool        isMap;
-            Value       name;           // This is for "typed" objects.
+            static CompactValue box(uint64_t tag, const void* pointer);
     };
 
 /*****************************************************************************
- * AMF0
+ * ChunkWriter
  *
- * Version 0 of AMF
+ * A Writer that splits what is written to it into RTMP chunks as it goes,
+ * writing the chunk headers in between, so a message can be encoded
+ * straight into a socket buffer with no separate framing pass.
+ *
+ *   GrowableWriter  socketBuf;
+ *   ChunkWriter     chunks(socketBuf, 4096, 3);  // chunk size, stream ID
+ *
+ *   chunks.write(message, 20, 0, 0);  // AMF0 command, message stream 0
+ *
+ * The message gets a type 0 header, and every chunk after that gets a
+ * type 3 header.  Since the type 0 header has the message length in it,
+ * we need to know that up front; write() encodes the message into a
+ * CountingWriter first, as encodedSize doesn't know about references.
+ * For anything other than an AMF0 message, call begin / finish yourself
+ * with the right length.
  *****************************************************************************/
 
-    class AMF0 : public AMF
+    class ChunkWriter : public Writer
     {
         public:
-            enum Types : unsigned char
-                              { NUMBER = 0, BOOLEAN, STRING, OBJECT, MOVIECLIP,
-                                NILL, UNDEFINED, REFERENCE, ECMA_ARRAY,
-                                OBJECT_END, STRICT_ARRAY, DATE, LONG_STRING,
-                                UNSUPPORTED, RECORDSET, XML_DOC, TYPED_OBJECT,
-                                AVMPLUS, INVALID = 0xff };
-
-            /*
-             * Constructor to initialize 'name'.  'name' is used by
-             * AMF TypedObjects.
-             */
-            AMF0(const char* name = NULL, uint32_t nameSize = 0)
-            {
-                this->name.val = name;
-                this->name.len = nameSize;
-            }
-
             /*
-             * This will process some buffer of data and load it into
-             * this AMF object.
-             *
-             * Note that the buffer is NOT! owned by the AMF object,
-             * but WILL be used by it.  The goal of this class is to
-             * alloc as little memory as possible and to re-use th
-             * buffer where available.
-             *
-             * Decode will throw an underflow_error if there is not
-             * enough data to decode, or a runtime_error if there
-             * is a problem.
-             *
-             * This is the top level decode and will loop over
-             * decodeProperty / decodeObject as necessary.
-             *
-             * Returns the number of bytes consumed from the buffer.
+             * Chunks go into 'out'.  chunkSize is the negotiated chunk
+             * size, and chunkStreamId is the chunk stream to send on.
              */
-            uint32_t decode(const char* buf, uint32_t size);
+            ChunkWriter(Writer& out, uint32_t chunkSize,
+                        uint32_t chunkStreamId);
 
             /*
-             * Return size of buffer required to encode this object.
-             * How this buffer is alloc'd is up to the caller.  The
-             * resulting buffer will not be larger than this.
-             *
-             * It iterates over all items and child items, so therefore
-             * this is a potentially expensive call.
-             *
-             * Currently, this does not take into account references
-             * @TODO: Take into account references
+             * Start a message of 'length' bytes by writing its type 0
+             * header.  Then write exactly that many bytes to us, and
+             * call finish().
              */
-            uint32_t  encodedSize();
+            void begin(uint32_t length, unsigned char typeId,
+                       uint32_t messageStreamId, uint32_t timestamp);
 
             /*
-             * Method to produce a size (in bytes) to encode a given
-             * Property.
+             * Finish up the message.  Throws a runtime_error if fewer
+             * bytes were written than begin was told; writing too many
+             * throws an overflow_error as it happens.
              */
-            uint32_t  propertySize(const Property& prop);
+            void finish();
 
             /*
-             * This encodes the object into an AMF data stream suitable
-             * for transmission or storage to file system.
-             *
-             * Requires a buffer that we will write to, with a size
-             * parameter to say how much buffer is provided.  It will
-             * return how many bytes of that buffer we actually consumed.
-             *
-             * You can use the "encodedSize" call to figure out the
-             * minimum buffer size required to encode an object.
-             * IMPLEMENTATION NOTE: The top level AMF0 object has no
-             * type; it should be treated like a list.  encodeProperty
-             * will use this method, but it will add the window dressing
-             * (any pre-amble or post-amble bytes).
-             *
-             * The point is, only call this on a top-level AMF0 object.
+             * begin, encode and finish.  Returns the message length.
              */
-            uint32_t encode(char* buf, uint32_t size);
+            uint32_t write(AMF0& message, unsigned char typeId,
+                           uint32_t messageStreamId, uint32_t timestamp);
 
-            /*
-             * Clean out properties
-             */
-            ~AMF0();
+        protected:
+            void flush(uint32_t need);
+            void appendSlow(const char* data, uint32_t n);
 
         private:
-            /*
-             * These decoders/encoders are protected because they won't work
-             * right without the reference object.
-             */
+            Writer&     out;
+            uint32_t    chunkSize;
+            uint32_t    chunkStreamId;
+            uint32_t    timestamp = 0;
 
-            uint32_t    refCount = 0;   // How many references we have.
-                                        // If this is > 0, we should
-                                        // not free it yet.
+            // Bytes of the message not handed to 'out' yet, and bytes
+            // left in the current chunk.  Both are as of 'start'.
+            uint32_t    messageLeft = 0;
+            uint32_t    chunkLeft = 0;
+
+            // Our window is either in out's buffer, or -- when a value
+            // would straddle two chunks -- in scratch.
+            char        scratch[16];
+            bool        staged = false;
 
             /*
-             * Decode an object or list.  This will loop a call on
-             * decodeProperty over its elements as needed.
-             *
-             * Returns number of bytes consumsed from the buffer.
+             * Hand our window over to 'out'.
              */
-            uint32_t decodeObject(const char* buf, uint32_t size, bool isMap,
-                                  std::vector<Property>& references,
-                                  uint32_t arraySize = 0);
+            void settle();
 
             /*
-             * This encodes an individual AMF property into the provided
-             * buffer.  The buffer must be large enough to handle it.
-             *
-             * You will usually use encode to encode a whole AMF
-             * message, but if you need to encode some small part of
-             * an AMF message, you can use this instead.
-             *
-             * Returns number of bytes consumed.
+             * Copy data into the chunk stream, adding headers as needed.
              */
-            uint32_t encodeProperty(char* buf, uint32_t size, const Property& prop,
-                                    std::map<AMF*, uint32_t>& references,
-                                    uint32_t& refCounter);
+            void drain(const char* data, uint32_t n);
 
             /*
-             * This encodes the object into an AMF data stream suitable
-             * for transmission or storage to file system.
-             *
-             * Requires a buffer that we will write to, with a size
-             * parameter to say how much buffer is provided.  It will
-             * return how many bytes of that buffer we actually consumed.
-             *
-             * THIS MUST be called by encodeProperty unless its called
-             * on the top level object.  Generally speaking, this
-             * method shouldn't be used by anyone.
+             * Write a basic header.
              */
-            uint32_t encodeObject(char* buf, uint32_t size,
-                                  std::map<AMF*, uint32_t>& references,
-                                  uint32_t& refCounter);
+            uint32_t basicHeader(char* p, unsigned char fmt);
 
+            /*
+             * Start the next chunk.
+             */
+            void nextChunk();
     };
 
 /*****************************************************************************
@@ -524,37 +3186,76 @@ namespace Tigerdile
 
             /*
              * This will process some buffer of data and load it into
-             * this AMF object.
+             * this AMF object, as a list of values, until the buffer
+             * runs out.  Each decode has its own string, object and
+             * trait reference tables.
              *
              * Note that the buffer is NOT! owned by the AMF object,
-             * but WILL be used by it.  The goal of this class is to
-             * alloc as little memory as possible and to re-use th
-             * buffer where available.
+             * but WILL be used by it.  Like AMF0, strings, XML and
+             * ByteArrays point into it rather than being copied.
              *
-             * Decode will throw an underflow_error if there is not
-             * enough data to decode, or a runtime_error if there
-             * is a problem.
+             * What each type turns into:
+             *
+             * UNDEFINED, NILL     - just the type.
+             * FALSE, TRUE         - number is 0 or 1.
+             * INTEGER, DOUBLE     - number.  INTEGERs are sign extended.
+             * DATE                - number, in milliseconds.
+             * STRING, XML_DOC,
+             * XML, BYTE_ARRAY     - value.
+             * ARRAY               - a list, or if it has any named
+             *                       members, a map; then the dense part
+             *                       is keyed "0", "1" and so on.
+             * OBJECT              - a map, with the class name in 'name'.
+             *                       Sealed members come first, then any
+             *                       dynamic ones.  Externalizable
+             *                       objects can't be decoded, as only
+             *                       their class knows what's in them.
+             * VECTOR_INT,
+             * VECTOR_UINT,
+             * VECTOR_DOUBLE       - a list of INTEGERs or DOUBLEs.
+             * VECTOR_OBJECT       - a list, with the type name in 'name'.
+             * DICTIONARY          - a list of keys and values, in turn.
              *
-             * The third parameter, isMap, will indicate if we're expecting
-             * to load a map with key value pairs or just a list of
-             * something.
+             * A reference to an object is a Property pointing at the
+             * same node, so a tree can go in circles.  That's fine; we
+             * free what decode made without following them.
              *
-             * The fourth parameter, if non-zero AND isMap is false,
-             * will be used as a hard limit of how many records
-             * we will process -- basically that's to support AMF's
-             * "strict array" type.
+             * Decode will throw an underflow_error if there is not
+             * enough data to decode, a runtime_error if there is a
+             * problem, or an out_of_range for a bad reference.
              *
              * Returns the number of bytes consumed from the buffer.
              */
             uint32_t decode(const char* buf, uint32_t size);
 
+            /*
+             * The deepest objects can be nested, same as AMF0.
+             */
+            static const uint32_t MAX_DEPTH = AMF0::MAX_DEPTH;
+
+            /*
+             * Same as above, but every node, property container and the
+             * reference tables come out of the provided arena, like
+             * AMF0::decode(buf, size, arena).
+             */
+            uint32_t decode(const char* buf, uint32_t size, Arena& arena);
+
+            /*
+             * The same decodes, but errors come back in the Result
+             * instead of being thrown, like AMF0::tryDecode.
+             */
+            Result tryDecode(const char* buf, uint32_t size) noexcept;
+
+            Result tryDecode(const char* buf, uint32_t size,
+                             Arena& arena) noexcept;
+
             /*
              * Return size of buffer required to encode this object.
-             * How this buffer is alloc'd is up to the caller.  The
-             * resulting buffer will not be larger than this.
              *
-             * It iterates over all items and child items, so therefore
-             * this is a potentially expensive call.
+             * We don't have an AMF3 encoder yet, so we can only encode
+             * what was decoded and hasn't been changed since (see
+             * invalidate()), which is just a copy.  Anything else is a
+             * runtime_error.
              */
             uint32_t  encodedSize();
 
@@ -572,17 +3273,16 @@ namespace Tigerdile
              * parameter to say how much buffer is provided.  It will
              * return how many bytes of that buffer we actually consumed.
              *
-             * You can use the "encodedSize" call to figure out the
-             * minimum buffer size required to encode an object.
-             * IMPLEMENTATION NOTE: The top level AMF0 object has no
-             * type; it should be treated like a list.  encodeProperty
-             * will use this method, but it will add the window dressing
-             * (any pre-amble or post-amble bytes).
-             *
-             * The point is, only call this on a top-level AMF0 object.
+             * The same as encodedSize goes: for now, this only copies
+             * out what we were decoded from.
              */
             uint32_t encode(char* buf, uint32_t size);
 
+            /*
+             * Same, but into a Writer.
+             */
+            uint32_t encode(Writer& out);
+
             /*
              * Clean out properties
              */
@@ -590,54 +3290,100 @@ namespace Tigerdile
 
         private:
             /*
-             * Decode an AMF3 freak 29-bit integer.
+             * Decode an AMF3 freak 29-bit integer into 'value'.
              *
-             * This can have a reference bit (for string decoding)
-             * Returns the value of the AMF3 integer, and if provided,
-             * will put the reference bit in the provided second parameter.
+             * This can have a reference bit (for string decoding) in
+             * the bottom; that's left for the caller to pick off.
              *
              * We won't know ahead of time how many bytes are going to
              * be consumed, so we need a size parameter that we will
-             * decriment with whatever we consumed.
+             * decriment with whatever we consumed.  Returns false,
+             * leaving size alone, if the buffer ends first.
              */
-            inline uint32_t decodeInt29(const unsigned char* buf,
-                                        uint32_t& size)
+            static inline bool decodeInt29(const unsigned char* buf,
+                                           uint32_t& size, uint32_t& value)
             {
                 if(size && buf[0] < 0x80) {
                     size--;
-                    return buf[0];
+                    value = buf[0];
                 } else if((size > 1) && (buf[1] < 0x80)) {
                     size -= 2;
-                    return ((buf[0] & 0x7F) << 7) | buf[1];
+                    value = ((buf[0] & 0x7F) << 7) | buf[1];
                 } else if((size > 2) && (buf[2] < 0x80)) {
                     size -= 3;
-                    return ((buf[0] & 0x7F) << 14) |
-                           ((buf[1] & 0x7F) << 7) | buf[2];
+                    value = ((buf[0] & 0x7F) << 14) |
+                            ((buf[1] & 0x7F) << 7) | buf[2];
                 } else if(size > 3) {
                     size -= 4;
-                    return ((buf[0] & 0x7F) << 22) |
-                           ((buf[1] & 0x7F) << 15) |
-                           ((buf[2] & 0x7F) << 8) | buf[3];
+                    value = ((buf[0] & 0x7F) << 22) |
+                            ((buf[1] & 0x7F) << 15) |
+                            ((buf[2] & 0x7F) << 8) | buf[3];
                 } else {
-                    throw std::underflow_error(
-                        "Not enough bytes to decode Int29"
-                    );
+                    return false;
                 }
+
+                return true;
             }
 
             /*
-             * Shortcut for handling the type -- our buf is usually not
-             * const char but must be for bit manipulation.
+             * Decode into ourselves, for decode() and tryDecode().  If
+             * arena is NULL, we use the heap.
              */
-            inline uint32_t decodeInt29(const char* buf, uint32_t& size)
-            {
-                return this->decodeInt29((const unsigned char*)buf, size);
-            }
+            Result decodeTop(const char* buf, uint32_t size, Arena* arena);
+
+            /*
+             * Decode 'count' values into our list, or if count is 0,
+             * as many as there are in the buffer.  Nested objects are
+             * kept on a stack of our own rather than recursing.
+             *
+             * This is the core of decode, tryDecode and AMF0's AVMPLUS
+             * (which is one value), so it doesn't throw; errors go in
+             * 'result' and we return 0.
+             *
+             * limits.maxDepth is how deep objects can go below us, and
+             * 'nodes' is how many values have been decoded so far,
+             * which we add ours to and check against limits.maxNodes.
+             * Plain AMF3 decodes use the default Limits.
+             *
+             * Returns number of bytes consumsed from the buffer.
+             */
+            uint32_t decodeValues(const char* buf, uint32_t size,
+                                  uint32_t count, Result& result,
+                                  const AMF0::Limits& limits,
+                                  uint32_t& nodes);
+
+            /*
+             * Find where 'count' values end, with the same checks as
+             * decodeValues, but without decoding them.  This is how
+             * AMF0 steps over AVMPLUS data.  Only objects can be
+             * nested, up to maxDepth.
+             *
+             * Returns the number of bytes they take up, or 0 with the
+             * error in 'result'.
+             */
+            static uint32_t skipValues(const char* buf, uint32_t size,
+                                       uint32_t count, Result& result,
+                                       uint32_t maxDepth = MAX_DEPTH);
 
             uint32_t    refCount = 0;   // How many references we have.
                                         // If this is > 0, we should
                                         // not free it yet.
 
+            // If we were decoded into without an arena, every node
+            // decode made under us.  We free them all, without walking
+            // the tree, since references can make it go in circles.
+            std::vector<AMF3*>* decoded = NULL;
+
+            // Set on the nodes in someone's 'decoded'; they only free
+            // their own container.
+            bool        owned = false;
+
+            // Keys for the dense part of ARRAYs that are maps, which
+            // aren't in the buffer.  Only used without an arena.
+            Arena*      indexKeys = NULL;
+
+            friend class AMF0;
+            friend class AMF0Decoder;
     };
 }
 
@@ -15,6 +15,11 @@
 
 #include "amf.hpp"
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#   include <immintrin.h>
+#   define TDAMF_SSSE3
+#endif
+
 using namespace Tigerdile;
 
 /*****************************************************************************
@@ -35,27 +40,415 @@ using namespace Tigerdile;
  * is a problem.
  */
 uint32_t AMF0::decode(const char* buf, uint32_t size)
+{
+    return this->decode(buf, size, (uint32_t)0);
+}
+
+/*
+ * Decode with DecodeFlags.
+ */
+uint32_t AMF0::decode(const char* buf, uint32_t size, uint32_t flags)
+{
+    return this->decode(buf, size, Limits(), flags);
+}
+
+/*
+ * Decode with Limits.
+ */
+uint32_t AMF0::decode(const char* buf, uint32_t size, const Limits& limits,
+                      uint32_t flags)
+{
+    Result result = this->decodeTop(buf, size, NULL, limits, flags);
+
+    if(result.status) {
+        raise(result);
+    }
+
+    return result.bytes;
+}
+
+/*
+ * Same as above, but everything we allocate -- child nodes, property
+ * containers and the reference table -- comes out of 'arena'.
+ */
+uint32_t AMF0::decode(const char* buf, uint32_t size, Arena& arena,
+                      uint32_t flags)
+{
+    return this->decode(buf, size, arena, Limits(), flags);
+}
+
+uint32_t AMF0::decode(const char* buf, uint32_t size, Arena& arena,
+                      const Limits& limits, uint32_t flags)
+{
+    Result result = this->decodeTop(buf, size, &arena, limits, flags);
+
+    if(result.status) {
+        raise(result);
+    }
+
+    return result.bytes;
+}
+
+/*
+ * The decodes that don't throw.
+ */
+AMF::Result AMF0::tryDecode(const char* buf, uint32_t size,
+                            uint32_t flags) noexcept
+{
+    return this->decodeTop(buf, size, NULL, Limits(), flags);
+}
+
+AMF::Result AMF0::tryDecode(const char* buf, uint32_t size,
+                            const Limits& limits, uint32_t flags) noexcept
+{
+    return this->decodeTop(buf, size, NULL, limits, flags);
+}
+
+AMF::Result AMF0::tryDecode(const char* buf, uint32_t size, Arena& arena,
+                            uint32_t flags) noexcept
+{
+    return this->decodeTop(buf, size, &arena, Limits(), flags);
+}
+
+AMF::Result AMF0::tryDecode(const char* buf, uint32_t size, Arena& arena,
+                            const Limits& limits, uint32_t flags) noexcept
+{
+    return this->decodeTop(buf, size, &arena, limits, flags);
+}
+
+/*
+ * Decode the message itself, remembering where it came from.
+ */
+AMF::Result AMF0::decodeTop(const char* buf, uint32_t size, Arena* arena,
+                            const Limits& limits, uint32_t flags)
 {
     // Keep our references ready
-    std::vector<Property>   references;
+    PropertyList    local{PropertyList::allocator_type(arena)};
+    PropertyList&   references = (this->pool && !arena) ?
+                                 this->pool->references : local;
+    Result          result;
+    uint32_t        res;
+    bool            appending;
+
+    // Whatever we had before belongs to someone else's arena (or has
+    // already been freed by a reset), so just forget it.
+    if(arena) {
+        this->arena = arena;
+        this->properties.propMap = NULL;
+    }
+
+    references.clear();
+
+    // The top level's source can only stand for the whole list if the
+    // list was empty; otherwise we're appending to it.
+    appending = this->properties.propList &&
+                !this->properties.propList->empty();
+
+    this->decodeFlags = flags;
+    this->invalidate();
+
+    if(size > limits.maxBytes) {
+        fail(result, BAD_DATA, "Message is too big");
+        return result;
+    }
+
+    res = this->decodeObject(buf, size, false, references, result, 0,
+                             limits);
+
+    if(result.status) {
+        return result;
+    }
+
+    if(appending) {
+        this->source = NULL;
+    }
+
+    result.bytes = res;
+
+    return result;
+}
+
+/*
+ * Decode a message spread over several buffers.
+ */
+uint32_t AMF0::decode(const struct iovec* iov, int iovcnt)
+{
+    Result result = this->decodeTop(iov, iovcnt, NULL);
+
+    if(result.status) {
+        raise(result);
+    }
+
+    return result.bytes;
+}
+
+/*
+ * Same as above, but everything comes out of the arena.
+ */
+uint32_t AMF0::decode(const struct iovec* iov, int iovcnt, Arena& arena)
+{
+    Result result = this->decodeTop(iov, iovcnt, &arena);
+
+    if(result.status) {
+        raise(result);
+    }
+
+    return result.bytes;
+}
+
+AMF::Result AMF0::tryDecode(const struct iovec* iov, int iovcnt) noexcept
+{
+    return this->decodeTop(iov, iovcnt, NULL);
+}
+
+AMF::Result AMF0::tryDecode(const struct iovec* iov, int iovcnt,
+                            Arena& arena) noexcept
+{
+    return this->decodeTop(iov, iovcnt, &arena);
+}
+
+/*
+ * Feed the iovec to an AMF0Decoder, one buffer at a time.
+ */
+AMF::Result AMF0::decodeTop(const struct iovec* iov, int iovcnt,
+                            Arena* arena)
+{
+    AMF0Decoder decoder;
+    Result      result;
+    uint64_t    total = 0;
+
+    // The common case of the message being in one chunk.
+    if(iovcnt == 1) {
+        return this->decodeTop((const char*)iov[0].iov_base,
+                               (uint32_t)iov[0].iov_len, arena, Limits(), 0);
+    }
+
+    for(int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+
+    if(total > UINT32_MAX) {
+        fail(result, NEED_MORE_ROOM, "iovec is larger than 4GB");
+        return result;
+    }
+
+    if(arena) {
+        decoder.begin(*this, (uint32_t)total, *arena);
+    } else {
+        // Anything we stitch has to live as long as we do.
+        if(!this->stitched) {
+            this->stitched = new Arena(1024);
+        }
+
+        decoder.start(*this, (uint32_t)total, *this->stitched);
+    }
+
+    for(int i = 0; i < iovcnt; i++) {
+        decoder.decodePiece((const char*)iov[i].iov_base,
+                            (uint32_t)iov[i].iov_len, result);
+
+        if(result.status) {
+            return result;
+        }
+    }
+
+    result.bytes = decoder.consumed();
+
+    return result;
+}
+
+/*
+ * Load a LAZY object.
+ */
+void AMF0::load()
+{
+    if(this->lazyBuf) {
+        PropertyList    references{PropertyList::allocator_type(this->arena)};
+        Result          result;
+
+        this->load(references, result);
+
+        if(result.status) {
+            raise(result);
+        }
+    }
+}
+
+/*
+ * Load a LAZY object, using 'references' as the reference table for its
+ * contents.
+ */
+void AMF0::load(PropertyList& references, Result& result)
+{
+    if(this->lazyBuf) {
+        const char* buf = this->lazyBuf;
+
+        this->lazyBuf = NULL;
+        this->decodeObject(buf, this->lazySize, this->isMap, references,
+                           result, this->lazyCount);
+    }
+}
+
+/*
+ * Make a child for a nested object.  It gets our arena, pool and decode
+ * flags.  A pooled node has already been emptied by recycle.
+ */
+AMF0* AMF0::newChild(bool isMap, const char* name, uint32_t nameSize)
+{
+    AMF0* child;
+
+    if(this->pool && !this->arena &&
+       !(isMap ? this->pool->maps : this->pool->lists).empty()) {
+        std::vector<AMF0*>& spare = isMap ? this->pool->maps :
+                                            this->pool->lists;
+
+        child = spare.back();
+        spare.pop_back();
+
+        child->name.val = name;
+        child->name.len = nameSize;
+        child->parent = this;
+    } else {
+        child = this->createChild<AMF0>(name, nameSize);
+        child->pool = this->pool;
+        child->isMap = isMap;
+    }
 
-    return this->decodeObject(buf, size, false, references, 0);
+    child->decodeFlags = this->decodeFlags;
+
+    return child;
+}
+
+/*
+ * A REFERENCE pointed at an INVALID placeholder, which means it wants
+ * something inside a lazy object we haven't loaded.  Load that object
+ * (not lazily, so everything in it is real) and put its contents into
+ * the reference table where the placeholders were.
+ */
+void AMF0::resolveReference(PropertyList& references, uint32_t index,
+                            Result& result)
+{
+    AMF0*           owner = (AMF0*)references[index].property.object;
+    PropertyList    local{PropertyList::allocator_type(this->arena)};
+    uint32_t        base = index;
+
+    // Find the first placeholder for this owner.
+    while(base && (references[base - 1].type == Types::INVALID) &&
+          (references[base - 1].property.object == owner)) {
+        base--;
+    }
+
+    owner->decodeFlags &= ~LAZY;
+    owner->load(local, result);
+
+    // There's a placeholder for everything in there.
+    for(uint32_t i = 0; (i < local.size()) &&
+                        (base + i < references.size()); i++) {
+        references[base + i] = local[i];
+    }
+}
+
+/*
+ * Make our container, and decode a dense list right away.
+ */
+uint32_t AMF0::beginBody(const char* buf, uint32_t size, bool isMap,
+                         uint32_t arraySize)
+{
+    this->initProperties(isMap);
+
+    // A list of nothing but NUMBERs, which we keep as doubles.
+    if(!isMap && arraySize && (this->decodeFlags & DENSE_NUMBERS) &&
+       (size / 9 >= arraySize) && isNumberArray(buf, arraySize)) {
+        double* numbers;
+
+        if(this->arena) {
+            numbers = (double*)this->arena->allocate(
+                          arraySize * sizeof(double), alignof(double)
+                      );
+        } else {
+            // We may still have a big enough one from before clear().
+            if(this->denseCapacity < arraySize) {
+                delete[] this->denseBuffer;
+                this->denseBuffer = new double[arraySize];
+                this->denseCapacity = arraySize;
+            }
+
+            numbers = this->denseBuffer;
+        }
+
+        decodeNumberArray(buf, numbers, arraySize);
+
+        this->dense = numbers;
+        this->denseCount = arraySize;
+
+        return arraySize * 9;
+    }
+
+    return 0;
 }
 
 /*
- * Decode an object or list.  This will loop a call on
- * decodeProperty over its elements as needed.
+ * Decode an object or list, and everything in it.
+ *
+ * Each object we're in the middle of has a Frame on our stack; stack[0]
+ * is us.  When a nested object starts, we add it to its parent, push a
+ * frame for it and carry on with its body.  When it ends, we pop back to
+ * its parent and add it to the reference table -- after everything in
+ * it, just like the spec wants.
+ *
+ * Nested objects that we don't have to decode now (empty lists, dense
+ * lists and LAZY objects) are finished on the spot instead.
+ *
+ * Everything complex inside a lazy object still needs a slot in the
+ * reference table so that later indexes line up.  We fill those slots
+ * with INVALID placeholders pointing at the lazy object; see
+ * resolveReference.
  *
  * Returns number of bytes consumsed from the buffer.
  */
 uint32_t AMF0::decodeObject(const char* buf, uint32_t size, bool isMap,
-                            std::vector<Property>& references,
-                            uint32_t arraySize)
+                            PropertyList& references, Result& result,
+                            uint32_t arraySize, const Limits& limits)
 {
-    Value name;
-    Property prop;
-    uint32_t originalSize = size;
-    uint32_t objectCount = 0;
+    struct Frame
+    {
+        AMF0*       node;
+        const char* start;          // where its body starts
+        uint32_t    complexBefore;  // references.size() at the start
+        uint32_t    arraySize;
+        uint32_t    objectCount;
+        Property    prop;           // what's in its parent
+        bool        clean;          // can be copied as-is by encode
+    };
+
+    Frame       stack[MAX_DEPTH + 1];
+    Frame*      frame = stack;
+    Frame*      deepest = stack + MIN(limits.maxDepth, MAX_DEPTH);
+    bool        keepSource = this->decodeFlags & KEEP_SOURCE;
+    Value       name;
+    Property    prop;
+    uint32_t    originalSize = size;
+    uint32_t    nodes = 0;
+    uint32_t    res;
+    AMF0*       child;
+    bool        childIsMap;
+    uint32_t    childCount;
+
+    // A value is cut short; we need 'n' more bytes from here.
+    auto underflow = [&](const char* message, uint64_t n) {
+        return fail(result, NEED_MORE_DATA, message,
+                    originalSize - size + n);
+    };
+
+    // Nothing we're in can be copied as-is by encode.  Objects only get
+    // a source once they're decoded, so a failed decode leaves none.
+    auto dirty = [&]() {
+        for(Frame* open = stack; open <= frame; open++) {
+            open->clean = false;
+        }
+
+        frame->node->invalidate();
+    };
 
 #   ifdef DEBUG
         if(isMap){
@@ -67,38 +460,72 @@ uint32_t AMF0::decodeObject(const char* buf, uint32_t size, bool isMap,
         }
 #   endif
 
-    if((this->isMap = isMap) && (!this->properties.propMap)) {
-        this->properties.propMap = new std::map<Value, Property>();
-    } else if(!this->properties.propList) {
-        this->properties.propList = new std::vector<Property>();
+    if((res = this->beginBody(buf, size, isMap, arraySize))) {
+        return res;
     }
 
-    while(size > 0 && ((arraySize == 0) || (objectCount < arraySize))) {
-        // We're looking for hex 0x00 0x00 0x09 
-        if((size >= 3) &&
+    frame->node = this;
+    frame->start = buf;
+    frame->complexBefore = references.size();
+    frame->arraySize = arraySize;
+    frame->objectCount = 0;
+    frame->clean = keepSource;
+
+    while(true) {
+        bool done = !size || (frame->arraySize &&
+                              (frame->objectCount >= frame->arraySize));
+
+        // We're looking for hex 0x00 0x00 0x09, which only ends maps;
+        // in a list those bytes are the start of a NUMBER.
+        if(!done && frame->node->isMap && (size >= 3) &&
            (buf[0] == 0x00 && buf[1] == 0x00 && buf[2] == 0x09)) {
-            // We're done here
             size -= 3;
             buf += 3;
-            break;
+            done = true;
+        }
+
+        if(done) {
+            // We're done here.  A REFERENCE or AVMPLUS anywhere inside
+            // makes us dirty; see below.
+            child = frame->node;
+
+            if(frame->clean) {
+                child->source = frame->start;
+                child->sourceSize = buf - frame->start;
+                child->sourceComplex = references.size() -
+                                       frame->complexBefore;
+            }
+
+            if(frame == stack) {
+                break;
+            }
+
+            prop = frame->prop;
+            frame--;
+
+            // add to references; it's already in its parent.
+            references.push_back(prop);
+            frame->objectCount++;
+            continue;
         }
 
         // try to decode the property
         // If we're loading as a map (object) then there will
         // be a string key first.
-        if(isMap) {
+        if(frame->node->isMap) {
             if(size < 4) {
-                // error
-                throw std::underflow_error(
-                    "isMap is true and size less than 4 bytes"
+                // error; though an OBJECT_END would only need 3.
+                return underflow(
+                    "isMap is true and size less than 4 bytes",
+                    size < 3 ? 3 : 4
                 );
             }
 
 
             name.len = this->decodeInt16(buf);
             if(name.len > size - 2) {
-                throw std::underflow_error(
-                    "Got out-of-bounds name.len"
+                return underflow(
+                    "Got out-of-bounds name.len", name.len + 3
                 );
             }
 
@@ -108,6 +535,16 @@ uint32_t AMF0::decodeObject(const char* buf, uint32_t size, bool isMap,
             name.val = buf;
             size -= name.len;
             buf += name.len;
+
+            if(!size) {
+                return underflow(
+                    "No type byte after name", 1
+                );
+            }
+        }
+
+        if(++nodes > limits.maxNodes) {
+            return fail(result, BAD_DATA, "Too many values in message");
         }
 
         // Type will be the first byte.
@@ -115,14 +552,18 @@ uint32_t AMF0::decodeObject(const char* buf, uint32_t size, bool isMap,
         buf++;
         size--;
 
+        child = NULL;
+        childIsMap = true;
+        childCount = 0;
+
         // What the type is determines how we proces it.
         // This may be better implemented in a number of ways, such as
         // some kind of callback map
         switch((Types)prop.type) {
             case Types::NUMBER: // a "double" - 8 bttes, IEEE-754
                 if(size < 8) {
-                    throw std::underflow_error(
-                        "Could not decode number - less than 8 bytes"
+                    return underflow(
+                        "Could not decode number - less than 8 bytes", 8
                     );
                 }
 
@@ -132,8 +573,8 @@ uint32_t AMF0::decodeObject(const char* buf, uint32_t size, bool isMap,
                 break;
             case Types::BOOLEAN: // Single byte, true/false
                 if(size < 1) {
-                    throw std::underflow_error(
-                        "Could not decode boolean - less than 1 byte"
+                    return underflow(
+                        "Could not decode boolean - less than 1 byte", 1
                     );
                 }
 
@@ -143,8 +584,8 @@ uint32_t AMF0::decodeObject(const char* buf, uint32_t size, bool isMap,
                 break;
             case Types::STRING: // "small" string, 2 bytes length then string.
                 if(size < 3) {
-                    throw std::underflow_error(
-                        "String requires at least 3 bytes in buffer."
+                    return underflow(
+                        "String requires at least 3 bytes in buffer.", 3
                     );
                 }
 
@@ -154,8 +595,9 @@ uint32_t AMF0::decodeObject(const char* buf, uint32_t size, bool isMap,
                 size -= 2;
 
                 if(size < prop.property.value.len) {
-                    throw std::underflow_error(
-                        "Couldn't decode a string with not enough buffer"
+                    return underflow(
+                        "Couldn't decode a string with not enough buffer",
+                        prop.property.value.len
                     );
                 }
 
@@ -167,8 +609,8 @@ uint32_t AMF0::decodeObject(const char* buf, uint32_t size, bool isMap,
                 // This is an associative array.  It has a 4-byte count
                 // then otherwise is treated like an object.
                 if(size < 4) {
-                    throw std::underflow_error(
-                        "ECMA_ARRAY with not enough bytes"
+                    return underflow(
+                        "ECMA_ARRAY with not enough bytes", 4
                     );
                 }
 
@@ -177,23 +619,26 @@ uint32_t AMF0::decodeObject(const char* buf, uint32_t size, bool isMap,
                 // if it doesn't match expectations, but I'm not
                 // sure why we'd really care that much.
                 // @TODO ?
-                size -= 4;
-                buf += 4;
-            case Types::OBJECT: // This will be a "map" basically.
+                //
+                // We do use it as a hint for sizing our map, as long
+                // as it's sane (every entry is at least 3 bytes).
                 {
-                    uint32_t res;
+                    uint32_t hint = this->decodeInt32(buf);
 
-                    prop.property.object = new AMF0();
-                    res = ((AMF0*)prop.property.object)
-                                ->decodeObject(buf, size, true, references);
+                    size -= 4;
+                    buf += 4;
 
-                    buf += res;
-                    size -= res;
-                }
+                    child = frame->node->newChild(true);
 
-                // add to references
-                references.push_back(prop);
+                    if((hint <= size / 3) && !(this->decodeFlags & LAZY)) {
+                        child->initProperties(true);
+                        child->properties.propMap->reserve(hint);
+                    }
+                }
 
+                break;
+            case Types::OBJECT: // This will be a "map" basically.
+                child = frame->node->newChild(true);
                 break;
             case Types::TYPED_OBJECT:
                 /* From the AMF0 spec
@@ -207,42 +652,28 @@ uint32_t AMF0::decodeObject(const char* buf, uint32_t size, bool isMap,
                  * Read string which is the type name, and the rest is the
                  * object.
                  */
-                {
-                    uint32_t res;
-
-                    if(size < 2) {
-                        // Minimum
-                        throw std::underflow_error(
-                            "TYPED_OBJECT without enough buffer for type str"
-                        );
-                    }
-
-                    res = this->decodeInt16(buf);
-
-                    buf += 2;
-                    size -= 2;
-
-                    if(size < res) {
-                        throw std::underflow_error(
-                            "TYPED_OBJECT without enough buffer to load name"
-                        );
-                    }
-
-                    prop.property.object = new AMF0(buf, res);
+                if(size < 2) {
+                    // Minimum
+                    return underflow(
+                        "TYPED_OBJECT without enough buffer for type str", 2
+                    );
+                }
 
-                    buf += res;
-                    size -= res;
+                res = this->decodeInt16(buf);
 
-                    res = ((AMF0*)prop.property.object)->
-                                    decodeObject(buf, size, true, references);
+                buf += 2;
+                size -= 2;
 
-                    buf += res;
-                    size -= res;
+                if(size < res) {
+                    return underflow(
+                        "TYPED_OBJECT without enough buffer to load name", res
+                    );
                 }
 
-                // add to references
-                references.push_back(prop);
+                child = frame->node->newChild(true, buf, res);
 
+                buf += res;
+                size -= res;
                 break;
             case Types::REFERENCE:
                 /* From the AMF0 spec
@@ -251,7 +682,7 @@ uint32_t AMF0::decodeObject(const char* buf, uint32_t size, bool isMap,
                  * typed object, an array or an ecma-array. If the exact
                  * same instance of a complex object appears more than once
                  * in an object graph then it must be sent by reference. The
-                 * reference type uses an unsigned 16- bit integer to point 
+                 * reference type uses an unsigned 16- bit integer to point
                  * to an index in a table of previously serialized objects.
                  * Indices start at 0.
                  *
@@ -261,16 +692,40 @@ uint32_t AMF0::decodeObject(const char* buf, uint32_t size, bool isMap,
                  * I got this a little wrong, but, hey, I'm trying :)
                  */
                 if(size < 2) {
-                    throw std::underflow_error(
-                        "Could not decode reference -- less than 2 bytes"
+                    return underflow(
+                        "Could not decode reference -- less than 2 bytes", 2
                     );
                 }
 
-                prop = references.at(this->decodeInt16(buf));
+                {
+                    uint32_t index = this->decodeInt16(buf);
+
+                    if(index >= references.size()) {
+                        return fail(result, BAD_REFERENCE,
+                            "Reference to an object that isn't decoded yet"
+                        );
+                    }
+
+                    // Points inside something we haven't loaded yet.
+                    if(references[index].type == Types::INVALID) {
+                        this->resolveReference(references, index, result);
+
+                        if(result.status) {
+                            return 0;
+                        }
+                    }
+
+                    prop = references[index];
+                }
 
                 // add to reference count
                 ((AMF0*)prop.property.object)->refCount++;
 
+                // Reference numbers depend on everything before them
+                // in the message, so whatever we're in can't be copied
+                // as-is by encode.
+                dirty();
+
                 buf += 2;
                 size -= 2;
                 break;
@@ -278,7 +733,7 @@ uint32_t AMF0::decodeObject(const char* buf, uint32_t size, bool isMap,
             case Types::RECORDSET:
                 // These are not supported -- Movieclip is a reserved type
                 // in AMF0 with no implementation, as is RECORDSET.
-                throw std::runtime_error("Reserved/Unsupported type!");
+                return fail(result, BAD_DATA, "Reserved/Unsupported type!");
             case Types::UNDEFINED:
             case Types::UNSUPPORTED:
                 // These two will be treated like null
@@ -289,31 +744,28 @@ uint32_t AMF0::decodeObject(const char* buf, uint32_t size, bool isMap,
             case Types::STRICT_ARRAY:
                 // This is a numeric array.
                 if(size < 4) {
-                    throw std::underflow_error(
-                        "STRICT_ARRAY type with not enough bytes"
+                    return underflow(
+                        "STRICT_ARRAY type with not enough bytes", 4
                     );
                 }
-                {
-                    uint32_t res;
-
-                    // use arrayCount instead of arraySize to support
-                    // nested arrays.  Be careful!
-                    uint32_t arrayCount = this->decodeInt32(buf);
-                    buf += 4;
-                    size -= 4;
 
-                    prop.property.object = new AMF0();
-                    res = ((AMF0*)prop.property.object)->
-                            decodeObject(buf, size, false, references,
-                                         arrayCount);
+                // use childCount instead of arraySize to support
+                // nested arrays.  Be careful!
+                childCount = this->decodeInt32(buf);
+                buf += 4;
+                size -= 4;
 
-                    buf += res;
-                    size -= res;
+                // Every element is at least a byte, so don't go any
+                // further with a count that can't be right.
+                if(childCount > size) {
+                    return underflow(
+                        "STRICT_ARRAY count is larger than the buffer",
+                        childCount
+                    );
                 }
 
-                // add to references
-                references.push_back(prop);
-
+                child = frame->node->newChild(false);
+                childIsMap = false;
                 break;
             case Types::DATE:
                 /*
@@ -339,8 +791,8 @@ uint32_t AMF0::decodeObject(const char* buf, uint32_t size, bool isMap,
                  * @TODO : log it?  Care?  I dunno
                  */
                 if(size < 10) {
-                    throw std::underflow_error(
-                        "Got DATE type but not enough bytes"
+                    return underflow(
+                        "Got DATE type but not enough bytes", 10
                     );
                 }
 
@@ -356,8 +808,8 @@ uint32_t AMF0::decodeObject(const char* buf, uint32_t size, bool isMap,
                 // These are identical types according to spec.
                 // This must be a least 4 bytes
                 if(size < 4) {
-                    throw std::underflow_error(
-                        "Not enough bytes to process LONG_STRING/XML_DOC"
+                    return underflow(
+                        "Not enough bytes to process LONG_STRING/XML_DOC", 4
                     );
                 }
 
@@ -367,8 +819,9 @@ uint32_t AMF0::decodeObject(const char* buf, uint32_t size, bool isMap,
 
                 // do we have enough?
                 if(size < prop.property.value.len) {
-                    throw std::underflow_error(
-                        "Not enough bytes to load LONG_STRING/XML_DOC"
+                    return underflow(
+                        "Not enough bytes to load LONG_STRING/XML_DOC",
+                        prop.property.value.len
                     );
                 }
 
@@ -378,42 +831,825 @@ uint32_t AMF0::decodeObject(const char* buf, uint32_t size, bool isMap,
                 size -= prop.property.value.len;
                 break;
             case Types::AVMPLUS:
-                // Swap to AMF3 decoder.
+                // Swap to AMF3 decoder for one value, which has reference
+                // tables of its own.  Like objects, it goes in first.
+                // It gets whatever is left of our limits: the marker
+                // stands for the value after it, and objects in there
+                // are as deep as they would have been in its place.
                 {
-                    uint32_t res = 0;
+                    AMF3*   amf3 = frame->node->createChild<AMF3>();
+                    Limits  inner = limits;
+
+                    inner.maxDepth = (uint32_t)(deepest - frame);
+                    nodes--;
 
-                    prop.property.object = new AMF3();
-                    res = prop.property.object->decode(buf, size);
+                    prop.property.object = amf3;
+                    frame->node->addProperty(name, prop);
 
-                    buf += res;
-                    size -= res;
+                    res = amf3->decodeValues(buf, size, 1, result, inner,
+                                             nodes);
 
-                    // @TODO: I think once in AVMPLUS mode we're
-                    // always in AMF3 from here on out -- verify.
-                    // Maybe get mad if buffer isn't empty ?
-                    // or force an abort out of decode?
+                    if(result.status) {
+                        return failedAt(result, originalSize - size);
+                    }
                 }
-                break;
+
+                // We don't know what's in there, so don't copy it.
+                dirty();
+
+                buf += res;
+                size -= res;
+
+                frame->objectCount++;
+                continue;
             default:
-                throw std::runtime_error("Unknown type received");
+                return fail(result, BAD_DATA, "Unknown type received");
         }
 
-        // Add it to our map or vector
-        // Use emplace_back ?  Could save some CPU
-        if(isMap) {
-            this->properties.propMap->insert(
-                std::pair<Value, Property>(name, prop)
-            );
-        } else {
-            this->properties.propList->push_back(prop);
+        // Add it to our map or vector.  Objects go in before they're
+        // decoded, so that if something in them turns out to be bad,
+        // what we've made so far is freed with the rest of the tree.
+        if(child) {
+            prop.property.object = child;
+        }
+
+        frame->node->addProperty(name, prop);
+
+        if(!child) {
+            frame->objectCount++;
+            continue;
+        }
+
+        if(frame == deepest) {
+            return fail(result, BAD_DATA, "Objects nested too deep");
+        }
+
+        res = 0;
+
+        if(!childIsMap && !childCount) {
+            // An empty STRICT_ARRAY; there's nothing to decode.
+            child->initProperties(false);
+        } else if(this->decodeFlags & LAZY) {
+            // Just measure it and remember where it is, unless it has
+            // something we can't skip; then decode it now.
+            uint32_t complexCount = 0;
+
+            res = skipObject(buf, size, childIsMap, childCount,
+                             complexCount, STOP_AT_REFERENCES, result,
+                             deepest - frame - 1);
+
+            if(result.status) {
+                return failedAt(result, originalSize - size);
+            }
+
+            if(res) {
+                Property placeholder;
+
+                child->lazyBuf = buf;
+                child->lazySize = res;
+                child->lazyCount = childCount;
+
+                if(keepSource) {
+                    child->source = buf;
+                    child->sourceSize = res;
+                    child->sourceComplex = complexCount;
+                }
+
+                placeholder.type = Types::INVALID;
+                placeholder.property.object = child;
+
+                for(uint32_t i = 0; i < complexCount; i++) {
+                    references.push_back(placeholder);
+                }
+            }
+        }
+
+        if(!res && (childIsMap || childCount)) {
+            res = child->beginBody(buf, size, childIsMap, childCount);
+
+            if(!res) {
+                frame++;
+                frame->node = child;
+                frame->start = buf;
+                frame->complexBefore = references.size();
+                frame->arraySize = childCount;
+                frame->objectCount = 0;
+                frame->prop = prop;
+                frame->clean = keepSource;
+                continue;
+            }
+
+            // Dense arrays count each number, as AMF3 vectors do.
+            if((uint64_t)nodes + childCount > limits.maxNodes) {
+                return fail(result, BAD_DATA, "Too many values in message");
+            }
+
+            nodes += childCount;
+
+            if(keepSource) {
+                child->source = buf;
+                child->sourceSize = res;
+                child->sourceComplex = 0;
+            }
         }
 
-        objectCount++;
+        buf += res;
+        size -= res;
+
+        // add to references
+        references.push_back(prop);
+        frame->objectCount++;
     }
 
     return originalSize - size;
 }
 
+/*
+ * Every ninth byte is a type, and they all have to be NUMBER (0).
+ */
+bool AMF0::isNumberArray(const char* buf, uint32_t count)
+{
+    unsigned char types = 0;
+
+    for(uint32_t i = 0; i < count; i++) {
+        types |= buf[i * 9];
+    }
+
+    return !types;
+}
+
+#ifdef TDAMF_SSSE3
+/*
+ * Checked once.  __builtin_cpu_init is needed in case the first decode
+ * happens in a static constructor.
+ */
+static bool haveSSSE3()
+{
+    static const bool result = (__builtin_cpu_init(),
+                                __builtin_cpu_supports("ssse3"));
+
+    return result;
+}
+
+/*
+ * Four NUMBERs are 36 bytes: three 16 byte loads, and a shuffle per
+ * double to drop the type bytes and reverse the rest.  Returns how many
+ * were done; the caller does the leftovers.
+ */
+__attribute__((target("ssse3")))
+static uint32_t decodeNumbersSSSE3(const char* buf, double* out,
+                                   uint32_t count)
+{
+    // Bytes 1-16: the first double, a type, 7 bytes of the second.
+    const __m128i first = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0,
+                                        -1, 15, 14, 13, 12, 11, 10, 9);
+    // Bytes 17-32: the last byte of the second, the third, and the
+    // start of the fourth.
+    const __m128i second = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+                                         0, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i third = _mm_setr_epi8(9, 8, 7, 6, 5, 4, 3, 2,
+                                        -1, -1, -1, -1, -1, -1, -1, -1);
+    // Bytes 20-35: the end of which is the fourth.
+    const __m128i fourth = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+                                         15, 14, 13, 12, 11, 10, 9, 8);
+    uint32_t i;
+
+    for(i = 0; i + 4 <= count; i += 4) {
+        const char* p = &buf[i * 9];
+        __m128i     a = _mm_loadu_si128((const __m128i*)(p + 1));
+        __m128i     b = _mm_loadu_si128((const __m128i*)(p + 17));
+        __m128i     c = _mm_loadu_si128((const __m128i*)(p + 20));
+
+        _mm_storeu_si128((__m128i*)&out[i],
+                         _mm_or_si128(_mm_shuffle_epi8(a, first),
+                                      _mm_shuffle_epi8(b, second)));
+        _mm_storeu_si128((__m128i*)&out[i + 2],
+                         _mm_or_si128(_mm_shuffle_epi8(b, third),
+                                      _mm_shuffle_epi8(c, fourth)));
+    }
+
+    return i;
+}
+#endif
+
+/*
+ * Use SSSE3 if the CPU has it, and decodeNumber for anything left.
+ */
+void AMF0::decodeNumberArray(const char* buf, double* out,
+                             uint32_t count)
+{
+    uint32_t i = 0;
+
+#   ifdef TDAMF_SSSE3
+        if(haveSSSE3()) {
+            i = decodeNumbersSSSE3(buf, out, count);
+        }
+#   endif
+
+    for(; i < count; i++) {
+        out[i] = decodeNumber(&buf[i * 9 + 1]);
+    }
+}
+
+#ifdef TDAMF_SSSE3
+/*
+ * The reverse of decodeNumbersSSSE3: four doubles become 36 bytes, as
+ * three 16 byte stores.  The last one overlaps the one before it, with
+ * the same bytes.  Returns how many were done.
+ */
+__attribute__((target("ssse3")))
+static uint32_t encodeNumbersSSSE3(char* buf, const double* numbers,
+                                   uint32_t count)
+{
+    // Bytes 0-15, from the first two doubles.
+    const __m128i first = _mm_setr_epi8(-1, 7, 6, 5, 4, 3, 2, 1,
+                                        0, -1, 15, 14, 13, 12, 11, 10);
+    // Bytes 16-31, from all four.
+    const __m128i second = _mm_setr_epi8(9, 8, -1, -1, -1, -1, -1, -1,
+                                         -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i third = _mm_setr_epi8(-1, -1, -1, 7, 6, 5, 4, 3,
+                                        2, 1, 0, -1, 15, 14, 13, 12);
+    // Bytes 20-35, from the last two.
+    const __m128i fourth = _mm_setr_epi8(6, 5, 4, 3, 2, 1, 0, -1,
+                                         15, 14, 13, 12, 11, 10, 9, 8);
+    uint32_t i;
+
+    for(i = 0; i + 4 <= count; i += 4) {
+        char*   p = &buf[i * 9];
+        __m128i a = _mm_loadu_si128((const __m128i*)&numbers[i]);
+        __m128i b = _mm_loadu_si128((const __m128i*)&numbers[i + 2]);
+
+        _mm_storeu_si128((__m128i*)p, _mm_shuffle_epi8(a, first));
+        _mm_storeu_si128((__m128i*)(p + 16),
+                         _mm_or_si128(_mm_shuffle_epi8(a, second),
+                                      _mm_shuffle_epi8(b, third)));
+        _mm_storeu_si128((__m128i*)(p + 20), _mm_shuffle_epi8(b, fourth));
+    }
+
+    return i;
+}
+#endif
+
+/*
+ * Write as many elements as fit in out's window at a time, so big
+ * arrays go straight in without a Property each or a copy.  We only ever
+ * reserve one element's worth, which every Writer can give us.
+ */
+void AMF0::encodeNumberArray(Writer& out, const double* numbers,
+                             uint32_t count)
+{
+    char*       p;
+    uint32_t    n;
+    uint32_t    i;
+
+    while(count) {
+        p = out.reserve(9);
+        n = MIN(count, out.available() / 9);
+        i = 0;
+
+#       ifdef TDAMF_SSSE3
+            if(haveSSSE3()) {
+                i = encodeNumbersSSSE3(p, numbers, n);
+            }
+#       endif
+
+        for(; i < n; i++) {
+            p[i * 9] = Types::NUMBER;
+            encodeNumber(numbers[i], &p[i * 9 + 1]);
+        }
+
+        out.commit(n * 9);
+        numbers += n;
+        count -= n;
+    }
+}
+
+/*
+ * A whole STRICT_ARRAY from a span.
+ */
+uint32_t AMF0::encodeStrictArray(Writer& out, const double* numbers,
+                                 uint32_t count)
+{
+    char* p = out.reserve(5);
+
+    p[0] = Types::STRICT_ARRAY;
+    encodeInt32(count, &p[1]);
+    out.commit(5);
+
+    encodeNumberArray(out, numbers, count);
+
+    return 5 + count * 9;
+}
+
+/*
+ * Measure the value at the start of buf.
+ */
+uint32_t AMF0::skipValue(const char* buf, uint32_t size)
+{
+    uint32_t complexCount = 0;
+
+    return skipValue(buf, size, complexCount);
+}
+
+/*
+ * Same, carrying the reference count over from earlier values.
+ */
+uint32_t AMF0::skipValue(const char* buf, uint32_t size,
+                         uint32_t& complexCount)
+{
+    Result      result;
+    uint32_t    res;
+
+    if(!size) {
+        TDAMF_THROW(std::underflow_error("No type byte to skip"));
+    }
+
+    res = skipProperty(buf, size, complexCount, CHECK_REFERENCES, result);
+
+    if(result.status) {
+        raise(result);
+    }
+
+    return res;
+}
+
+/*
+ * Measure a whole message.
+ */
+uint32_t AMF0::measure(const char* buf, uint32_t size)
+{
+    Result      result;
+    uint32_t    complexCount = 0;
+    uint32_t    res = skipObject(buf, size, false, 0, complexCount,
+                                 CHECK_REFERENCES, result);
+
+    if(result.status) {
+        raise(result);
+    }
+
+    return res;
+}
+
+/*
+ * Values that can be patched over one another without changing the
+ * reference table.
+ */
+bool AMF0::isSimple(unsigned char type)
+{
+    switch(type) {
+        case AMF0::Types::NUMBER:
+        case AMF0::Types::BOOLEAN:
+        case AMF0::Types::STRING:
+        case AMF0::Types::NILL:
+        case AMF0::Types::UNDEFINED:
+        case AMF0::Types::UNSUPPORTED:
+        case AMF0::Types::DATE:
+        case AMF0::Types::LONG_STRING:
+        case AMF0::Types::XML_DOC:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Patch a message in a buffer.
+ */
+uint32_t AMF0::patch(char* buf, uint32_t size, uint32_t capacity,
+                     Path path, const Property& value)
+{
+    AMF0        sizer;
+    uint32_t    at;
+    uint32_t    oldSize = findPatch(buf, size, path, value, at);
+    uint64_t    valueSize = sizer.propertySize(value);
+
+    if((uint64_t)size - oldSize + valueSize > capacity) {
+        TDAMF_THROW(std::overflow_error("Not enough room to patch"));
+    }
+
+    if(valueSize != oldSize) {
+        memmove(&buf[at + valueSize], &buf[at + oldSize],
+                size - at - oldSize);
+    }
+
+    writePatch(&buf[at], valueSize, value);
+
+    return size - oldSize + valueSize;
+}
+
+/*
+ * Patch a message in a vector.
+ */
+void AMF0::patch(std::vector<char>& message, Path path,
+                 const Property& value)
+{
+    AMF0        sizer;
+    uint32_t    at;
+    uint32_t    oldSize;
+    uint64_t    valueSize = sizer.propertySize(value);
+    uint32_t    size = message.size();
+
+    oldSize = findPatch(message.data(), size, path, value, at);
+
+    if((uint64_t)size - oldSize + valueSize > UINT32_MAX) {
+        TDAMF_THROW(std::overflow_error("Can't encode more than 4GB"));
+    }
+
+    if(valueSize > oldSize) {
+        message.resize(size - oldSize + valueSize);
+    }
+
+    if(valueSize != oldSize) {
+        memmove(&message[at + valueSize], &message[at + oldSize],
+                size - at - oldSize);
+    }
+
+    writePatch(&message[at], valueSize, value);
+    message.resize(size - oldSize + valueSize);
+}
+
+/*
+ * Walk to the value with AMF0Reader, and make sure it's something we can
+ * patch over.
+ */
+uint32_t AMF0::findPatch(const char* buf, uint32_t size, Path path,
+                         const Property& value, uint32_t& at)
+{
+    AMF0Reader reader(buf, size);
+
+    if(!isSimple(value.type)) {
+        TDAMF_THROW(std::runtime_error("Can only patch in simple values"));
+    }
+
+    if((value.type == Types::STRING) && (value.property.value.len > 0xFFFF)) {
+        TDAMF_THROW(std::overflow_error("STRING is over 64K"));
+    }
+
+    if(!reader.find(path)) {
+        TDAMF_THROW(std::out_of_range("Nothing to patch at that path"));
+    }
+
+    at = reader.valueOffset();
+
+    if(!isSimple(buf[at])) {
+        TDAMF_THROW(std::runtime_error("Can only patch over simple values"));
+    }
+
+    return reader.offset() - at;
+}
+
+/*
+ * Encode the value; the encoder needs a reference table, but simple
+ * values don't use it.
+ */
+void AMF0::writePatch(char* buf, uint32_t valueSize, const Property& value)
+{
+    AMF0                        encoder;
+    FixedWriter                 out(buf, valueSize);
+    std::map<AMF*, uint32_t>    references;
+    uint32_t                    counter = 0;
+
+    encoder.encodeProperty(out, value, references, counter);
+}
+
+/*
+ * Walk over an object or list body without decoding it, using the same
+ * rules and bounds checks as decodeObject.
+ *
+ * Returns the number of bytes it takes up, or 0 if it contains
+ * something we can't skip over.
+ */
+uint32_t AMF0::skipObject(const char* buf, uint32_t size, bool isMap,
+                          uint32_t arraySize, uint32_t& complexCount,
+                          SkipMode mode, Result& result,
+                          uint32_t maxDepth)
+{
+    // All we need to know about the objects we're in.
+    struct Frame
+    {
+        bool        isMap;
+        uint32_t    arraySize;
+        uint32_t    objectCount;
+    };
+
+    Frame       stack[MAX_DEPTH + 1];
+    Frame*      frame = stack;
+    Frame*      deepest = stack + MIN(maxDepth, MAX_DEPTH);
+    uint32_t    originalSize = size;
+    uint32_t    res;
+    bool        childIsMap;
+    uint32_t    childCount;
+
+    frame->isMap = isMap;
+    frame->arraySize = arraySize;
+    frame->objectCount = 0;
+
+    while(true) {
+        bool done = !size || (frame->arraySize &&
+                              (frame->objectCount >= frame->arraySize));
+
+        if(!done && frame->isMap && (size >= 3) &&
+           (buf[0] == 0x00 && buf[1] == 0x00 && buf[2] == 0x09)) {
+            buf += 3;
+            size -= 3;
+            done = true;
+        }
+
+        if(done) {
+            if(frame == stack) {
+                break;
+            }
+
+            frame--;
+            frame->objectCount++;
+            complexCount++;
+            continue;
+        }
+
+        if(frame->isMap) {
+            if(size < 4) {
+                return fail(result, NEED_MORE_DATA,
+                            "isMap is true and size less than 4 bytes",
+                            (uint64_t)originalSize - size +
+                            (size < 3 ? 3 : 4));
+            }
+
+            res = decodeInt16(buf);
+
+            if(res >= size - 2) {
+                return fail(result, NEED_MORE_DATA,
+                            "Got out-of-bounds name.len",
+                            (uint64_t)originalSize - size + res + 3);
+            }
+
+            size -= 2 + res;
+            buf += 2 + res;
+        }
+
+        // Big lists are nearly always numbers (onMetaData's keyframe
+        // times and positions), so run through those without a call.
+        if(!frame->isMap) {
+            uint32_t run = 0;
+            uint32_t max = frame->arraySize ?
+                           frame->arraySize - frame->objectCount : UINT32_MAX;
+
+            while((run < max) && (size >= 9) &&
+                  (buf[0] == Types::NUMBER)) {
+                buf += 9;
+                size -= 9;
+                run++;
+            }
+
+            frame->objectCount += run;
+
+            if(run) {
+                continue;
+            }
+        }
+
+        // Objects get a frame of their own; anything else is skipped
+        // in one go.
+        if(isComplex(buf[0])) {
+            res = skipHeader(buf, size, childIsMap, childCount, result);
+
+            if(result.status) {
+                return failedAt(result, originalSize - size);
+            }
+
+            if(frame == deepest) {
+                return fail(result, BAD_DATA, "Objects nested too deep");
+            }
+
+            buf += res;
+            size -= res;
+
+            // An empty STRICT_ARRAY is done already.
+            if(!childIsMap && !childCount) {
+                frame->objectCount++;
+                complexCount++;
+                continue;
+            }
+
+            frame++;
+            frame->isMap = childIsMap;
+            frame->arraySize = childCount;
+            frame->objectCount = 0;
+            continue;
+        }
+
+        if(!(res = skipProperty(buf, size, complexCount, mode, result))) {
+            return failedAt(result, originalSize - size);
+        }
+
+        buf += res;
+        size -= res;
+        frame->objectCount++;
+    }
+
+    return originalSize - size;
+}
+
+/*
+ * Everything that goes in the reference table.
+ */
+bool AMF0::isComplex(unsigned char type)
+{
+    switch((Types)type) {
+        case Types::OBJECT:
+        case Types::ECMA_ARRAY:
+        case Types::TYPED_OBJECT:
+        case Types::STRICT_ARRAY:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Check the header of an object, and find out what its body is like.
+ */
+uint32_t AMF0::skipHeader(const char* buf, uint32_t size, bool& isMap,
+                          uint32_t& arraySize, Result& result)
+{
+    uint32_t nameLen;
+
+    isMap = true;
+    arraySize = 0;
+
+    // Caller makes sure we have at least the type byte.
+    switch((Types)buf[0]) {
+        case Types::OBJECT:
+            return 1;
+        case Types::ECMA_ARRAY:
+            if(size < 5) {
+                return fail(result, NEED_MORE_DATA,
+                    "ECMA_ARRAY with not enough bytes", 5);
+            }
+
+            return 5;
+        case Types::TYPED_OBJECT:
+            if(size < 3) {
+                return fail(result, NEED_MORE_DATA,
+                    "TYPED_OBJECT without enough buffer for type str", 3);
+            }
+
+            nameLen = decodeInt16(&buf[1]);
+
+            if(size - 3 < nameLen) {
+                return fail(result, NEED_MORE_DATA,
+                    "TYPED_OBJECT without enough buffer to load name",
+                    3 + nameLen);
+            }
+
+            return 3 + nameLen;
+        case Types::STRICT_ARRAY:
+            if(size < 5) {
+                return fail(result, NEED_MORE_DATA,
+                    "STRICT_ARRAY type with not enough bytes", 5);
+            }
+
+            isMap = false;
+            arraySize = decodeInt32(&buf[1]);
+
+            // Same check as decodeObject.
+            if(arraySize > size - 5) {
+                return fail(result, NEED_MORE_DATA,
+                    "STRICT_ARRAY count is larger than the buffer",
+                    (uint64_t)5 + arraySize);
+            }
+
+            return 5;
+        default:
+            return 0;
+    }
+}
+
+/*
+ * Skip a single property, starting at its type byte.
+ */
+uint32_t AMF0::skipProperty(const char* buf, uint32_t size,
+                            uint32_t& complexCount, SkipMode mode,
+                            Result& result)
+{
+    uint32_t res;
+
+    // Caller makes sure we have at least the type byte.
+    switch((Types)buf[0]) {
+        case Types::NUMBER:
+            if(size < 9) {
+                return fail(result, NEED_MORE_DATA,
+                    "Could not decode number - less than 8 bytes", 9);
+            }
+
+            return 9;
+        case Types::BOOLEAN:
+            if(size < 2) {
+                return fail(result, NEED_MORE_DATA,
+                    "Could not decode boolean - less than 1 byte", 2);
+            }
+
+            return 2;
+        case Types::STRING:
+            if(size < 4) {
+                return fail(result, NEED_MORE_DATA,
+                    "String requires at least 3 bytes in buffer.", 4);
+            }
+
+            res = 3 + decodeInt16(&buf[1]);
+
+            if(size < res) {
+                return fail(result, NEED_MORE_DATA,
+                    "Couldn't decode a string with not enough buffer", res);
+            }
+
+            return res;
+        case Types::OBJECT:
+        case Types::ECMA_ARRAY:
+        case Types::TYPED_OBJECT:
+        case Types::STRICT_ARRAY:
+            {
+                bool        isMap;
+                uint32_t    arraySize;
+                uint32_t    header = skipHeader(buf, size, isMap, arraySize,
+                                                    result);
+
+                if(result.status) {
+                    return 0;
+                }
+
+                if(!isMap && !arraySize) {
+                    complexCount++;
+                    return header;
+                }
+
+                res = skipObject(&buf[header], size - header, isMap,
+                                 arraySize, complexCount, mode, result);
+                complexCount++;
+
+                return res ? header + res : failedAt(result, header);
+            }
+        case Types::REFERENCE:
+            if(mode == STOP_AT_REFERENCES) {
+                return 0;
+            }
+
+            if(size < 3) {
+                return fail(result, NEED_MORE_DATA,
+                    "Could not decode reference -- less than 2 bytes", 3);
+            }
+
+            // Just like decode.
+            if((mode == CHECK_REFERENCES) &&
+               (decodeInt16(&buf[1]) >= complexCount)) {
+                return fail(result, BAD_REFERENCE,
+                            "Reference to an object that isn't decoded yet");
+            }
+
+            return 3;
+        case Types::AVMPLUS:
+            if(mode == STOP_AT_REFERENCES) {
+                return 0;
+            }
+
+            // One AMF3 value, with reference tables of its own.
+            res = AMF3::skipValues(&buf[1], size - 1, 1, result);
+
+            return res ? 1 + res : failedAt(result, 1);
+        case Types::MOVIECLIP:
+        case Types::RECORDSET:
+            return fail(result, BAD_DATA, "Reserved/Unsupported type!");
+        case Types::UNDEFINED:
+        case Types::UNSUPPORTED:
+        case Types::NILL:
+            return 1;
+        case Types::DATE:
+            if(size < 11) {
+                return fail(result, NEED_MORE_DATA,
+                    "Got DATE type but not enough bytes", 11);
+            }
+
+            return 11;
+        case Types::LONG_STRING:
+        case Types::XML_DOC:
+            if(size < 5) {
+                return fail(result, NEED_MORE_DATA,
+                    "Not enough bytes to process LONG_STRING/XML_DOC", 5);
+            }
+
+            res = decodeInt32(&buf[1]);
+
+            if(size - 5 < res) {
+                return fail(result, NEED_MORE_DATA,
+                    "Not enough bytes to load LONG_STRING/XML_DOC",
+                    (uint64_t)5 + res);
+            }
+
+            return 5 + res;
+        default:
+            return fail(result, BAD_DATA, "Unknown type received");
+    }
+}
+
 
 /*
  * Method to produce a size (in bytes) to encode a given
@@ -421,6 +1657,24 @@ uint32_t AMF0::decodeObject(const char* buf, uint32_t size, bool isMap,
  */
 uint32_t  AMF0::propertySize(const Property& prop)
 {
+    Result      result;
+    uint32_t    res = this->propertySize(prop, result);
+
+    if(result.status) {
+        raise(result);
+    }
+
+    return res;
+}
+
+/*
+ * The above, with errors going in result.  Everything complex but
+ * AVMPLUS is one of ours.
+ */
+uint32_t  AMF0::propertySize(const Property& prop, Result& result)
+{
+    uint32_t res;
+
     switch(prop.type) {
         case Types::OBJECT_END:
             LOG("OBJE: 3");
@@ -435,59 +1689,43 @@ uint32_t  AMF0::propertySize(const Property& prop)
             LOG("SSTR: " << 3+prop.property.value.len);
             return 3+prop.property.value.len;
         case Types::ECMA_ARRAY:
-#           ifdef DEBUG
-                {
-                    uint32_t encSize = 5+prop.property.object->encodedSize();
-                    LOG("EARR: " << encSize);
-                    return encSize;
-                }
-#           else
-                return 5+prop.property.object->encodedSize();
-#           endif
-        case Types::AVMPLUS: // These are the same computation.
+            res = 5+((AMF0*)prop.property.object)->encodedSize(result);
+            LOG("EARR: " << res);
+            return res;
+        case Types::AVMPLUS:
+            // AMF3 can only be copied out as it was decoded.
+            if(!((AMF3*)prop.property.object)->source) {
+                return fail(result, BAD_DATA,
+                            "AMF3 can only be encoded as it was decoded");
+            }
+
+            res = 1+((AMF3*)prop.property.object)->sourceSize;
+            LOG("AMF3: " << res);
+            return res;
         case Types::OBJECT:
-#           ifdef DEBUG
-                {
-                    uint32_t encSize = 1+prop.property.object->encodedSize();
-                    LOG("AOBJ: " << encSize);
-                    return encSize;
-                }
-#           else
-                return 1+prop.property.object->encodedSize();
-#           endif
+            res = 1+((AMF0*)prop.property.object)->encodedSize(result);
+            LOG("AOBJ: " << res);
+            return res;
         case Types::REFERENCE:
             LOG("REFE: 3");
             return 3;
         case Types::TYPED_OBJECT:
-#           ifdef DEBUG
-                {
-                    uint32_t encSize = 3+prop.property.object->name.len
-                                       +prop.property.object->encodedSize();
-                    LOG("TOBJ: " << encSize);
-                    return encSize;
-                }
-#           else
-                return 3+prop.property.object->name.len
-                        +prop.property.object->encodedSize();
-#           endif
+            res = 3+prop.property.object->name.len
+                   +((AMF0*)prop.property.object)->encodedSize(result);
+            LOG("TOBJ: " << res);
+            return res;
         case Types::MOVIECLIP:
         case Types::RECORDSET:
-            throw std::runtime_error("Reserved / unsupported type!");
+            return fail(result, BAD_DATA, "Reserved / unsupported type!");
         case Types::UNDEFINED:
         case Types::UNSUPPORTED:
         case Types::NILL:
             LOG("NULL: 1");
             return 1;
         case Types::STRICT_ARRAY:
-#           ifdef DEBUG
-                {
-                    uint32_t encSize = 5+prop.property.object->encodedSize();
-                    LOG("SARR: " << encSize);
-                    return encSize;
-                }
-#           else
-                return 5+prop.property.object->encodedSize();
-#           endif
+            res = 5+((AMF0*)prop.property.object)->encodedSize(result);
+            LOG("SARR: " << res);
+            return res;
         case Types::DATE:
             LOG("DATE: 11");
             return 11;
@@ -496,7 +1734,7 @@ uint32_t  AMF0::propertySize(const Property& prop)
             LOG("LSTR:" << 5+prop.property.value.len);
             return 5+prop.property.value.len;
         default:
-            throw std::runtime_error("Unknown type received");
+            return fail(result, BAD_DATA, "Unknown type received");
     }
 }
 
@@ -511,31 +1749,71 @@ uint32_t  AMF0::propertySize(const Property& prop)
  */
 uint32_t AMF0::encodedSize()
 {
-    size_t result = 0;
+    Result      result;
+    uint32_t    res = this->encodedSize(result);
+
+    if(result.status) {
+        raise(result);
+    }
+
+    return res;
+}
+
+/*
+ * The above, with errors going in result.
+ */
+uint32_t AMF0::encodedSize(Result& result)
+{
+    size_t total = 0;
+
+    // Unchanged since decode, so no need to load it, either.
+    if(this->source) {
+        return this->sourceSize;
+    }
 
     LOG(">>> ENTER encodedSize");
 
-    if(this->isMap) {
+    if(this->lazyBuf) {
+        PropertyList    references{PropertyList::allocator_type(this->arena)};
+
+        this->load(references, result);
+
+        if(result.status) {
+            return 0;
+        }
+    }
+
+    if(this->dense) {
+        total = (size_t)this->denseCount * 9;
+    } else if(this->isMap) {
         for(const auto& kv: *this->properties.propMap) {
-            result += this->propertySize(kv.second);
+            total += this->propertySize(kv.second, result);
 
             // add in our key size, small string
             LOG("ENTR: " << kv.first.len + 2);
-            result += kv.first.len + 2;
+            total += kv.first.len + 2;
+
+            if(result.status) {
+                return 0;
+            }
         }
 
         // This will have the end bytes
         LOG("ENDM: 3");
-        result += 3;
+        total += 3;
     } else {
         for(const Property& prop: *this->properties.propList) {
-            result += this->propertySize(prop);
+            total += this->propertySize(prop, result);
+
+            if(result.status) {
+                return 0;
+            }
         }
     }
 
     LOG("<<< EXIT encodedSize");
 
-    return result;
+    return total;
 }
 
 /*
@@ -557,146 +1835,170 @@ uint32_t AMF0::encodedSize()
  * The point is, only call this on a top-level AMF0 object.
  */
 uint32_t AMF0::encode(char* buf, uint32_t size)
+{
+    FixedWriter out(buf, size);
+
+    return this->encode(out);
+}
+
+/*
+ * Sizing finds anything encode would throw for, other than running out
+ * of room.  The encode itself goes into a CountingWriter, which doesn't
+ * throw for that either.
+ */
+AMF::Result AMF0::tryEncode(char* buf, uint32_t size) noexcept
+{
+    Result      result;
+    uint32_t    bound = this->encodedSize(result);
+
+    if(result.status) {
+        return result;
+    }
+
+    // References come in under encodedSize, so we may fit anyway.
+    if(bound > size) {
+        CountingWriter  counter;
+
+        this->encode(counter);
+
+        if(counter.size() > size) {
+            fail(result, NEED_MORE_ROOM, "Not enough buffer to encode into",
+                 counter.size());
+            return result;
+        }
+    }
+
+    CountingWriter  out(buf, size);
+
+    result.bytes = this->encode(out);
+
+    if(out.overflowed()) {
+        fail(result, NEED_MORE_ROOM, "Not enough buffer to encode into",
+             out.size());
+    }
+
+    return result;
+}
+
+/*
+ * Encode straight into the vector, growing it as we go.
+ */
+uint32_t AMF0::encode(std::vector<char>& out)
+{
+    VectorWriter    writer(out);
+    uint32_t        result = this->encode(writer);
+
+    writer.finish();
+
+    return result;
+}
+
+/*
+ * Encode into a Writer.  Everything else ends up here.
+ */
+uint32_t AMF0::encode(Writer& out)
 {
     std::map<AMF*, uint32_t>    references;
-    uint32_t                    counter;
+    uint32_t                    counter = 0;
+    uint32_t                    start = out.size();
+
+    if(this->source) {
+        out.append(this->source, this->sourceSize);
+        return this->sourceSize;
+    }
 
-    return this->encodeObject(buf, size, references, counter);
+    this->load();
+    this->encodeObject(out, references, counter);
+
+    return out.size() - start;
 }
 
 
 /*
- * This encodes the object into an AMF data stream suitable
- * for transmission or storage to file system.
- *
- * Requires a buffer that we will write to, with a size
- * parameter to say how much buffer is provided.  It will
- * return how many bytes of that buffer we actually consumed.
+ * This encodes the object's properties into an AMF data stream,
+ * without any of the window dressing of its own type.
  *
  * THIS MUST be called by encodeProperty unless its called
  * on the top level object.  Generally speaking, this
  * method shouldn't be used by anyone.
  */
-uint32_t AMF0::encodeObject(char* buf, uint32_t size,
-                            std::map<AMF*, uint32_t>& references,
-                            uint32_t& counter)
+void AMF0::encodeObject(Writer& out, std::map<AMF*, uint32_t>& references,
+                        uint32_t& counter)
 {
-    uint32_t consumed;
-    uint32_t originalSize = size;
+    char*   p;
 
     // How we iterate depends on isMap
-    if(this->isMap) {
+    if(this->dense) {
+        encodeNumberArray(out, this->dense, this->denseCount);
+    } else if(this->isMap) {
         for(auto& kv: *this->properties.propMap) {
             // Encode name
-            if(size < 3+kv.first.len) {
-                throw std::overflow_error(
-                    "Not enough buffer to write key name"
-                );
-            }
-
-            this->encodeInt16(kv.first.len, buf);
-            memcpy(&buf[2], kv.first.val, kv.first.len);
-            size -= 2+kv.first.len;
-            buf += 2+kv.first.len;
+            p = out.reserve(2);
+            this->encodeInt16(kv.first.len, p);
+            out.commit(2);
+            out.append(kv.first.val, kv.first.len);
 
-            consumed = this->encodeProperty(buf, size, kv.second, references,
-                                            counter);
-            size -= consumed;
-            buf += consumed;
+            this->encodeProperty(out, kv.second, references, counter);
         }
     } else {
         for(const Property& prop: *this->properties.propList) {
-            consumed = this->encodeProperty(buf, size, prop, references,
-                                            counter);
-            size -= consumed;
-            buf += consumed;
+            this->encodeProperty(out, prop, references, counter);
         }
     }
-
-    return originalSize - size;
 }
 
 /*
  * This encodes an individual AMF property into the provided
- * buffer.  The buffer must be large enough to handle it.
+ * Writer.
  *
- * You will usually use encode to encode a whole AMF
- * message, but if you need to encode some small part of
- * an AMF message, you can use this instead.
- *
- * Returns number of bytes consumed.
+ * references and counter are shared by the whole message, so that an
+ * object that shows up a second time anywhere is sent as a REFERENCE.
+ * Like decodeObject, an object gets its number once it's done.
  */
-uint32_t AMF0::encodeProperty(char* buf, uint32_t size, const Property& prop,
-                              std::map<AMF*, uint32_t>& references,
-                              uint32_t& counter)
+void AMF0::encodeProperty(Writer& out, const Property& prop,
+                          std::map<AMF*, uint32_t>& references,
+                          uint32_t& counter)
 {
-    uint32_t consumed = 0; // used in a few places.
+    AMF0*   object;
+    char*   p;
 
     switch(prop.type) {
         case Types::OBJECT_END:
             // We probably don't have a property of this type,
             // but we can encode it if we do!
-            if(size < 3) {
-                throw std::overflow_error(
-                    "Not enough buffer room to write OBJECT_END."
-                );
-            }
+            p = out.reserve(3);
+            p[0] = 0x00;
+            p[1] = 0x00;
+            p[2] = 0x09;
+            out.commit(3);
 
-            buf[0] = 0x00;
-            buf[1] = 0x00;
-            buf[2] = 0x09;
-
-            return 3;
+            return;
         case Types::NUMBER:
             // Type byte + 8 byte double
-            if(size < 9) {
-                throw std::overflow_error(
-                    "Not enough buffer to write NUMBER"
-                );
-            }
-
-            buf[0] = prop.type;
-            this->encodeNumber(prop.property.number, &buf[1]);
+            p = out.reserve(9);
+            p[0] = prop.type;
+            this->encodeNumber(prop.property.number, &p[1]);
+            out.commit(9);
 
-            return 9;
+            return;
         case Types::BOOLEAN:
             // Type byte + 1 byte boolean
-            if(size < 2) {
-                throw std::overflow_error(
-                    "Not enough buffer room to write BOOLEAN"
-                );
-            }
+            p = out.reserve(2);
+            p[0] = prop.type;
+            p[1] = (char)(prop.property.number != 0);
+            out.commit(2);
 
-            buf[0] = prop.type;
-            buf[1] = (char)(prop.property.number != 0);
-
-            return 2;
+            return;
         case Types::STRING:
             // Small string - type byte + 2 byte len + string
-            if(size < 3+prop.property.value.len) {
-                throw std::overflow_error(
-                    "Not enough buffer to write STRING"
-                );
-            }
+            p = out.reserve(3);
+            p[0] = prop.type;
+            this->encodeInt16(prop.property.value.len, &p[1]);
+            out.commit(3);
+            out.append(prop.property.value.val, prop.property.value.len);
 
-            buf[0] = prop.type;
-            this->encodeInt16(prop.property.value.len, &buf[1]);
-            memcpy(&buf[3], prop.property.value.val, prop.property.value.len);
-
-            return 3+prop.property.value.len;
+            return;
         case Types::ECMA_ARRAY:
-            // This is identical to object, except it has a 4 byte header
-            if(size < 5) {
-                throw std::overflow_error(
-                    "Not enough buffer to write ECMA_ARRAY"
-                );
-            }
-
-            buf[0] = prop.type;
-            this->encodeInt32(prop.property.object->properties.propList->size(),
-                              &buf[1]);
-
-            consumed = 5;
         case Types::TYPED_OBJECT:
         case Types::OBJECT:
             // Are we doing a reference?
@@ -708,89 +2010,75 @@ uint32_t AMF0::encodeProperty(char* buf, uint32_t size, const Property& prop,
                     tmp.type = Types::REFERENCE;
                     tmp.property.value.len = search->second;
 
-                    return this->encodeProperty(buf, size, tmp, references,
-                                                counter);
+                    this->encodeProperty(out, tmp, references, counter);
+                    return;
                 }
             }
 
-            // We may have fallen through from ECMA_Array.  if consumed > 0
-            if(!consumed) {
-                if(size < 1) {
-                    // need 1 byte + length of name
-                    throw std::overflow_error(
-                        "Not enough buffer to write OBJECT/TYPED_OBJECT"
-                    );
-                }
+            object = (AMF0*)prop.property.object;
 
-                buf[0] = prop.type;
-                consumed++;
+            if(object->source) {
+                this->encodeSource(out, prop, object, references, counter);
+                return;
+            }
 
-                // write name if typed object, if available.
-                // for my purposes this is a minority case and therefore
-                // this somewhat unoptimized process is okay :P
-                if(prop.property.object->name.len) {
-                    // check size
-                    if((size - 1) < (2+prop.property.object->name.len)) {
-                        throw std::overflow_error(
-                            "Not enough buffer to write TYPED_OBJECT"
-                        );
-                    }
+            object->load();
 
-                    // write string
-                    this->encodeInt16(prop.property.object->name.len, &buf[1]);
-                    memcpy(&buf[3], prop.property.object->name.val,
-                           prop.property.object->name.len);
+            if(prop.type == Types::ECMA_ARRAY) {
+                // This is identical to object, except it has a 4 byte
+                // header
+                p = out.reserve(5);
+                p[0] = prop.type;
+                this->encodeInt32(object->properties.propMap->size(), &p[1]);
+                out.commit(5);
+            } else {
+                p = out.reserve(1);
+                p[0] = prop.type;
+                out.commit(1);
 
-                    consumed += 2 + prop.property.object->name.len;
+                // write name if typed object, if available.
+                if(object->name.len) {
+                    p = out.reserve(2);
+                    this->encodeInt16(object->name.len, p);
+                    out.commit(2);
+                    out.append(object->name.val, object->name.len);
                 }
             }
 
-            consumed += prop.property.object->encode(&buf[consumed],
-                                                     size-consumed);
+            object->encodeObject(out, references, counter);
 
             // Now add OBJECT_END
-            if(size - consumed < 3) {
-                throw std::overflow_error(
-                    "Not enough buffer to write terminating OBJECT_END"
-                );
-            }
-
-            buf[consumed] = 0x00;
-            buf[consumed+1] = 0x00;
-            buf[consumed+2] = 0x09;
+            p = out.reserve(3);
+            p[0] = 0x00;
+            p[1] = 0x00;
+            p[2] = 0x09;
+            out.commit(3);
 
             // Add to reference
-            references.insert({prop.property.object, counter});
+            references.insert({object, counter});
             counter++;
 
-            return consumed + 3;
+            return;
         case Types::REFERENCE:
             // This shouldn't be used by anyone directly.
-            if(size < 3) {
-                throw std::overflow_error(
-                    "Not enough buffer to encode a REFERENCE"
-                );
-            }
-
-            buf[0] = Types::REFERENCE;
-            this->encodeInt16(prop.property.value.len, &buf[1]);
+            p = out.reserve(3);
+            p[0] = Types::REFERENCE;
+            this->encodeInt16(prop.property.value.len, &p[1]);
+            out.commit(3);
 
-            return 3;
+            return;
         case Types::MOVIECLIP:
         case Types::RECORDSET:
-            throw std::runtime_error("Reserved / unsupported type!");
+            TDAMF_THROW(std::runtime_error("Reserved / unsupported type!"));
         case Types::UNDEFINED:
         case Types::UNSUPPORTED:
         case Types::NILL:
             // These are just a type with no data
-            if(size < 1) {
-                throw std::overflow_error(
-                    "Not enough buffer to write NULL type"
-                );
-            }
+            p = out.reserve(1);
+            p[0] = prop.type;
+            out.commit(1);
 
-            buf[0] = prop.type;
-            return 1;
+            return;
         case Types::STRICT_ARRAY:
             // Are we doing a reference?
             {
@@ -801,82 +2089,235 @@ uint32_t AMF0::encodeProperty(char* buf, uint32_t size, const Property& prop,
                     tmp.type = Types::REFERENCE;
                     tmp.property.value.len = search->second;
 
-                    return this->encodeProperty(buf, size, tmp, references,
-                                                counter);
+                    this->encodeProperty(out, tmp, references, counter);
+                    return;
                 }
             }
 
             // 4 byte size followed by elements
-            if(size < 5) {
-                throw std::overflow_error(
-                    "Not enough buffer to write STRICT_ARRAY"
-                );
+            object = (AMF0*)prop.property.object;
+
+            if(object->source) {
+                this->encodeSource(out, prop, object, references, counter);
+                return;
             }
 
-            buf[0] = prop.type;
-            this->encodeInt32(prop.property.object->properties.propList->size(),
-                              &buf[1]);
+            object->load();
+
+            p = out.reserve(5);
+            p[0] = prop.type;
+            this->encodeInt32(object->dense ? object->denseCount :
+                              object->properties.propList->size(), &p[1]);
+            out.commit(5);
+
+            object->encodeObject(out, references, counter);
 
             // Add to reference
-            references.insert({prop.property.object, counter});
+            references.insert({object, counter});
             counter++;
 
-            return 5+prop.property.object->encode(&buf[5], size-5);
+            return;
         case Types::DATE:
             // type byte + 8 byte NUMBER + 2 bytes all 0's
             // NOTE: if we decided to implement TZ's, we need to implement
             // it here too.
-            if(size < 11) {
-                throw std::overflow_error(
-                    "Not enough buffer to write DATE"
-                );
-            }
-
-            buf[0] = prop.type;
-            this->encodeNumber(prop.property.number, &buf[1]);
-            buf[9] = 0x00;
-            buf[10] = 0x00;
-
-            return 11;
+            p = out.reserve(11);
+            p[0] = prop.type;
+            this->encodeNumber(prop.property.number, &p[1]);
+            p[9] = 0x00;
+            p[10] = 0x00;
+            out.commit(11);
+
+            return;
         case Types::LONG_STRING:
         case Types::XML_DOC:
             // These are identical except for type byte
             // type bite + 4 byte len + string
-            if(size < 5+prop.property.value.len) {
-                throw std::overflow_error(
-                    "Not enough buffer to write LONG_STRING/XML_DOC"
-                );
-            }
-
-            buf[0] = prop.type;
-            this->encodeInt32(prop.property.value.len, &buf[1]);
-            memcpy(&buf[5], prop.property.value.val, prop.property.value.len);
+            p = out.reserve(5);
+            p[0] = prop.type;
+            this->encodeInt32(prop.property.value.len, &p[1]);
+            out.commit(5);
+            out.append(prop.property.value.val, prop.property.value.len);
 
-            return 5+prop.property.value.len;
+            return;
         case Types::AVMPLUS:
             // Type byte followed by AMF03 encoding
-            if(size < 1) {
-                throw std::overflow_error(
-                    "Not enough buffer to write AVMPLUS"
-                );
-            }
-
-            buf[0] = prop.type;
+            p = out.reserve(1);
+            p[0] = prop.type;
+            out.commit(1);
 
             // After switching to AVMPLUS, we probably can't encode
             // more stuff in AMF0 -- @TODO enforce this ?
-            return 1+prop.property.object->encode(&buf[1], size-1);
+            prop.property.object->encode(out);
+
+            return;
         default:
-            throw std::runtime_error("Unknown type received");
+            TDAMF_THROW(std::runtime_error("Unknown type received"));
     }
 }
 
 
+/*
+ * Copy an object that hasn't changed since decode from where it was
+ * decoded.  Anything complex in it still takes up reference numbers.
+ */
+void AMF0::encodeSource(Writer& out, const Property& prop, AMF0* object,
+                        std::map<AMF*, uint32_t>& references,
+                        uint32_t& counter)
+{
+    char*   p;
+
+    switch(prop.type) {
+        case Types::ECMA_ARRAY:
+        case Types::STRICT_ARRAY:
+            // Our body comes right after the 4 byte count we were
+            // decoded with, so copy that too.
+            p = out.reserve(1);
+            p[0] = prop.type;
+            out.commit(1);
+            out.append(object->source - 4, object->sourceSize + 4);
+            break;
+        default:
+            p = out.reserve(1);
+            p[0] = prop.type;
+            out.commit(1);
+
+            if(object->name.len) {
+                p = out.reserve(2);
+                this->encodeInt16(object->name.len, p);
+                out.commit(2);
+                out.append(object->name.val, object->name.len);
+            }
+
+            out.append(object->source, object->sourceSize);
+            break;
+    }
+
+    counter += object->sourceComplex;
+    references.insert({object, counter});
+    counter++;
+}
+
+/*
+ * Empty ourselves for the next decode.  Everything we made goes into
+ * the pool; the pool is made here if we don't have one yet.
+ */
+void AMF0::clear()
+{
+    this->invalidate();
+
+    if(this->arena) {
+        this->properties.propMap = NULL;
+        this->dense = NULL;
+        this->denseCount = 0;
+        this->lazyBuf = NULL;
+        return;
+    }
+
+    if(!this->pool) {
+        this->pool = new Pool();
+        this->ownsPool = true;
+    }
+
+    this->recycle();
+}
+
+/*
+ * Put our children in the pool, and empty our containers without giving
+ * their memory back.  References are counted like the destructor does,
+ * so a node that is in the tree more than once is only pooled once.
+ *
+ * A child that has no pool joins ours; one that has its own (because
+ * clear() was called on it) keeps it, and its children go there.
+ */
+void AMF0::recycle()
+{
+    auto recycleProperty = [this](Property& prop) {
+        AMF0* child = (AMF0*)prop.property.object;
+
+        switch((Types)prop.type) {
+            case Types::OBJECT:
+            case Types::ECMA_ARRAY:
+            case Types::STRICT_ARRAY:
+            case Types::TYPED_OBJECT:
+                if(child->refCount) {
+                    child->refCount--;
+                    break;
+                }
+
+                if(!child->pool) {
+                    child->pool = this->pool;
+                }
+
+                child->recycle();
+                child->parent = NULL;
+
+                if(child->isMap) {
+                    this->pool->maps.push_back(child);
+                } else {
+                    this->pool->lists.push_back(child);
+                }
+
+                break;
+            case Types::AVMPLUS:
+                delete prop.property.object;
+            default: // avoids warning
+                break;
+        }
+    };
+
+    if(this->isMap && this->properties.propMap) {
+        for(auto& kv: *this->properties.propMap) {
+            recycleProperty(kv.second);
+        }
+
+        this->properties.propMap->clear();
+    } else if(this->properties.propList) {
+        for(Property& prop : *this->properties.propList) {
+            recycleProperty(prop);
+        }
+
+        this->properties.propList->clear();
+    }
+
+    if(this->stitched) {
+        this->stitched->reset();
+    }
+
+    this->dense = NULL;
+    this->denseCount = 0;
+    this->lazyBuf = NULL;
+    this->source = NULL;
+}
+
 /*
  * AMF0 destructor to clean out properties that use objects.
  */
 AMF0::~AMF0()
 {
+    delete this->stitched;
+
+    // Pooled nodes are always on the heap, even if we've since been
+    // decoded into an arena.
+    if(this->ownsPool) {
+        for(AMF0* spare : this->pool->maps) {
+            delete spare;
+        }
+
+        for(AMF0* spare : this->pool->lists) {
+            delete spare;
+        }
+
+        delete this->pool;
+    }
+
+    // Arena objects get cleaned up by resetting the arena.
+    if(this->arena) {
+        return;
+    }
+
+    delete[] this->denseBuffer;
+
     if(this->isMap && this->properties.propMap) {
         // Iterate over map, delete what's an object type
         for(auto& kv: *this->properties.propMap) {
@@ -884,6 +2325,7 @@ AMF0::~AMF0()
                 case Types::OBJECT:
                 case Types::ECMA_ARRAY:
                 case Types::STRICT_ARRAY:
+                case Types::TYPED_OBJECT:
                     if(((AMF0*)kv.second.property.object)->refCount) {
                         ((AMF0*)kv.second.property.object)->refCount--;
                     } else {
@@ -907,6 +2349,7 @@ AMF0::~AMF0()
                 case Types::OBJECT:
                 case Types::ECMA_ARRAY:
                 case Types::STRICT_ARRAY:
+                case Types::TYPED_OBJECT:
                     if(((AMF0*)prop.property.object)->refCount) {
                         ((AMF0*)prop.property.object)->refCount--;
                     } else {
@@ -914,7 +2357,7 @@ AMF0::~AMF0()
                     }
                     break;
                 case Types::AVMPLUS:
-                    delete kv.second.property.object;
+                    delete prop.property.object;
                 default: // avoids warning
                     break;
             }
@@ -0,0 +1,233 @@
+/*
+ * amf0binding.cpp
+ *
+ * Source code for decoding AMF0 objects into structs.
+ *
+ * @author sconley
+ * Copyright 2017
+ *********************************************************************
+ */
+
+#include "amf.hpp"
+
+using namespace Tigerdile;
+
+/*****************************************************************************
+ * AMF0Binding Definitions
+ ****************************************************************************/
+
+/*
+ * Bind, and throw if a REQUIRED field is missing, naming it.
+ */
+uint32_t AMF0Binding::decodeObject(const char* buf, uint32_t size,
+                                   const AMF0Field* fields, uint32_t count,
+                                   char* out)
+{
+    AMF::Result result;
+    uint64_t    found = 0;
+    uint32_t    used = bindObject(buf, size, fields, count, out, found,
+                                  result);
+    uint32_t    f;
+
+    if(result.status) {
+        AMF::raise(result);
+    }
+
+    if((f = missing(fields, count, found)) < count) {
+        TDAMF_THROW(std::runtime_error(
+            std::string("Missing required field ") + fields[f].key
+        ));
+    }
+
+    return used;
+}
+
+/*
+ * Same, without throwing.  A Result's message can't name the field, so
+ * this one doesn't.
+ */
+AMF::Result AMF0Binding::tryDecodeObject(const char* buf, uint32_t size,
+                                         const AMF0Field* fields,
+                                         uint32_t count, char* out) noexcept
+{
+    AMF::Result result;
+    uint64_t    found = 0;
+    uint32_t    used = bindObject(buf, size, fields, count, out, found,
+                                  result);
+
+    if(result.status) {
+        return result;
+    }
+
+    if(missing(fields, count, found) < count) {
+        AMF0::fail(result, AMF::BAD_DATA, "Missing a required field");
+        return result;
+    }
+
+    result.bytes = used;
+
+    return result;
+}
+
+/*
+ * Walk the keys like AMF0Reader would, and look each one up in fields.
+ * Keys usually come in the same order every time, so we start looking
+ * right after the last one we found.
+ */
+uint32_t AMF0Binding::bindObject(const char* buf, uint32_t size,
+                                 const AMF0Field* fields, uint32_t count,
+                                 char* out, uint64_t& found,
+                                 AMF::Result& result)
+{
+    uint32_t            complexCount = 0;
+    uint32_t            pos;
+    uint32_t            len;
+    uint32_t            res;
+    uint32_t            last = 0;
+    const char*         key;
+
+    if(count > 64) {
+        return AMF0::fail(result, AMF::BAD_DATA,
+                          "Can't bind more than 64 fields");
+    }
+
+    if(!size) {
+        return AMF0::fail(result, AMF::NEED_MORE_DATA,
+                          "No type byte to bind", 1);
+    }
+
+    switch((AMF0::Types)buf[0]) {
+        case AMF0::Types::OBJECT:
+            pos = 1;
+            break;
+        case AMF0::Types::ECMA_ARRAY:
+            pos = 5;
+            break;
+        case AMF0::Types::TYPED_OBJECT:
+            if(size < 3) {
+                return AMF0::fail(result, AMF::NEED_MORE_DATA,
+                    "TYPED_OBJECT without enough buffer for type str", 3
+                );
+            }
+
+            pos = 3 + AMF::decodeInt16(&buf[1]);
+            break;
+        default:
+            return AMF0::fail(result, AMF::BAD_DATA,
+                "Can only bind an OBJECT, ECMA_ARRAY or TYPED_OBJECT"
+            );
+    }
+
+    while(true) {
+        if((pos > size) || (size - pos < 3)) {
+            return AMF0::fail(result, AMF::NEED_MORE_DATA,
+                              "Object ends without OBJECT_END",
+                              (uint64_t)pos + 3);
+        }
+
+        len = AMF::decodeInt16(&buf[pos]);
+
+        if(!len && (buf[pos + 2] == AMF0::Types::OBJECT_END)) {
+            pos += 3;
+            break;
+        }
+
+        if(len >= size - pos - 2) {
+            return AMF0::fail(result, AMF::NEED_MORE_DATA,
+                              "Got out-of-bounds name.len",
+                              (uint64_t)pos + len + 3);
+        }
+
+        key = &buf[pos + 2];
+        pos += 2 + len;
+
+        res = AMF0::skipProperty(&buf[pos], size - pos, complexCount,
+                                 AMF0::SKIP_REFERENCES, result);
+
+        if(result.status) {
+            return AMF0::failedAt(result, pos);
+        }
+
+        for(uint32_t i = 0, f = last; i < count; i++, f++) {
+            if(f == count) {
+                f = 0;
+            }
+
+            if((fields[f].keyLen == len) &&
+               !memcmp(fields[f].key, key, len)) {
+                if(store(&buf[pos], fields[f], out)) {
+                    found |= (uint64_t)1 << f;
+                }
+
+                last = f + 1;
+                break;
+            }
+        }
+
+        pos += res;
+    }
+
+    return pos;
+}
+
+/*
+ * The first REQUIRED field that isn't in found, or count if there isn't
+ * one.
+ */
+uint32_t AMF0Binding::missing(const AMF0Field* fields, uint32_t count,
+                              uint64_t found)
+{
+    for(uint32_t f = 0; f < count; f++) {
+        if((fields[f].flags & AMF0Field::REQUIRED) &&
+           !(found & ((uint64_t)1 << f))) {
+            return f;
+        }
+    }
+
+    return count;
+}
+
+/*
+ * skipProperty has already checked that the value fits.
+ */
+bool AMF0Binding::store(const char* buf, const AMF0Field& field, char* out)
+{
+    AMF::Value* value;
+
+    switch(field.type) {
+        case AMF0::Types::NUMBER:
+            if((buf[0] != AMF0::Types::NUMBER) &&
+               (buf[0] != AMF0::Types::DATE)) {
+                return false;
+            }
+
+            *(double*)&out[field.offset] = AMF::decodeNumber(&buf[1]);
+            return true;
+        case AMF0::Types::BOOLEAN:
+            if(buf[0] != AMF0::Types::BOOLEAN) {
+                return false;
+            }
+
+            *(bool*)&out[field.offset] = (buf[1] != 0);
+            return true;
+        case AMF0::Types::STRING:
+            value = (AMF::Value*)&out[field.offset];
+
+            if(buf[0] == AMF0::Types::STRING) {
+                value->len = AMF::decodeInt16(&buf[1]);
+                value->val = &buf[3];
+                return true;
+            }
+
+            if((buf[0] == AMF0::Types::LONG_STRING) ||
+               (buf[0] == AMF0::Types::XML_DOC)) {
+                value->len = AMF::decodeInt32(&buf[1]);
+                value->val = &buf[5];
+                return true;
+            }
+
+            return false;
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,294 @@
+/*
+ * amf0builder.cpp
+ *
+ * Source code for building AMF0 messages in an arena.
+ *
+ * @author sconley
+ * Copyright 2017
+ *********************************************************************
+ */
+
+#include "amf.hpp"
+
+using namespace Tigerdile;
+
+/*****************************************************************************
+ * AMF0Builder Definitions
+ ****************************************************************************/
+
+/*
+ * The message, and the key table, go into the arena.
+ */
+AMF0Builder::AMF0Builder(Arena& arena, uint32_t reserve)
+{
+    this->object = arena.create<AMF0>();
+    this->object->arena = &arena;
+    this->object->initProperties(false);
+
+    if(reserve) {
+        this->object->properties.propList->reserve(reserve);
+    }
+
+    this->keys = arena.create<Keys>();
+    this->keys->size = 32;
+    this->keys->count = 0;
+    this->keys->slots = (AMF::Value*)arena.allocate(
+                            sizeof(AMF::Value) * this->keys->size
+                        );
+    memset(this->keys->slots, 0, sizeof(AMF::Value) * this->keys->size);
+}
+
+/*
+ * List values.
+ */
+AMF0Builder& AMF0Builder::add(const char* value)
+{
+    return this->put(NULL, string(this->copy(value)));
+}
+
+AMF0Builder& AMF0Builder::add(const AMF::Value& value)
+{
+    return this->put(NULL, string(value));
+}
+
+AMF0Builder& AMF0Builder::add(double value)
+{
+    return this->add(NULL, value);
+}
+
+AMF0Builder& AMF0Builder::add(int value)
+{
+    return this->add(NULL, (double)value);
+}
+
+AMF0Builder& AMF0Builder::add(bool value)
+{
+    return this->add(NULL, value);
+}
+
+AMF0Builder& AMF0Builder::addNull()
+{
+    return this->addNull(NULL);
+}
+
+/*
+ * Object values.
+ */
+AMF0Builder& AMF0Builder::add(const char* key, const char* value)
+{
+    return this->put(key, string(this->copy(value)));
+}
+
+AMF0Builder& AMF0Builder::add(const char* key, const AMF::Value& value)
+{
+    return this->put(key, string(value));
+}
+
+AMF0Builder& AMF0Builder::add(const char* key, double value)
+{
+    AMF::Property prop;
+
+    prop.type = AMF0::Types::NUMBER;
+    prop.property.number = value;
+
+    return this->put(key, prop);
+}
+
+AMF0Builder& AMF0Builder::add(const char* key, int value)
+{
+    return this->add(key, (double)value);
+}
+
+AMF0Builder& AMF0Builder::add(const char* key, bool value)
+{
+    AMF::Property prop;
+
+    prop.type = AMF0::Types::BOOLEAN;
+    prop.property.number = value;
+
+    return this->put(key, prop);
+}
+
+AMF0Builder& AMF0Builder::addNull(const char* key)
+{
+    AMF::Property prop;
+
+    prop.type = AMF0::Types::NILL;
+    prop.property.object = NULL;
+
+    return this->put(key, prop);
+}
+
+/*
+ * Make a child in the arena, with its container presized.
+ */
+AMF0Builder AMF0Builder::addChild(const char* key, unsigned char type,
+                                  uint32_t reserve)
+{
+    AMF::Property   prop;
+    bool            isMap = (type != AMF0::Types::STRICT_ARRAY);
+    AMF0*           child = this->object->newChild(isMap);
+
+    child->initProperties(isMap);
+
+    if(reserve) {
+        if(child->isMap) {
+            child->properties.propMap->reserve(reserve);
+        } else {
+            child->properties.propList->reserve(reserve);
+        }
+    }
+
+    prop.type = type;
+    prop.property.object = child;
+    this->put(key, prop);
+
+    return AMF0Builder(child, this->keys);
+}
+
+/*
+ * A dense STRICT_ARRAY, like DENSE_NUMBERS decodes.
+ */
+AMF0Builder& AMF0Builder::addNumbers(const char* key, const double* numbers,
+                                     uint32_t count)
+{
+    AMF::Property   prop;
+    AMF0*           child = this->object->newChild(false);
+
+    child->initProperties(false);
+
+    if(count) {
+        child->dense = numbers;
+        child->denseCount = count;
+    }
+
+    prop.type = AMF0::Types::STRICT_ARRAY;
+    prop.property.object = child;
+
+    return this->put(key, prop);
+}
+
+/*
+ * Add to our map or list, making sure the key matches which we are.
+ */
+AMF0Builder& AMF0Builder::put(const char* key, const AMF::Property& prop)
+{
+    if(this->object->isMap) {
+        if(!key) {
+            TDAMF_THROW(std::runtime_error(
+                "Objects need a key for every value"
+            ));
+        }
+
+        this->object->properties.propMap->insert(
+            AMF::PropertyMap::Entry(this->intern(key), prop)
+        );
+    } else {
+        if(key) {
+            TDAMF_THROW(std::runtime_error("Lists can't have keys"));
+        }
+
+        this->object->properties.propList->push_back(prop);
+    }
+
+    this->object->invalidate();
+
+    return *this;
+}
+
+/*
+ * Copy a string into the arena.
+ */
+AMF::Value AMF0Builder::copy(const char* str)
+{
+    AMF::Value  result;
+    char*       val;
+
+    result.len = strlen(str);
+    val = (char*)this->object->arena->allocate(result.len, 1);
+    memcpy(val, str, result.len);
+    result.val = val;
+
+    return result;
+}
+
+/*
+ * Find a key we've already copied, or copy it.  Known keys don't need
+ * copying at all.  The table grows at 3/4 full; the old one is left in
+ * the arena.
+ */
+AMF::Value AMF0Builder::intern(const char* key)
+{
+    AMF::Value          wanted;
+    AMF::Value          result;
+    AMF::Value*         slot;
+    AMF::Value*         old;
+    const AMF::Value*   known;
+    uint32_t            oldSize;
+
+    wanted.val = key;
+    wanted.len = strlen(key);
+
+    if((known = AMF::knownKey(wanted.val, wanted.len))) {
+        return *known;
+    }
+
+    slot = this->slotFor(wanted);
+
+    if(slot->val) {
+        return *slot;
+    }
+
+    result = *slot = this->copy(key);
+
+    if(++this->keys->count * 4 > this->keys->size * 3) {
+        old = this->keys->slots;
+        oldSize = this->keys->size;
+
+        this->keys->size *= 2;
+        this->keys->slots = (AMF::Value*)this->object->arena->allocate(
+                                sizeof(AMF::Value) * this->keys->size
+                            );
+        memset(this->keys->slots, 0,
+               sizeof(AMF::Value) * this->keys->size);
+
+        for(uint32_t i = 0; i < oldSize; i++) {
+            if(old[i].val) {
+                *this->slotFor(old[i]) = old[i];
+            }
+        }
+    }
+
+    return result;
+}
+
+/*
+ * The slot key is in, or the empty one it would go in.
+ */
+AMF::Value* AMF0Builder::slotFor(const AMF::Value& key)
+{
+    AMF::Value* slot;
+    uint32_t    mask = this->keys->size - 1;
+    uint32_t    hash = AMF::PropertyMap::hash(key, NULL);
+
+    for(slot = &this->keys->slots[hash & mask];
+        slot->val && !(*slot == key);
+        slot = &this->keys->slots[++hash & mask]) {
+    }
+
+    return slot;
+}
+
+/*
+ * A STRING, or a LONG_STRING if it's too long for that.
+ */
+AMF::Property AMF0Builder::string(const AMF::Value& value)
+{
+    AMF::Property prop;
+
+    prop.type = (value.len > 0xFFFF) ? AMF0::Types::LONG_STRING :
+                                       AMF0::Types::STRING;
+    prop.property.value = value;
+
+    return prop;
+}
@@ -0,0 +1,289 @@
+/*
+ * amf0compact.cpp
+ *
+ * Source code for the compact, NaN-boxed AMF0 decode.
+ *
+ * @author sconley
+ * Copyright 2017
+ *********************************************************************
+ */
+
+#include "amf.hpp"
+
+using namespace Tigerdile;
+
+/*****************************************************************************
+ * CompactValue Definitions
+ ****************************************************************************/
+
+/*
+ * Most of the type is in the tag; boxes and objects know their own.
+ */
+AMF0::Types CompactValue::type() const
+{
+    if(this->isNumber()) {
+        return AMF0::Types::NUMBER;
+    }
+
+    switch(this->bits & TAG) {
+        case SPECIAL:
+            return (AMF0::Types)(this->bits & 0xFF);
+        case STRING:
+            return AMF0::Types::STRING;
+        case BOXED:
+            return (AMF0::Types)((const Box*)this->pointer())->type;
+        default:
+            return this->object()->type();
+    }
+}
+
+/*
+ * NUMBERs are stored as themselves, DATEs in a box.
+ */
+double CompactValue::number() const
+{
+    double result;
+
+    if(this->isNumber()) {
+        memcpy(&result, &this->bits, 8);
+        return result;
+    }
+
+    switch(this->bits & TAG) {
+        case SPECIAL:
+            return (this->bits >> 8) & 1;
+        case BOXED:
+            return ((const Box*)this->pointer())->number;
+        default:
+            return 0;
+    }
+}
+
+/*****************************************************************************
+ * AMF0Compact Definitions
+ ****************************************************************************/
+
+/*
+ * Pointers have to fit under the tag, which they do for user space on
+ * the 64 bit platforms we know of (and trivially on 32 bit ones).
+ */
+CompactValue AMF0Compact::box(uint64_t tag, const void* pointer)
+{
+    CompactValue result;
+
+    result.bits = (uint64_t)(uintptr_t)pointer;
+
+    if(result.bits & CompactValue::TAG) {
+        TDAMF_THROW(std::runtime_error(
+            "Pointer doesn't fit in a CompactValue"
+        ));
+    }
+
+    result.bits |= tag;
+
+    return result;
+}
+
+/*
+ * AMF0Reader does the walking and all the checks.  Values pile up on
+ * one stack, and keys on another, until their object ends; then they're
+ * copied into the arena as the object's arrays.  That way we only ever
+ * allocate exactly what each object needs.
+ *
+ * Objects go into the reference table when they end, like decode.
+ */
+const AMF0Compact& AMF0Compact::decode(const char* buf, uint32_t size,
+                                       Arena& arena)
+{
+    struct Open
+    {
+        size_t          firstValue;
+        size_t          firstKey;
+        unsigned char   kind;
+        uint64_t        typeName;
+    };
+
+    AMF0Reader                  reader(buf, size);
+    std::vector<uint64_t>       values;
+    std::vector<uint64_t>       keys;
+    std::vector<AMF0Compact*>   references;
+    Open                        open[AMF0Reader::MAX_DEPTH];
+    uint32_t                    level = 0;
+    CompactValue                value;
+    CompactValue::Box*          boxed;
+
+    // Enough for most messages in one go.
+    values.reserve(64);
+    keys.reserve(64);
+
+    open[0].firstValue = open[0].firstKey = 0;
+    open[0].kind = AMF0::Types::STRICT_ARRAY;
+    open[0].typeName = 0;
+
+    while(true) {
+        if(!reader.next()) {
+            Open&           ending = open[level];
+            AMF0Compact*    node = arena.create<AMF0Compact>();
+            size_t          count = values.size() - ending.firstValue;
+            CompactValue*   nodeValues = (CompactValue*)arena.allocate(
+                                             count * sizeof(CompactValue),
+                                             alignof(CompactValue)
+                                         );
+            uint64_t*       nodeKeys = NULL;
+
+            memcpy((void*)nodeValues, values.data() + ending.firstValue,
+                   count * sizeof(CompactValue));
+
+            if(ending.kind != AMF0::Types::STRICT_ARRAY) {
+                nodeKeys = (uint64_t*)arena.allocate(
+                               count * sizeof(uint64_t), alignof(uint64_t)
+                           );
+                memcpy(nodeKeys, keys.data() + ending.firstKey,
+                       count * sizeof(uint64_t));
+            }
+
+            node->base = buf;
+            node->keys = nodeKeys;
+            node->values = nodeValues;
+            node->typeName = ending.typeName;
+            node->count = count;
+            node->kind = ending.kind;
+
+            values.resize(ending.firstValue);
+            keys.resize(ending.firstKey);
+
+            if(!level--) {
+                return *node;
+            }
+
+            references.push_back(node);
+            values.push_back(box(CompactValue::OBJECT, node).bits);
+            continue;
+        }
+
+        if(open[level].kind != AMF0::Types::STRICT_ARRAY) {
+            keys.push_back(((uint64_t)(reader.key().val - buf) << 16) |
+                           reader.key().len);
+        }
+
+        switch(reader.type()) {
+            case AMF0::Types::NUMBER:
+                {
+                    double number = reader.number();
+
+                    memcpy(&value.bits, &number, 8);
+
+                    if(number != number) {
+                        value.bits = CompactValue::NOT_A_NUMBER;
+                    }
+                }
+                break;
+            case AMF0::Types::BOOLEAN:
+                value.bits = CompactValue::SPECIAL |
+                             ((uint64_t)(reader.number() != 0) << 8) |
+                             AMF0::Types::BOOLEAN;
+                break;
+            case AMF0::Types::NILL:
+                value.bits = CompactValue::SPECIAL | AMF0::Types::NILL;
+                break;
+            case AMF0::Types::STRING:
+                value.bits = CompactValue::STRING |
+                             ((uint64_t)(reader.string().val - buf) << 16) |
+                             reader.string().len;
+                break;
+            case AMF0::Types::DATE:
+            case AMF0::Types::LONG_STRING:
+            case AMF0::Types::XML_DOC:
+            case AMF0::Types::AVMPLUS:
+                boxed = arena.create<CompactValue::Box>();
+                boxed->type = reader.type();
+                boxed->number = (reader.type() == AMF0::Types::DATE) ?
+                                reader.number() : 0;
+                boxed->value = reader.string();
+                value = box(CompactValue::BOXED, boxed);
+                break;
+            case AMF0::Types::REFERENCE:
+                if(reader.count() >= references.size()) {
+                    TDAMF_THROW(std::out_of_range(
+                        "Reference to an object that isn't decoded yet"
+                    ));
+                }
+
+                value = box(CompactValue::OBJECT,
+                            references[reader.count()]);
+                break;
+            case AMF0::Types::OBJECT:
+            case AMF0::Types::ECMA_ARRAY:
+            case AMF0::Types::STRICT_ARRAY:
+            case AMF0::Types::TYPED_OBJECT:
+                {
+                    // enterObject checks the depth for us.
+                    reader.enterObject();
+
+                    Open& child = open[++level];
+
+                    child.firstValue = values.size();
+                    child.firstKey = keys.size();
+                    child.kind = reader.type();
+                    child.typeName = 0;
+
+                    if(reader.string().val) {
+                        child.typeName =
+                            ((uint64_t)(reader.string().val - buf) << 16) |
+                            reader.string().len;
+                    }
+                }
+                continue;
+            default:
+                TDAMF_THROW(std::runtime_error("Reserved/Unsupported type!"));
+        }
+
+        values.push_back(value.bits);
+    }
+}
+
+/*
+ * STRINGs are in our buffer; the long ones are in a box.
+ */
+AMF::Value AMF0Compact::string(const CompactValue& value) const
+{
+    AMF::Value result;
+
+    switch(value.bits & CompactValue::TAG) {
+        case CompactValue::STRING:
+            return this->unpack(value.bits & ~CompactValue::TAG);
+        case CompactValue::BOXED:
+            if(((const CompactValue::Box*)value.pointer())->type !=
+               AMF0::Types::DATE) {
+                return ((const CompactValue::Box*)value.pointer())->value;
+            }
+
+            break;
+        default:
+            break;
+    }
+
+    // DATEs and everything else have no string.
+    result.val = NULL;
+    result.len = 0;
+    return result;
+}
+
+/*
+ * Objects we hold on to are mostly small, so just scan.
+ */
+const CompactValue* AMF0Compact::find(const AMF::Value& key) const
+{
+    if(!this->keys) {
+        return NULL;
+    }
+
+    for(uint32_t i = 0; i < this->count; i++) {
+        if(((this->keys[i] & 0xFFFF) == key.len) &&
+           !memcmp(this->base + (this->keys[i] >> 16), key.val, key.len)) {
+            return &this->values[i];
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,876 @@
+/*
+ * amf0decoder.cpp
+ *
+ * Source code for the resumable AMF0 decoder.
+ *
+ * @author sconley
+ * Copyright 2017
+ *********************************************************************
+ */
+
+#include "amf.hpp"
+
+using namespace Tigerdile;
+
+/*****************************************************************************
+ * AMF0Decoder Definitions
+ ****************************************************************************/
+
+/*
+ * Get our stack ready so that normal messages don't need to grow it.
+ */
+AMF0Decoder::AMF0Decoder() : stitchArena(1024)
+{
+    this->frames.reserve(16);
+    this->references.reserve(16);
+}
+
+/*
+ * Start decoding a message of messageSize bytes into target.
+ */
+void AMF0Decoder::begin(AMF0& target, uint32_t messageSize)
+{
+    this->start(target, messageSize, this->stitchArena);
+}
+
+/*
+ * Same, but everything goes into arena.
+ */
+void AMF0Decoder::begin(AMF0& target, uint32_t messageSize, Arena& arena)
+{
+    // Whatever we had before belongs to someone else's arena (or has
+    // already been freed by a reset), so just forget it.
+    target.arena = &arena;
+    target.properties.propMap = NULL;
+
+    this->start(target, messageSize, arena);
+}
+
+/*
+ * Reset our state for a new message.
+ */
+void AMF0Decoder::start(AMF0& target, uint32_t messageSize, Arena& stitch)
+{
+    Frame   top;
+
+    this->arena = &stitch;
+    this->target = &target;
+    this->messageSize = messageSize;
+    this->total = 0;
+    this->state = ITEM;
+    this->partial = 0;
+    this->amf3Have = 0;
+    this->resume = NULL;
+    this->stitchArena.reset();
+
+    this->frames.clear();
+    this->references.clear();
+
+    target.decodeFlags = 0;
+    target.initProperties(false);
+    target.invalidate();
+
+    // The top level is an unlimited list, like AMF0::decode.
+    top.node = &target;
+    top.isMap = false;
+    top.counted = false;
+    top.remaining = 0;
+    this->frames.push_back(top);
+}
+
+/*
+ * Decode a piece of the message.
+ */
+AMF0Decoder::Status AMF0Decoder::feed(const char* buf, uint32_t size)
+{
+    AMF::Result result;
+    Status      status = this->decodePiece(buf, size, result);
+
+    if(result.status) {
+        AMF::raise(result);
+    }
+
+    return status;
+}
+
+/*
+ * Same, but without throwing.
+ */
+AMF::Result AMF0Decoder::tryFeed(const char* buf, uint32_t size) noexcept
+{
+    AMF::Result result;
+    Status      status = this->decodePiece(buf, size, result);
+
+    if(result.status == AMF::NEED_MORE_DATA) {
+        // We already know how long the message is, so no more data is
+        // coming that could fix this.
+        result.status = AMF::BAD_DATA;
+        result.bytes = 0;
+    } else if(!result.status) {
+        if(status == DONE) {
+            result.bytes = this->total;
+        } else {
+            result.status = AMF::NEED_MORE_DATA;
+            result.bytes = this->messageSize - this->total;
+        }
+    }
+
+    return result;
+}
+
+/*
+ * The core of feed and tryFeed.  After an error, we forget the message,
+ * so feeding us more of it is an error too.
+ */
+AMF0Decoder::Status AMF0Decoder::decodePiece(const char* buf, uint32_t size,
+                                             AMF::Result& result)
+{
+    const char* data;
+    uint32_t    len;
+
+    if(!this->target) {
+        AMF0::fail(result, AMF::BAD_DATA, "feed called before begin");
+        return NEED_MORE_DATA;
+    }
+
+    this->piece = buf;
+    this->pieceLeft = MIN(size, this->messageSize - this->total);
+
+    for(;;) {
+        Frame& frame = this->frames.back();
+
+        switch(this->state) {
+            case ITEM:
+                if(frame.counted && !frame.remaining) {
+                    this->pop();
+                    continue;
+                }
+
+                if(this->total == this->messageSize) {
+                    // Like decodeObject, objects left open at the end of
+                    // the buffer are taken as they are.
+                    while(this->frames.size() > 1) {
+                        this->pop();
+                    }
+
+                    return DONE;
+                }
+
+                // Most values are small and sit entirely in the piece.
+                if(!this->partial && this->quick(frame)) {
+                    continue;
+                }
+
+                if(!frame.isMap) {
+                    this->key.val = NULL;
+                    this->key.len = 0;
+                    this->state = TYPE;
+                    continue;
+                }
+
+                if(!(data = this->take(2))) {
+                    return this->more(2, result);
+                }
+
+                this->keyLen = AMF::decodeInt16(data);
+
+                if(!this->checkLength(this->keyLen, result)) {
+                    return this->abandon();
+                }
+
+                this->state = KEY;
+                continue;
+            case KEY:
+                if(!(data = this->take(this->keyLen, true))) {
+                    return this->more(this->keyLen, result);
+                }
+
+                this->key.val = data;
+                this->key.len = this->keyLen;
+                this->state = TYPE;
+                continue;
+            case TYPE:
+                if(!(data = this->take(1))) {
+                    return this->more(1, result);
+                }
+
+                this->type = data[0];
+
+                // An empty key and OBJECT_END is the 0x00 0x00 0x09
+                // terminator.
+                if(frame.isMap && !this->key.len &&
+                   (this->type == AMF0::Types::OBJECT_END)) {
+                    this->pop();
+                    continue;
+                }
+
+                this->state = HEADER;
+                continue;
+            case HEADER:
+                len = this->headerSize(result);
+
+                if(result.status) {
+                    return this->abandon();
+                }
+
+                if(!(data = this->take(len))) {
+                    return this->more(len, result);
+                }
+
+                this->header(data, result);
+                break;
+            case BODY:
+                if(!(data = this->take(this->bodyLen, true))) {
+                    return this->more(this->bodyLen, result);
+                }
+
+                this->body(data, result);
+                break;
+            case AVMPLUS:
+                if(!(data = this->collectAMF3(len, result))) {
+                    if(result.status) {
+                        return this->abandon();
+                    }
+
+                    return NEED_MORE_DATA;
+                }
+
+                this->decodeAMF3(data, len, result);
+                break;
+        }
+
+        if(result.status) {
+            return this->abandon();
+        }
+    }
+}
+
+/*
+ * Decode as many whole scalars as we can straight out of the piece,
+ * skipping the state machine.  This is where most of the time goes, so
+ * it works on locals and only writes back what it consumed.  We stop,
+ * without consuming it, at anything that's an object or isn't all
+ * there; the slow path will sort it out.
+ *
+ * Returns false if nothing was decoded.
+ */
+bool AMF0Decoder::quick(Frame& frame)
+{
+    const char*     p = this->piece;
+    const char*     end = p + this->pieceLeft;
+    AMF::Value      key;
+    AMF::Property   prop;
+    uint32_t        len;
+    uint32_t        remaining = frame.remaining;
+
+    key.val = NULL;
+    key.len = 0;
+
+    while(!frame.counted || remaining) {
+        const char* item = p;
+
+        if(frame.isMap) {
+            if(end - p < 3) {
+                break;
+            }
+
+            len = AMF::decodeInt16(p);
+
+            // The key, its length and a type byte; an empty key could be
+            // the terminator, so let the slow path look at it.
+            if(!len || ((uint32_t)(end - p) < len + 3)) {
+                break;
+            }
+
+            key.val = p + 2;
+            key.len = len;
+            p += 2 + len;
+        } else if(p == end) {
+            break;
+        }
+
+        prop.type = p[0];
+
+        switch((AMF0::Types)prop.type) {
+            case AMF0::Types::NUMBER:
+                if(end - p < 9) {
+                    len = 0;
+                    break;
+                }
+
+                prop.property.number = AMF::decodeNumber(&p[1]);
+                len = 9;
+                break;
+            case AMF0::Types::BOOLEAN:
+                if(end - p < 2) {
+                    len = 0;
+                    break;
+                }
+
+                prop.property.number = (p[1] != 0);
+                len = 2;
+                break;
+            case AMF0::Types::STRING:
+                if(end - p < 3) {
+                    len = 0;
+                    break;
+                }
+
+                len = AMF::decodeInt16(&p[1]);
+
+                if((uint32_t)(end - p) - 3 < len) {
+                    len = 0;
+                    break;
+                }
+
+                prop.property.value.val = &p[3];
+                prop.property.value.len = len;
+                len += 3;
+                break;
+            case AMF0::Types::NILL:
+                len = 1;
+                break;
+            default:
+                len = 0;
+                break;
+        }
+
+        if(!len) {
+            p = item;
+            break;
+        }
+
+        p += len;
+
+        if(frame.isMap) {
+            frame.node->properties.propMap->insert(
+                std::pair<AMF::Value, AMF::Property>(key, prop)
+            );
+        } else {
+            frame.node->properties.propList->push_back(prop);
+        }
+
+        remaining--;
+    }
+
+    if(frame.counted) {
+        frame.remaining = remaining;
+    }
+
+    if(p == this->piece) {
+        return false;
+    }
+
+    this->total += p - this->piece;
+    this->pieceLeft -= p - this->piece;
+    this->piece = p;
+
+    return true;
+}
+
+/*
+ * Get n contiguous bytes, or NULL if we don't have them yet.
+ *
+ * If the piece has them all, we point right into it.  Otherwise we
+ * collect them in scratch (small things, which are decoded right away)
+ * or, if 'keep' is set, in a stitch buffer that lives as long as the
+ * message does.
+ */
+const char* AMF0Decoder::take(uint32_t n, bool keep)
+{
+    const char* result;
+    char*       dest;
+    uint32_t    copy;
+
+    if(!this->partial && (this->pieceLeft >= n)) {
+        result = n ? this->piece : this->scratch;
+        this->piece += n;
+        this->pieceLeft -= n;
+        this->total += n;
+
+        return result;
+    }
+
+    if(!keep) {
+        dest = this->scratch;
+    } else {
+        if(!this->partial) {
+            this->stitch = (char*)this->arena->allocate(n, 1);
+        }
+
+        dest = this->stitch;
+    }
+
+    do {
+        copy = MIN(n - this->partial, this->pieceLeft);
+
+        memcpy(&dest[this->partial], this->piece, copy);
+        this->piece += copy;
+        this->pieceLeft -= copy;
+        this->total += copy;
+        this->partial += copy;
+
+        if(this->partial == n) {
+            this->partial = 0;
+            return dest;
+        }
+    } while(this->nextPiece());
+
+    return NULL;
+}
+
+/*
+ * If we were going over bytes that came after an AVMPLUS value, go back
+ * to the rest of the piece.  Returns false if there's nothing left.
+ */
+bool AMF0Decoder::nextPiece()
+{
+    if(!this->resume) {
+        return false;
+    }
+
+    this->piece = this->resume;
+    this->pieceLeft = this->resumeLeft;
+    this->resume = NULL;
+
+    return true;
+}
+
+/*
+ * Get a whole AVMPLUS value, or NULL if we don't have it yet.
+ *
+ * We can't tell how long AMF3 is without walking it, so if it isn't all
+ * in the piece, we collect it.  Rather than walk it again for every
+ * piece, we only look once we have what the last walk said it needs,
+ * and at least twice what we had then.  So we may collect some of
+ * whatever comes after it; we go over that again before the rest of the
+ * piece.
+ */
+const char* AMF0Decoder::collectAMF3(uint32_t& len, AMF::Result& result)
+{
+    AMF::Result measured;
+    const char* data;
+    char*       grown;
+    uint32_t    copy;
+
+    // Usually it's all here.
+    if(!this->amf3Have) {
+        len = AMF3::skipValues(this->piece, this->pieceLeft, 1, measured,
+                               AMF0::MAX_DEPTH + 1 - this->frames.size());
+
+        if(!measured.status) {
+            data = this->piece;
+            this->piece += len;
+            this->pieceLeft -= len;
+            this->total += len;
+
+            return data;
+        }
+
+        if(!this->checkAMF3(measured, result)) {
+            return NULL;
+        }
+
+        // Nothing to collect until the next piece.
+        if(!this->pieceLeft && !this->resume) {
+            return NULL;
+        }
+
+        this->growAMF3(measured.bytes);
+    }
+
+    while(true) {
+        do {
+            copy = MIN(this->amf3Want - this->amf3Have, this->pieceLeft);
+
+            memcpy(&this->amf3Buf[this->amf3Have], this->piece, copy);
+            this->piece += copy;
+            this->pieceLeft -= copy;
+            this->total += copy;
+            this->amf3Have += copy;
+        } while((this->amf3Have < this->amf3Want) && this->nextPiece());
+
+        if(this->amf3Have < this->amf3Want) {
+            return NULL;
+        }
+
+        measured = AMF::Result();
+        len = AMF3::skipValues(this->amf3Buf, this->amf3Have, 1, measured,
+                               AMF0::MAX_DEPTH + 1 - this->frames.size());
+
+        if(!measured.status) {
+            break;
+        }
+
+        if(!this->checkAMF3(measured, result)) {
+            return NULL;
+        }
+
+        grown = this->amf3Buf;
+        this->growAMF3(measured.bytes);
+        memcpy(this->amf3Buf, grown, this->amf3Have);
+    }
+
+    // Go over what we took past the end again.
+    if(this->amf3Have > len) {
+        this->resume = this->pieceLeft ? this->piece : NULL;
+        this->resumeLeft = this->pieceLeft;
+        this->piece = &this->amf3Buf[len];
+        this->pieceLeft = this->amf3Have - len;
+        this->total -= this->pieceLeft;
+    }
+
+    this->amf3Have = 0;
+
+    return this->amf3Buf;
+}
+
+/*
+ * Walking what we have of an AVMPLUS value said 'measured'.  That's
+ * fine if it just needs more, and the message has it; otherwise the
+ * error goes in result and we return false.
+ */
+bool AMF0Decoder::checkAMF3(const AMF::Result& measured,
+                            AMF::Result& result)
+{
+    if((measured.status == AMF::NEED_MORE_DATA) &&
+       (measured.bytes <= this->amf3Have + this->messageSize - this->total)) {
+        return true;
+    }
+
+    // It started amf3Have bytes back.
+    result = measured;
+    AMF0::failedAt(result, this->total - this->amf3Have);
+
+    return false;
+}
+
+/*
+ * Make room to collect 'need' bytes of an AVMPLUS value, or more; see
+ * collectAMF3.  Whatever we had is left for the caller to copy.
+ */
+void AMF0Decoder::growAMF3(uint32_t need)
+{
+    uint64_t    want = MAX((uint64_t)need,
+                           2 * (uint64_t)MAX(this->amf3Have,
+                                             this->pieceLeft));
+
+    this->amf3Want = MIN(want, (uint64_t)this->amf3Have +
+                               this->messageSize - this->total);
+    this->amf3Buf = (char*)this->arena->allocate(this->amf3Want, 1);
+}
+
+/*
+ * Decode a whole AVMPLUS value.  Like decodeObject, it goes in first,
+ * and objects in it can go as deep as they could have here.
+ */
+void AMF0Decoder::decodeAMF3(const char* data, uint32_t len,
+                             AMF::Result& result)
+{
+    AMF3*           amf3 = this->frames.back().node->createChild<AMF3>();
+    AMF0::Limits    limits;
+    uint32_t        nodes = 0;
+
+    limits.maxDepth = AMF0::MAX_DEPTH + 1 - this->frames.size();
+
+    this->prop.property.object = amf3;
+    this->emit();
+
+    amf3->decodeValues(data, len, 1, result, limits, nodes);
+}
+
+/*
+ * We ran out of piece; that's fine unless we also ran out of message.
+ * 'n' is what we were trying to take.
+ */
+AMF0Decoder::Status AMF0Decoder::more(uint32_t n, AMF::Result& result)
+{
+    if(this->total == this->messageSize) {
+        AMF0::fail(result, AMF::NEED_MORE_DATA,
+                   "Message ended in the middle of a value",
+                   (uint64_t)this->total + n - this->partial);
+        return this->abandon();
+    }
+
+    return NEED_MORE_DATA;
+}
+
+/*
+ * Forget the message after an error.
+ */
+AMF0Decoder::Status AMF0Decoder::abandon()
+{
+    this->target = NULL;
+
+    return NEED_MORE_DATA;
+}
+
+/*
+ * Make sure a length we just read can possibly fit in what's left of the
+ * message.  This way a bad length fails now, and we never stitch more
+ * than the message could hold.
+ */
+bool AMF0Decoder::checkLength(uint32_t len, AMF::Result& result)
+{
+    if(len > this->messageSize - this->total) {
+        AMF0::fail(result, AMF::NEED_MORE_DATA,
+                   "Length runs past the end of the message",
+                   (uint64_t)this->total + len);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Size of the fixed part of a value of this->type.
+ */
+uint32_t AMF0Decoder::headerSize(AMF::Result& result)
+{
+    switch((AMF0::Types)this->type) {
+        case AMF0::Types::NUMBER:
+            return 8;
+        case AMF0::Types::BOOLEAN:
+            return 1;
+        case AMF0::Types::STRING:
+        case AMF0::Types::TYPED_OBJECT:
+        case AMF0::Types::REFERENCE:
+            return 2;
+        case AMF0::Types::ECMA_ARRAY:
+        case AMF0::Types::STRICT_ARRAY:
+        case AMF0::Types::LONG_STRING:
+        case AMF0::Types::XML_DOC:
+            return 4;
+        case AMF0::Types::DATE:
+            return 10;
+        case AMF0::Types::OBJECT:
+        case AMF0::Types::NILL:
+        case AMF0::Types::UNDEFINED:
+        case AMF0::Types::UNSUPPORTED:
+        case AMF0::Types::AVMPLUS:
+            return 0;
+        case AMF0::Types::MOVIECLIP:
+        case AMF0::Types::RECORDSET:
+            return AMF0::fail(result, AMF::BAD_DATA,
+                              "Reserved/Unsupported type!");
+        default:
+            return AMF0::fail(result, AMF::BAD_DATA, "Unknown type received");
+    }
+}
+
+/*
+ * Handle the fixed part of a value.  Same rules as decodeObject.
+ */
+void AMF0Decoder::header(const char* data, AMF::Result& result)
+{
+    AMF0*       parent = this->frames.back().node;
+    AMF0*       child;
+    uint32_t    index;
+
+    this->prop.type = this->type;
+
+    switch((AMF0::Types)this->type) {
+        case AMF0::Types::NUMBER:
+        case AMF0::Types::DATE:
+            // DATE's timezone is thrown out, like decodeObject.
+            this->prop.property.number = AMF::decodeNumber(data);
+            this->emit();
+            break;
+        case AMF0::Types::BOOLEAN:
+            this->prop.property.number = (*data != 0);
+            this->emit();
+            break;
+        case AMF0::Types::STRING:
+        case AMF0::Types::TYPED_OBJECT:
+            this->bodyLen = AMF::decodeInt16(data);
+
+            if(this->checkLength(this->bodyLen, result)) {
+                this->state = BODY;
+            }
+
+            break;
+        case AMF0::Types::LONG_STRING:
+        case AMF0::Types::XML_DOC:
+            this->bodyLen = AMF::decodeInt32(data);
+
+            if(this->checkLength(this->bodyLen, result)) {
+                this->state = BODY;
+            }
+
+            break;
+        case AMF0::Types::UNDEFINED:
+        case AMF0::Types::UNSUPPORTED:
+            this->prop.type = AMF0::Types::NILL;
+        case AMF0::Types::NILL:
+            this->emit();
+            break;
+        case AMF0::Types::OBJECT:
+            this->push(parent->newChild(true), true, false, 0, result);
+            break;
+        case AMF0::Types::ECMA_ARRAY:
+            {
+                uint32_t hint = AMF::decodeInt32(data);
+
+                child = parent->newChild(true);
+                child->initProperties(true);
+
+                if(hint <= (this->messageSize - this->total) / 3) {
+                    child->properties.propMap->reserve(hint);
+                }
+
+                this->push(child, true, false, 0, result);
+            }
+            break;
+        case AMF0::Types::STRICT_ARRAY:
+            {
+                uint32_t count = AMF::decodeInt32(data);
+
+                child = parent->newChild(false);
+
+                if(count) {
+                    this->push(child, false, true, count, result);
+
+                    // Every element is at least a byte, so a count that
+                    // fits can't be used to make us allocate too much.
+                    if(!result.status &&
+                       (count <= this->messageSize - this->total)) {
+                        child->properties.propList->reserve(count);
+                    }
+                } else {
+                    child->initProperties(false);
+                    this->prop.property.object = child;
+                    this->references.push_back(this->prop);
+                    this->emit();
+                }
+            }
+            break;
+        case AMF0::Types::REFERENCE:
+            index = AMF::decodeInt16(data);
+
+            if(index >= this->references.size()) {
+                AMF0::fail(result, AMF::BAD_REFERENCE,
+                           "Reference to an object that isn't decoded yet");
+                break;
+            }
+
+            this->prop = this->references[index];
+            ((AMF0*)this->prop.property.object)->refCount++;
+            this->emit();
+            break;
+        case AMF0::Types::AVMPLUS:
+            // One AMF3 value, which we need all of; see collectAMF3.
+            this->amf3Have = 0;
+            this->state = AVMPLUS;
+            break;
+        default:
+            // headerSize already threw for anything else.
+            break;
+    }
+}
+
+/*
+ * Handle the variable part of a value.
+ */
+void AMF0Decoder::body(const char* data, AMF::Result& result)
+{
+    if(this->type == AMF0::Types::TYPED_OBJECT) {
+        AMF0* child = this->frames.back().node->newChild(true, data,
+                                                         this->bodyLen);
+
+        this->push(child, true, false, 0, result);
+        return;
+    }
+
+    this->prop.property.value.val = data;
+    this->prop.property.value.len = this->bodyLen;
+    this->emit();
+}
+
+/*
+ * Add this->prop to the current object, under this->key if it's a map.
+ */
+void AMF0Decoder::emit()
+{
+    Frame& frame = this->frames.back();
+
+    this->attach();
+
+    if(frame.counted) {
+        frame.remaining--;
+    }
+
+    this->state = ITEM;
+}
+
+/*
+ * Put this->prop in the current object, without counting it yet.
+ */
+void AMF0Decoder::attach()
+{
+    Frame& frame = this->frames.back();
+
+    if(frame.isMap) {
+        frame.node->properties.propMap->insert(
+            std::pair<AMF::Value, AMF::Property>(this->key, this->prop)
+        );
+    } else {
+        frame.node->properties.propList->push_back(this->prop);
+    }
+}
+
+/*
+ * Start decoding an object.  this->key and this->prop are for the
+ * parent and get restored when we're done.
+ *
+ * The object goes in its parent right away, so if the message turns
+ * out to be bad, what we've made so far is freed with the rest of the
+ * tree.
+ */
+void AMF0Decoder::push(AMF0* child, bool isMap, bool counted,
+                       uint32_t remaining, AMF::Result& result)
+{
+    Frame   frame;
+
+    child->initProperties(isMap);
+
+    this->prop.property.object = child;
+    this->attach();
+
+    // The same limit as decode, so the tree can be torn down again
+    // without running out of stack.
+    if(this->frames.size() > AMF0::MAX_DEPTH) {
+        AMF0::fail(result, AMF::BAD_DATA, "Objects nested too deep");
+        return;
+    }
+
+    frame.node = child;
+    frame.prop = this->prop;
+    frame.key = this->key;
+    frame.isMap = isMap;
+    frame.counted = counted;
+    frame.remaining = remaining;
+
+    this->frames.push_back(frame);
+    this->state = ITEM;
+}
+
+/*
+ * Finish decoding an object; it's already in its parent.  Like
+ * decodeObject, it goes into the reference table once it's done.
+ */
+void AMF0Decoder::pop()
+{
+    Frame& frame = this->frames.back();
+
+    this->key = frame.key;
+    this->prop = frame.prop;
+    this->frames.pop_back();
+
+    this->references.push_back(this->prop);
+
+    if(this->frames.back().counted) {
+        this->frames.back().remaining--;
+    }
+
+    this->state = ITEM;
+}
@@ -0,0 +1,427 @@
+/*
+ * amf0reader.cpp
+ *
+ * Source code for the AMF0 pull cursor.
+ *
+ * @author sconley
+ * Copyright 2017
+ *********************************************************************
+ */
+
+#include "amf.hpp"
+
+using namespace Tigerdile;
+
+/*****************************************************************************
+ * AMF0Reader Definitions
+ ****************************************************************************/
+
+/*
+ * The top level is an unlimited list, just like AMF0::decode.
+ */
+AMF0Reader::AMF0Reader(const char* buf, uint32_t size)
+{
+    this->start = this->buf = buf;
+    this->size = size;
+
+    this->curKey.val = this->curString.val = NULL;
+    this->curKey.len = this->curString.len = 0;
+
+    this->frames[0].remaining = 0;
+    this->frames[0].isMap = false;
+    this->frames[0].counted = false;
+}
+
+/*
+ * The throwing calls are just the Result ones, and a raise.
+ */
+bool AMF0Reader::next()
+{
+    AMF::Result result;
+    bool        found = this->next(result);
+
+    if(result.status) {
+        AMF::raise(result);
+    }
+
+    return found;
+}
+
+void AMF0Reader::enterObject()
+{
+    AMF::Result result;
+
+    this->enterObject(result);
+
+    if(result.status) {
+        AMF::raise(result);
+    }
+}
+
+void AMF0Reader::leaveObject()
+{
+    AMF::Result result;
+
+    this->leaveObject(result);
+
+    if(result.status) {
+        AMF::raise(result);
+    }
+}
+
+void AMF0Reader::skip()
+{
+    AMF::Result result;
+
+    this->skip(result);
+
+    if(result.status) {
+        AMF::raise(result);
+    }
+}
+
+bool AMF0Reader::find(AMF0::Path path)
+{
+    AMF::Result result;
+    bool        found = this->find(path, result);
+
+    if(result.status) {
+        AMF::raise(result);
+    }
+
+    return found;
+}
+
+/*
+ * Move to the next value in the current object or list.
+ */
+bool AMF0Reader::next(AMF::Result& result) noexcept
+{
+    Frame&  frame = this->frames[this->level];
+
+    if(this->pending && !this->skip(result)) {
+        return false;
+    }
+
+    this->curType = AMF0::Types::INVALID;
+
+    // Same end conditions as decodeObject.
+    if(frame.counted && !frame.remaining) {
+        this->pop();
+        return false;
+    }
+
+    if(!this->size) {
+        this->pop();
+        return false;
+    }
+
+    if(frame.isMap && (this->size >= 3) &&
+       (this->buf[0] == 0x00 && this->buf[1] == 0x00 &&
+        this->buf[2] == 0x09)) {
+        this->buf += 3;
+        this->size -= 3;
+        this->pop();
+        return false;
+    }
+
+    if(frame.isMap) {
+        if(this->size < 4) {
+            AMF0::fail(result, AMF::NEED_MORE_DATA,
+                       "isMap is true and size less than 4 bytes", 4);
+            return this->stop(result);
+        }
+
+        this->curKey.len = AMF::decodeInt16(this->buf);
+
+        if(this->curKey.len >= this->size - 2) {
+            AMF0::fail(result, AMF::NEED_MORE_DATA,
+                       "Got out-of-bounds name.len",
+                       (uint64_t)this->curKey.len + 3);
+            return this->stop(result);
+        }
+
+        this->curKey.val = this->buf + 2;
+        this->buf += 2 + this->curKey.len;
+        this->size -= 2 + this->curKey.len;
+    } else {
+        this->curKey.val = NULL;
+        this->curKey.len = 0;
+    }
+
+    if(frame.counted) {
+        frame.remaining--;
+    }
+
+    return this->readHeader(result);
+}
+
+/*
+ * Read the type and whatever else comes before the body of the value.
+ * Scalars are consumed entirely; for objects we stop at the body.
+ */
+bool AMF0Reader::readHeader(AMF::Result& result)
+{
+    uint32_t    complexCount = 0;
+    uint32_t    len;
+
+    this->curStart = this->offset();
+    this->curType = this->buf[0];
+    this->curCount = 0;
+    this->curString.val = NULL;
+    this->curString.len = 0;
+
+    switch((AMF0::Types)this->curType) {
+        case AMF0::Types::OBJECT:
+            this->buf++;
+            this->size--;
+            this->pending = true;
+            return true;
+        case AMF0::Types::ECMA_ARRAY:
+        case AMF0::Types::STRICT_ARRAY:
+            if(this->size < 5) {
+                AMF0::fail(result, AMF::NEED_MORE_DATA,
+                           "ECMA_ARRAY / STRICT_ARRAY with not enough bytes",
+                           5);
+                return this->stop(result);
+            }
+
+            this->curCount = AMF::decodeInt32(&this->buf[1]);
+            this->buf += 5;
+            this->size -= 5;
+            this->pending = true;
+            return true;
+        case AMF0::Types::TYPED_OBJECT:
+            if(this->size < 3) {
+                AMF0::fail(result, AMF::NEED_MORE_DATA,
+                           "TYPED_OBJECT without enough buffer for type str",
+                           3);
+                return this->stop(result);
+            }
+
+            this->curString.len = AMF::decodeInt16(&this->buf[1]);
+
+            if(this->size - 3 < this->curString.len) {
+                AMF0::fail(result, AMF::NEED_MORE_DATA,
+                           "TYPED_OBJECT without enough buffer to load name",
+                           (uint64_t)this->curString.len + 3);
+                return this->stop(result);
+            }
+
+            this->curString.val = this->buf + 3;
+            this->buf += 3 + this->curString.len;
+            this->size -= 3 + this->curString.len;
+            this->pending = true;
+            return true;
+        default:
+            break;
+    }
+
+    // Everything else is a scalar; skipProperty does our bounds checks
+    // and errors for us.
+    len = AMF0::skipProperty(this->buf, this->size, complexCount,
+                             AMF0::SKIP_REFERENCES, result);
+
+    if(result.status) {
+        return this->stop(result);
+    }
+
+    switch((AMF0::Types)this->curType) {
+        case AMF0::Types::NUMBER:
+        case AMF0::Types::DATE:
+            this->curNumber = AMF::decodeNumber(&this->buf[1]);
+            break;
+        case AMF0::Types::BOOLEAN:
+            this->curNumber = (this->buf[1] != 0);
+            break;
+        case AMF0::Types::STRING:
+            this->curString.len = AMF::decodeInt16(&this->buf[1]);
+            this->curString.val = this->buf + 3;
+            break;
+        case AMF0::Types::LONG_STRING:
+        case AMF0::Types::XML_DOC:
+            this->curString.len = AMF::decodeInt32(&this->buf[1]);
+            this->curString.val = this->buf + 5;
+            break;
+        case AMF0::Types::REFERENCE:
+            this->curCount = AMF::decodeInt16(&this->buf[1]);
+            break;
+        case AMF0::Types::AVMPLUS:
+            this->curString.val = this->buf + 1;
+            this->curString.len = len - 1;
+            break;
+        case AMF0::Types::UNDEFINED:
+        case AMF0::Types::UNSUPPORTED:
+            this->curType = AMF0::Types::NILL;
+            break;
+        default:
+            break;
+    }
+
+    this->buf += len;
+    this->size -= len;
+
+    return true;
+}
+
+/*
+ * Walk down 'path' a step at a time.  Each step but the last has to be
+ * something we can enter.
+ */
+bool AMF0Reader::find(AMF0::Path path, AMF::Result& result) noexcept
+{
+    const AMF0::PathStep*   last = path.end() - 1;
+    uint32_t                index;
+    size_t                  len;
+
+    if(!path.size()) {
+        return false;
+    }
+
+    for(const AMF0::PathStep* step = path.begin(); step != path.end();
+        step++) {
+        len = step->key ? strlen(step->key) : 0;
+        index = 0;
+
+        while(true) {
+            if(!this->next(result)) {
+                return false;
+            }
+
+            if(step->key ? ((this->curKey.len == len) && this->curKey.val &&
+                            !memcmp(this->curKey.val, step->key, len)) :
+                           (!this->frames[this->level].isMap &&
+                            (index++ == step->index))) {
+                break;
+            }
+        }
+
+        if(step != last) {
+            if(!this->pending) {
+                return false;
+            }
+
+            if(!this->enterObject(result)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Step into the current value.
+ */
+bool AMF0Reader::enterObject(AMF::Result& result) noexcept
+{
+    if(!this->pending) {
+        AMF0::fail(result, AMF::BAD_DATA, "Current value is not an object");
+        return this->stop(result);
+    }
+
+    if(this->level + 1 >= MAX_DEPTH) {
+        AMF0::fail(result, AMF::BAD_DATA, "Objects nested too deep");
+        return this->stop(result);
+    }
+
+    this->pending = false;
+    this->level++;
+
+    Frame& frame = this->frames[this->level];
+
+    frame.counted = (this->curType == AMF0::Types::STRICT_ARRAY);
+    frame.isMap = !frame.counted;
+    frame.remaining = this->curCount;
+
+    return true;
+}
+
+/*
+ * Skip the rest of the object we're in and step back out to its parent.
+ */
+bool AMF0Reader::leaveObject(AMF::Result& result) noexcept
+{
+    if(!this->level) {
+        AMF0::fail(result, AMF::BAD_DATA, "Not inside an object");
+        return this->stop(result);
+    }
+
+    if(this->pending && !this->skip(result)) {
+        return false;
+    }
+
+    Frame& frame = this->frames[this->level];
+
+    if(!this->skipBody(frame.isMap, frame.counted, frame.remaining,
+                       result)) {
+        return false;
+    }
+
+    this->pop();
+    this->curType = AMF0::Types::INVALID;
+
+    return true;
+}
+
+/*
+ * Skip over the current value.  Only objects have anything left to skip.
+ */
+bool AMF0Reader::skip(AMF::Result& result) noexcept
+{
+    if(this->pending) {
+        this->pending = false;
+
+        return this->skipBody(this->curType != AMF0::Types::STRICT_ARRAY,
+                              this->curType == AMF0::Types::STRICT_ARRAY,
+                              this->curCount, result);
+    }
+
+    return true;
+}
+
+/*
+ * Skip an object or list body.
+ */
+bool AMF0Reader::skipBody(bool isMap, bool counted, uint32_t remaining,
+                          AMF::Result& result)
+{
+    uint32_t    complexCount = 0;
+    uint32_t    res;
+
+    // A counted list with nothing left; don't let skipObject treat 0
+    // as unlimited.
+    if(counted && !remaining) {
+        return true;
+    }
+
+    res = AMF0::skipObject(this->buf, this->size, isMap,
+                           counted ? remaining : 0, complexCount,
+                           AMF0::SKIP_REFERENCES, result);
+
+    if(result.status) {
+        return this->stop(result);
+    }
+
+    this->buf += res;
+    this->size -= res;
+
+    return true;
+}
+
+/*
+ * Give up after an error.  We pretend we're at the end of the buffer,
+ * so that carrying on just finds nothing more.  Returns false.
+ */
+bool AMF0Reader::stop(AMF::Result& result)
+{
+    // Whatever it needs counts from our start, not buf.
+    AMF0::failedAt(result, this->offset());
+
+    this->size = 0;
+    this->level = 0;
+    this->pending = false;
+    this->curType = AMF0::Types::INVALID;
+
+    return false;
+}
@@ -0,0 +1,229 @@
+/*
+ * amf0template.cpp
+ *
+ * Source code for precompiled AMF0 messages.
+ *
+ * @author sconley
+ * Copyright 2017
+ *********************************************************************
+ */
+
+#include "amf.hpp"
+
+using namespace Tigerdile;
+
+/*****************************************************************************
+ * AMF0Template Definitions
+ ****************************************************************************/
+
+/*
+ * Encode the sample, find the slots in it, and cut their values out.
+ */
+AMF0Template::AMF0Template(AMF0& message,
+                           const std::vector<const AMF::Property*>& slots)
+{
+    std::vector<char>   sample;
+    uint32_t            from = 0;
+    uint32_t            removed = 0;
+
+    // References make things smaller than encodedSize says, which would
+    // throw our offsets off.
+    if(message.encode(sample) != message.encodedSize()) {
+        TDAMF_THROW(std::runtime_error("Templates can't contain references"));
+    }
+
+    this->locate(message, 0, slots);
+
+    if(this->slots.size() != slots.size()) {
+        TDAMF_THROW(std::runtime_error("Template slot isn't in the message"));
+    }
+
+    this->bytes.reserve(sample.size());
+
+    // Slots were found in order, so offsets only go up.
+    for(Slot& slot : this->slots) {
+        const AMF::Property&    prop = *slots[slot.index];
+        uint32_t                size = message.propertySize(prop) - 1;
+
+        this->bytes.insert(this->bytes.end(), &sample[from],
+                           &sample[slot.offset]);
+        from = slot.offset + size;
+        slot.offset -= removed;
+        removed += size;
+    }
+
+    this->bytes.insert(this->bytes.end(), sample.begin() + from,
+                       sample.end());
+}
+
+/*
+ * Walk object the same way encode does, keeping track of where we are
+ * with encodedSize.
+ */
+void AMF0Template::locate(AMF0& object, uint32_t offset,
+                          const std::vector<const AMF::Property*>& wanted)
+{
+    if(object.isMap) {
+        for(const auto& kv : *object.properties.propMap) {
+            offset += 2 + kv.first.len;
+            this->check(kv.second, offset, wanted);
+            offset += object.propertySize(kv.second);
+        }
+    } else {
+        for(const AMF::Property& prop : *object.properties.propList) {
+            this->check(prop, offset, wanted);
+            offset += object.propertySize(prop);
+        }
+    }
+}
+
+/*
+ * If prop is a slot, note that it's at 'offset'.  If it's an object,
+ * look inside it.
+ */
+void AMF0Template::check(const AMF::Property& prop, uint32_t offset,
+                         const std::vector<const AMF::Property*>& wanted)
+{
+    Slot    slot;
+
+    switch(prop.type) {
+        case AMF0::Types::OBJECT:
+            this->locate(*(AMF0*)prop.property.object, offset + 1, wanted);
+            return;
+        case AMF0::Types::ECMA_ARRAY:
+        case AMF0::Types::STRICT_ARRAY:
+            this->locate(*(AMF0*)prop.property.object, offset + 5, wanted);
+            return;
+        case AMF0::Types::TYPED_OBJECT:
+            this->locate(*(AMF0*)prop.property.object,
+                         offset + 3 + prop.property.object->name.len,
+                         wanted);
+            return;
+        default:
+            break;
+    }
+
+    for(slot.index = 0; slot.index < wanted.size(); slot.index++) {
+        if(wanted[slot.index] == &prop) {
+            break;
+        }
+    }
+
+    if(slot.index == wanted.size()) {
+        return;
+    }
+
+    switch(prop.type) {
+        case AMF0::Types::NUMBER:
+        case AMF0::Types::BOOLEAN:
+        case AMF0::Types::STRING:
+        case AMF0::Types::LONG_STRING:
+        case AMF0::Types::XML_DOC:
+            break;
+        default:
+            TDAMF_THROW(std::runtime_error(
+                "Template slots can't be that type"
+            ));
+    }
+
+    // Right after the type byte.
+    slot.offset = offset + 1;
+    slot.type = prop.type;
+    this->slots.push_back(slot);
+}
+
+/*
+ * Our bytes, plus the values.
+ */
+uint32_t AMF0Template::encodedSize(const AMF::Property* values) const
+{
+    size_t result = this->bytes.size();
+
+    for(const Slot& slot : this->slots) {
+        switch(slot.type) {
+            case AMF0::Types::NUMBER:
+                result += 8;
+                break;
+            case AMF0::Types::BOOLEAN:
+                result += 1;
+                break;
+            case AMF0::Types::STRING:
+                result += 2 + values[slot.index].property.value.len;
+                break;
+            default:
+                result += 4 + values[slot.index].property.value.len;
+                break;
+        }
+    }
+
+    if(result > UINT32_MAX) {
+        TDAMF_THROW(std::overflow_error("Can't encode more than 4GB"));
+    }
+
+    return result;
+}
+
+/*
+ * Copy our bytes up to each slot, then write the slot.
+ */
+uint32_t AMF0Template::render(Writer& out, const AMF::Property* values) const
+{
+    uint32_t    before = out.size();
+    uint32_t    from = 0;
+    char*       p;
+
+    for(const Slot& slot : this->slots) {
+        const AMF::Property& value = values[slot.index];
+
+        out.append(this->bytes.data() + from, slot.offset - from);
+        from = slot.offset;
+
+        switch(slot.type) {
+            case AMF0::Types::NUMBER:
+                p = out.reserve(8);
+                AMF::encodeNumber(value.property.number, p);
+                out.commit(8);
+                break;
+            case AMF0::Types::BOOLEAN:
+                p = out.reserve(1);
+                p[0] = value.property.number != 0;
+                out.commit(1);
+                break;
+            case AMF0::Types::STRING:
+                if(value.property.value.len > 0xFFFF) {
+                    TDAMF_THROW(std::overflow_error(
+                        "STRING slot value is over 64K"
+                    ));
+                }
+
+                p = out.reserve(2);
+                AMF::encodeInt16(value.property.value.len, p);
+                out.commit(2);
+                out.append(value.property.value.val,
+                           value.property.value.len);
+                break;
+            default:
+                p = out.reserve(4);
+                AMF::encodeInt32(value.property.value.len, p);
+                out.commit(4);
+                out.append(value.property.value.val,
+                           value.property.value.len);
+                break;
+        }
+    }
+
+    out.append(this->bytes.data() + from, this->bytes.size() - from);
+
+    return out.size() - before;
+}
+
+/*
+ * Render into a fixed buffer.
+ */
+uint32_t AMF0Template::render(char* buf, uint32_t size,
+                              const AMF::Property* values) const
+{
+    FixedWriter out(buf, size);
+
+    return this->render(out, values);
+}
@@ -38,25 +38,1058 @@ using namespace Tigerdile;
  */
 uint32_t AMF3::decode(const char* buf, uint32_t size)
 {
-    // We need our reference tables.
-    std::vector<Property>       objectRefs;
-    std::vector<Value>          stringRefs;
-    std::vector<
+    Result result = this->decodeTop(buf, size, NULL);
 
-    return 0;
+    if(result.status) {
+        raise(result);
+    }
+
+    return result.bytes;
+}
+
+uint32_t AMF3::decode(const char* buf, uint32_t size, Arena& arena)
+{
+    Result result = this->decodeTop(buf, size, &arena);
+
+    if(result.status) {
+        raise(result);
+    }
+
+    return result.bytes;
+}
+
+AMF::Result AMF3::tryDecode(const char* buf, uint32_t size) noexcept
+{
+    return this->decodeTop(buf, size, NULL);
+}
+
+AMF::Result AMF3::tryDecode(const char* buf, uint32_t size,
+                            Arena& arena) noexcept
+{
+    return this->decodeTop(buf, size, &arena);
+}
+
+/*
+ * Decode the values, remembering where they came from.
+ */
+AMF::Result AMF3::decodeTop(const char* buf, uint32_t size, Arena* arena)
+{
+    Result      result;
+    uint32_t    nodes = 0;
+    uint32_t    res;
+
+    // Whatever we had before belongs to someone else's arena (or has
+    // already been freed by a reset), so just forget it.
+    if(arena) {
+        this->arena = arena;
+        this->properties.propMap = NULL;
+    }
+
+    this->invalidate();
+
+    res = this->decodeValues(buf, size, 0, result, AMF0::Limits(), nodes);
+
+    if(result.status) {
+        return result;
+    }
+
+    result.bytes = res;
+
+    return result;
+}
+
+/*
+ * Everything we decode goes straight into its parent, and containers
+ * into the object table, before what's in them is decoded; so a
+ * reference to an object that is still being decoded works, and
+ * anything made before an error gets freed with the rest of us.
+ *
+ * The reference tables use the arena if we have one, so with an arena
+ * the heap isn't touched at all.
+ *
+ * 'nodes' carries on from whatever the AMF0 message around us has
+ * counted, so one AVMPLUS value can't get past its limits.
+ */
+uint32_t AMF3::decodeValues(const char* buf, uint32_t size, uint32_t count,
+                            Result& result, const AMF0::Limits& limits,
+                            uint32_t& nodes)
+{
+    // An OBJECT's class name and sealed member names.
+    struct Trait
+    {
+        Value       className;
+        uint32_t    firstMember;    // In 'members'
+        uint32_t    memberCount;
+        bool        dynamic;
+    };
+
+    // Something we're in the middle of decoding.
+    struct Frame
+    {
+        AMF3*       node;
+        Types       kind;       // UNDEFINED for the top
+        bool        keyed;      // Reading an ARRAY's named members
+        uint32_t    trait;      // OBJECT: which of 'traits' we are
+        uint32_t    next;       // OBJECT: next sealed member;
+                                // ARRAY: next dense index
+        uint32_t    remaining;  // Values left, not counting named ones
+    };
+
+    std::vector<Value, ArenaAllocator<Value>>
+                        strings{ArenaAllocator<Value>(this->arena)};
+    std::vector<Value, ArenaAllocator<Value>>
+                        members{ArenaAllocator<Value>(this->arena)};
+    std::vector<Trait, ArenaAllocator<Trait>>
+                        traits{ArenaAllocator<Trait>(this->arena)};
+    PropertyList        objects{PropertyList::allocator_type(this->arena)};
+    Frame               stack[MAX_DEPTH + 1];
+    Frame*              frame = stack;
+    Frame*              deepest = stack + MIN(limits.maxDepth, MAX_DEPTH);
+    const char*         start = buf;
+    Value               noName = { NULL, 0 };
+    uint32_t            header;
+
+    // We need 'n' more bytes than we have at buf.
+    auto underflow = [&](const char* message, uint64_t n) -> uint32_t {
+        return fail(result, NEED_MORE_DATA, message,
+                    (uint64_t)(buf - start) + n);
+    };
+
+    auto readInt29 = [&](uint32_t& value) -> bool {
+        uint32_t left = size;
+
+        if(!decodeInt29((const unsigned char*)buf, left, value)) {
+            underflow("Not enough bytes to decode Int29", (uint64_t)size + 1);
+            return false;
+        }
+
+        buf += size - left;
+        size = left;
+        return true;
+    };
+
+    // A string is inline, or a reference to an earlier one.  Empty
+    // strings are never sent by reference, so they aren't in the table.
+    auto readString = [&](Value& out) -> bool {
+        uint32_t header;
+
+        if(!readInt29(header)) {
+            return false;
+        }
+
+        if(!(header & 1)) {
+            if((header >> 1) >= strings.size()) {
+                fail(result, BAD_REFERENCE,
+                     "Reference to an AMF3 string that isn't decoded yet");
+                return false;
+            }
+
+            out = strings[header >> 1];
+            return true;
+        }
+
+        out.val = buf;
+        out.len = header >> 1;
+
+        if(size < out.len) {
+            underflow("Not enough bytes to load AMF3 string", out.len);
+            return false;
+        }
+
+        buf += out.len;
+        size -= out.len;
+
+        if(out.len) {
+            strings.push_back(out);
+        }
+
+        return true;
+    };
+
+    // 'property' is a copy of what the object table has at 'index'.
+    auto reference = [&](uint32_t index, Property& property) -> bool {
+        if(index >= objects.size()) {
+            fail(result, BAD_REFERENCE,
+                 "Reference to an AMF3 object that isn't decoded yet");
+            return false;
+        }
+
+        property = objects[index];
+        return true;
+    };
+
+    // The name of an ARRAY's dense element.
+    auto indexKey = [&](uint32_t index) -> Value {
+        char        digits[10];
+        uint32_t    len = 0;
+        Arena*      keys = this->arena;
+        Value       key;
+
+        if(!keys) {
+            if(!this->indexKeys) {
+                this->indexKeys = new Arena(1024);
+            }
+
+            keys = this->indexKeys;
+        }
+
+        do {
+            digits[len++] = '0' + (index % 10);
+            index /= 10;
+        } while(index);
+
+        key.val = (const char*)keys->allocate(len, 1);
+        key.len = len;
+
+        for(uint32_t i = 0; i < len; i++) {
+            ((char*)key.val)[i] = digits[len - i - 1];
+        }
+
+        return key;
+    };
+
+    // Without an arena, we free everything decode made.
+    auto newChild = [&](bool isMap, const Value& name) -> AMF3* {
+        AMF3* child = frame->node->createChild<AMF3>(name.val, name.len);
+
+        if(!this->arena) {
+            if(!this->decoded) {
+                this->decoded = new std::vector<AMF3*>();
+            }
+
+            this->decoded->push_back(child);
+            child->owned = true;
+        }
+
+        child->initProperties(isMap);
+
+        return child;
+    };
+
+    this->initProperties(false);
+
+    frame->node = this;
+    frame->kind = Types::UNDEFINED;
+    frame->remaining = count;
+
+    while(true) {
+        Property    prop;
+        Value       key = noName;
+        Frame       nested = { NULL, Types::UNDEFINED, false, 0, 0, 0 };
+        AMF3*       child = NULL;
+        bool        done = false;
+
+        // What's next where we are?
+        switch(frame->kind) {
+            case Types::OBJECT:
+                if(frame->next < traits[frame->trait].memberCount) {
+                    key = members[traits[frame->trait].firstMember +
+                                  frame->next++];
+                    break;
+                }
+
+                if(!traits[frame->trait].dynamic) {
+                    done = true;
+                    break;
+                }
+
+                // Dynamic members, up to an empty name.
+                if(!readString(key)) {
+                    return 0;
+                }
+
+                done = !key.len;
+                break;
+            case Types::ARRAY:
+                if(frame->keyed) {
+                    // Named members, up to an empty name, then the
+                    // dense part.
+                    if(!readString(key)) {
+                        return 0;
+                    }
+
+                    if(key.len) {
+                        break;
+                    }
+
+                    frame->keyed = false;
+                }
+
+                if(!frame->remaining) {
+                    done = true;
+                    break;
+                }
+
+                frame->remaining--;
+
+                if(frame->node->isMap) {
+                    key = indexKey(frame->next++);
+                }
+
+                break;
+            case Types::UNDEFINED:
+                // 'count' values, or up to the end of the buffer.
+                if(count ? !frame->remaining : !size) {
+                    done = true;
+                    break;
+                }
+
+                frame->remaining--;
+                break;
+            default:
+                // VECTOR_OBJECT and DICTIONARY
+                if(!frame->remaining) {
+                    done = true;
+                    break;
+                }
+
+                frame->remaining--;
+                break;
+        }
+
+        if(done) {
+            if(frame == stack) {
+                break;
+            }
+
+            frame--;
+            continue;
+        }
+
+        if(!size) {
+            return underflow("Not enough bytes to read AMF3 type", 1);
+        }
+
+        if(++nodes > limits.maxNodes) {
+            return fail(result, BAD_DATA, "Too many values in message");
+        }
+
+        prop.type = buf[0];
+        buf++;
+        size--;
+
+        switch(prop.type) {
+            case Types::UNDEFINED:
+            case Types::NILL:
+                break;
+            case Types::FALSE:
+            case Types::TRUE:
+                prop.property.number = (prop.type == Types::TRUE);
+                break;
+            case Types::INTEGER:
+                if(!readInt29(header)) {
+                    return 0;
+                }
+
+                // 29 bit two's complement
+                prop.property.number = (header & 0x10000000) ?
+                                       (double)((int32_t)header - 0x20000000) :
+                                       (double)header;
+                break;
+            case Types::DOUBLE:
+                if(size < 8) {
+                    return underflow("Not enough bytes to process DOUBLE", 8);
+                }
+
+                prop.property.number = this->decodeNumber(buf);
+                buf += 8;
+                size -= 8;
+                break;
+            case Types::STRING:
+                if(!readString(prop.property.value)) {
+                    return 0;
+                }
+
+                break;
+            case Types::DATE:
+                if(!readInt29(header)) {
+                    return 0;
+                }
+
+                if(!(header & 1)) {
+                    if(!reference(header >> 1, prop)) {
+                        return 0;
+                    }
+
+                    break;
+                }
+
+                if(size < 8) {
+                    return underflow("Not enough bytes to process DATE", 8);
+                }
+
+                prop.property.number = this->decodeNumber(buf);
+                buf += 8;
+                size -= 8;
+
+                objects.push_back(prop);
+                break;
+            case Types::XML_DOC:
+            case Types::XML:
+            case Types::BYTE_ARRAY:
+                if(!readInt29(header)) {
+                    return 0;
+                }
+
+                if(!(header & 1)) {
+                    if(!reference(header >> 1, prop)) {
+                        return 0;
+                    }
+
+                    break;
+                }
+
+                prop.property.value.val = buf;
+                prop.property.value.len = header >> 1;
+
+                if(size < prop.property.value.len) {
+                    return underflow(
+                        "Not enough bytes to load XML/BYTE_ARRAY",
+                        prop.property.value.len
+                    );
+                }
+
+                buf += prop.property.value.len;
+                size -= prop.property.value.len;
+
+                objects.push_back(prop);
+                break;
+            case Types::ARRAY:
+                if(!readInt29(header)) {
+                    return 0;
+                }
+
+                if(!(header & 1)) {
+                    if(!reference(header >> 1, prop)) {
+                        return 0;
+                    }
+
+                    break;
+                }
+
+                // At least the end of the named part, and a byte for
+                // each dense value.
+                if(size < 1 + (uint64_t)(header >> 1)) {
+                    return underflow("Not enough bytes for ARRAY",
+                                     1 + (uint64_t)(header >> 1));
+                }
+
+                nested.kind = Types::ARRAY;
+                nested.keyed = (buf[0] != 0x01);
+                nested.next = 0;
+                nested.remaining = header >> 1;
+
+                if(!nested.keyed) {
+                    buf++;
+                    size--;
+                }
+
+                child = newChild(nested.keyed, noName);
+                break;
+            case Types::OBJECT:
+                if(!readInt29(header)) {
+                    return 0;
+                }
+
+                if(!(header & 1)) {
+                    if(!reference(header >> 1, prop)) {
+                        return 0;
+                    }
+
+                    break;
+                }
+
+                nested.kind = Types::OBJECT;
+                nested.keyed = false;
+                nested.next = 0;
+                nested.remaining = 0;
+
+                if(!(header & 2)) {
+                    // Traits we've seen before.
+                    nested.trait = header >> 2;
+
+                    if(nested.trait >= traits.size()) {
+                        return fail(result, BAD_REFERENCE,
+                            "Reference to AMF3 traits not decoded yet");
+                    }
+                } else if(header & 4) {
+                    return fail(result, BAD_DATA,
+                                "Can't decode externalizable AMF3 objects");
+                } else {
+                    Trait trait;
+
+                    trait.dynamic = header & 8;
+                    trait.memberCount = header >> 4;
+                    trait.firstMember = members.size();
+
+                    if(!readString(trait.className)) {
+                        return 0;
+                    }
+
+                    // Each name is at least a byte.
+                    if(size < trait.memberCount) {
+                        return underflow("Not enough bytes for member names",
+                                         trait.memberCount);
+                    }
+
+                    for(uint32_t i = 0; i < trait.memberCount; i++) {
+                        Value member;
+
+                        if(!readString(member)) {
+                            return 0;
+                        }
+
+                        members.push_back(member);
+                    }
+
+                    nested.trait = traits.size();
+                    traits.push_back(trait);
+                }
+
+                child = newChild(true, traits[nested.trait].className);
+                break;
+            case Types::VECTOR_INT:
+            case Types::VECTOR_UINT:
+            case Types::VECTOR_DOUBLE:
+                if(!readInt29(header)) {
+                    return 0;
+                }
+
+                if(!(header & 1)) {
+                    if(!reference(header >> 1, prop)) {
+                        return 0;
+                    }
+
+                    break;
+                }
+
+                {
+                    uint32_t    width = (prop.type == Types::VECTOR_DOUBLE) ?
+                                        8 : 4;
+                    uint32_t    elements = header >> 1;
+                    Property    element;
+
+                    // The fixed-length flag, then the elements.
+                    if(size < 1 + (uint64_t)elements * width) {
+                        return underflow("Not enough bytes for VECTOR",
+                                         1 + (uint64_t)elements * width);
+                    }
+
+                    // Like a DENSE_NUMBERS array, each one counts.
+                    if((uint64_t)nodes + elements > limits.maxNodes) {
+                        return fail(result, BAD_DATA,
+                                    "Too many values in message");
+                    }
+
+                    nodes += elements;
+                    buf++;
+                    size--;
+
+                    child = newChild(false, noName);
+                    child->properties.propList->reserve(elements);
+
+                    for(uint32_t i = 0; i < elements; i++) {
+                        switch(prop.type) {
+                            case Types::VECTOR_INT:
+                                element.type = Types::INTEGER;
+                                element.property.number =
+                                    (int32_t)this->decodeInt32(buf);
+                                break;
+                            case Types::VECTOR_UINT:
+                                element.type = Types::INTEGER;
+                                element.property.number =
+                                    this->decodeInt32(buf);
+                                break;
+                            default:
+                                element.type = Types::DOUBLE;
+                                element.property.number =
+                                    this->decodeNumber(buf);
+                                break;
+                        }
+
+                        child->properties.propList->push_back(element);
+                        buf += width;
+                        size -= width;
+                    }
+                }
+
+                // Nothing more to decode in there.
+                prop.property.object = child;
+                objects.push_back(prop);
+                frame->node->addProperty(key, prop);
+                continue;
+            case Types::VECTOR_OBJECT:
+                if(!readInt29(header)) {
+                    return 0;
+                }
+
+                if(!(header & 1)) {
+                    if(!reference(header >> 1, prop)) {
+                        return 0;
+                    }
+
+                    break;
+                }
+
+                // The fixed-length flag, the type name, then a byte for
+                // each element.
+                if(size < 2 + (uint64_t)(header >> 1)) {
+                    return underflow("Not enough bytes for VECTOR_OBJECT",
+                                     2 + (uint64_t)(header >> 1));
+                }
+
+                buf++;
+                size--;
+
+                nested.kind = Types::VECTOR_OBJECT;
+                nested.remaining = header >> 1;
+
+                {
+                    Value typeName;
+
+                    if(!readString(typeName)) {
+                        return 0;
+                    }
+
+                    child = newChild(false, typeName);
+                }
+
+                break;
+            case Types::DICTIONARY:
+                if(!readInt29(header)) {
+                    return 0;
+                }
+
+                if(!(header & 1)) {
+                    if(!reference(header >> 1, prop)) {
+                        return 0;
+                    }
+
+                    break;
+                }
+
+                // The weak keys flag, then a byte for each key and value.
+                if(size < 1 + 2 * (uint64_t)(header >> 1)) {
+                    return underflow("Not enough bytes for DICTIONARY",
+                                     1 + 2 * (uint64_t)(header >> 1));
+                }
+
+                buf++;
+                size--;
+
+                nested.kind = Types::DICTIONARY;
+                nested.remaining = 2 * (header >> 1);
+
+                child = newChild(false, noName);
+                break;
+            default:
+                return fail(result, BAD_DATA, "Unknown AMF3 type received");
+        }
+
+        if(child) {
+            prop.property.object = child;
+            objects.push_back(prop);
+        }
+
+        frame->node->addProperty(key, prop);
+
+        if(!child) {
+            continue;
+        }
+
+        if(frame == deepest) {
+            return fail(result, BAD_DATA, "Objects nested too deep");
+        }
+
+        nested.node = child;
+        *++frame = nested;
+    }
+
+    this->source = start;
+    this->sourceSize = buf - start;
+
+    return buf - start;
+}
+
+/*
+ * The same walk as decodeValues, but nothing is made.  We still need
+ * the traits, to know what's in an OBJECT that uses ones we've seen,
+ * and how many strings and objects there have been, to check
+ * references; a trait is just its member count and dynamic bit.
+ */
+uint32_t AMF3::skipValues(const char* buf, uint32_t size, uint32_t count,
+                          Result& result, uint32_t maxDepth)
+{
+    // Something we're in the middle of skipping.
+    struct Frame
+    {
+        Types       kind;       // UNDEFINED for the top
+        bool        keyed;      // ARRAY: named members; OBJECT: dynamic
+        uint32_t    remaining;  // Values left, not counting named ones
+    };
+
+    std::vector<uint32_t>   traits;     // memberCount << 1 | dynamic
+    Frame                   stack[MAX_DEPTH + 1];
+    Frame*                  frame = stack;
+    Frame*                  deepest = stack + MIN(maxDepth, MAX_DEPTH);
+    const char*             start = buf;
+    uint32_t                strings = 0;
+    uint32_t                objects = 0;
+    uint32_t                header;
+    uint32_t                len;
+
+    // We need 'n' more bytes than we have at buf.
+    auto underflow = [&](const char* message, uint64_t n) -> uint32_t {
+        return fail(result, NEED_MORE_DATA, message,
+                    (uint64_t)(buf - start) + n);
+    };
+
+    auto readInt29 = [&](uint32_t& value) -> bool {
+        uint32_t left = size;
+
+        if(!decodeInt29((const unsigned char*)buf, left, value)) {
+            underflow("Not enough bytes to decode Int29", (uint64_t)size + 1);
+            return false;
+        }
+
+        buf += size - left;
+        size = left;
+        return true;
+    };
+
+    // Sets 'len' to the string's length, so we know an empty one.
+    auto skipString = [&]() -> bool {
+        if(!readInt29(header)) {
+            return false;
+        }
+
+        if(!(header & 1)) {
+            if((header >> 1) >= strings) {
+                fail(result, BAD_REFERENCE,
+                     "Reference to an AMF3 string that isn't decoded yet");
+                return false;
+            }
+
+            len = 1;
+            return true;
+        }
+
+        len = header >> 1;
+
+        if(size < len) {
+            underflow("Not enough bytes to load AMF3 string", len);
+            return false;
+        }
+
+        buf += len;
+        size -= len;
+
+        if(len) {
+            strings++;
+        }
+
+        return true;
+    };
+
+    // Read the header of something that can be sent by reference.
+    // Returns false with result OK if it was a (good) reference.
+    auto inlineHeader = [&]() -> bool {
+        if(!readInt29(header)) {
+            return false;
+        }
+
+        if(!(header & 1) && ((header >> 1) >= objects)) {
+            fail(result, BAD_REFERENCE,
+                 "Reference to an AMF3 object that isn't decoded yet");
+        }
+
+        return header & 1;
+    };
+
+    frame->kind = Types::UNDEFINED;
+    frame->keyed = false;
+    frame->remaining = count;
+
+    while(true) {
+        Frame   nested = { Types::UNDEFINED, false, 0 };
+        bool    done = false;
+
+        // What's next where we are?  Keys are just strings to skip.
+        switch(frame->kind) {
+            case Types::OBJECT:
+            case Types::ARRAY:
+                if(frame->keyed && (frame->kind == Types::ARRAY ||
+                                    !frame->remaining)) {
+                    if(!skipString()) {
+                        return 0;
+                    }
+
+                    if(len) {
+                        break;
+                    }
+
+                    frame->keyed = false;
+                }
+
+                if(!frame->remaining) {
+                    done = true;
+                    break;
+                }
+
+                frame->remaining--;
+                break;
+            case Types::UNDEFINED:
+                if(count ? !frame->remaining : !size) {
+                    done = true;
+                    break;
+                }
+
+                frame->remaining--;
+                break;
+            default:
+                if(!frame->remaining) {
+                    done = true;
+                    break;
+                }
+
+                frame->remaining--;
+                break;
+        }
+
+        if(done) {
+            if(frame == stack) {
+                break;
+            }
+
+            frame--;
+            continue;
+        }
+
+        if(!size) {
+            return underflow("Not enough bytes to read AMF3 type", 1);
+        }
+
+        buf++;
+        size--;
+
+        switch(buf[-1]) {
+            case Types::UNDEFINED:
+            case Types::NILL:
+            case Types::FALSE:
+            case Types::TRUE:
+                break;
+            case Types::INTEGER:
+                if(!readInt29(header)) {
+                    return 0;
+                }
+
+                break;
+            case Types::DOUBLE:
+                if(size < 8) {
+                    return underflow("Not enough bytes to process DOUBLE", 8);
+                }
+
+                buf += 8;
+                size -= 8;
+                break;
+            case Types::STRING:
+                if(!skipString()) {
+                    return 0;
+                }
+
+                break;
+            case Types::DATE:
+                if(!inlineHeader()) {
+                    break;
+                }
+
+                if(size < 8) {
+                    return underflow("Not enough bytes to process DATE", 8);
+                }
+
+                buf += 8;
+                size -= 8;
+                objects++;
+                break;
+            case Types::XML_DOC:
+            case Types::XML:
+            case Types::BYTE_ARRAY:
+                if(!inlineHeader()) {
+                    break;
+                }
+
+                if(size < (header >> 1)) {
+                    return underflow("Not enough bytes to load XML/BYTE_ARRAY",
+                                     header >> 1);
+                }
+
+                buf += header >> 1;
+                size -= header >> 1;
+                objects++;
+                break;
+            case Types::ARRAY:
+                if(!inlineHeader()) {
+                    break;
+                }
+
+                if(size < 1 + (uint64_t)(header >> 1)) {
+                    return underflow("Not enough bytes for ARRAY",
+                                     1 + (uint64_t)(header >> 1));
+                }
+
+                nested.kind = Types::ARRAY;
+                nested.keyed = (buf[0] != 0x01);
+                nested.remaining = header >> 1;
+
+                if(!nested.keyed) {
+                    buf++;
+                    size--;
+                }
+
+                objects++;
+                break;
+            case Types::OBJECT:
+                if(!inlineHeader()) {
+                    break;
+                }
+
+                if(!(header & 2)) {
+                    if((header >> 2) >= traits.size()) {
+                        return fail(result, BAD_REFERENCE,
+                            "Reference to AMF3 traits not decoded yet");
+                    }
+
+                    header = traits[header >> 2];
+                } else if(header & 4) {
+                    return fail(result, BAD_DATA,
+                                "Can't decode externalizable AMF3 objects");
+                } else {
+                    uint32_t trait = header >> 3;
+
+                    // The class name, then the sealed member names,
+                    // each at least a byte.
+                    if(!skipString()) {
+                        return 0;
+                    }
+
+                    if(size < (trait >> 1)) {
+                        return underflow("Not enough bytes for member names",
+                                         trait >> 1);
+                    }
+
+                    for(uint32_t i = 0; i < (trait >> 1); i++) {
+                        if(!skipString()) {
+                            return 0;
+                        }
+                    }
+
+                    traits.push_back(trait);
+                    header = trait;
+                }
+
+                nested.kind = Types::OBJECT;
+                nested.keyed = header & 1;
+                nested.remaining = header >> 1;
+                objects++;
+                break;
+            case Types::VECTOR_INT:
+            case Types::VECTOR_UINT:
+            case Types::VECTOR_DOUBLE:
+                {
+                    uint32_t width = (buf[-1] == Types::VECTOR_DOUBLE) ?
+                                     8 : 4;
+
+                    if(!inlineHeader()) {
+                        break;
+                    }
+
+                    if(size < 1 + (uint64_t)(header >> 1) * width) {
+                        return underflow("Not enough bytes for VECTOR",
+                                         1 + (uint64_t)(header >> 1) *
+                                         width);
+                    }
+
+                    buf += 1 + (header >> 1) * width;
+                    size -= 1 + (header >> 1) * width;
+                    objects++;
+                }
+                break;
+            case Types::VECTOR_OBJECT:
+                if(!inlineHeader()) {
+                    break;
+                }
+
+                if(size < 2 + (uint64_t)(header >> 1)) {
+                    return underflow("Not enough bytes for VECTOR_OBJECT",
+                                     2 + (uint64_t)(header >> 1));
+                }
+
+                buf++;
+                size--;
+
+                nested.kind = Types::VECTOR_OBJECT;
+                nested.remaining = header >> 1;
+
+                // Its type name.
+                if(!skipString()) {
+                    return 0;
+                }
+
+                objects++;
+                break;
+            case Types::DICTIONARY:
+                if(!inlineHeader()) {
+                    break;
+                }
+
+                if(size < 1 + 2 * (uint64_t)(header >> 1)) {
+                    return underflow("Not enough bytes for DICTIONARY",
+                                     1 + 2 * (uint64_t)(header >> 1));
+                }
+
+                buf++;
+                size--;
+
+                nested.kind = Types::DICTIONARY;
+                nested.remaining = 2 * (header >> 1);
+                objects++;
+                break;
+            default:
+                return fail(result, BAD_DATA, "Unknown AMF3 type received");
+        }
+
+        if(result.status) {
+            return 0;
+        }
+
+        if(nested.kind == Types::UNDEFINED) {
+            continue;
+        }
+
+        if(frame == deepest) {
+            return fail(result, BAD_DATA, "Objects nested too deep");
+        }
+
+        *++frame = nested;
+    }
+
+    return buf - start;
 }
 
 /*
  * Return size of buffer required to encode this object.
  * How this buffer is alloc'd is up to the caller.  The
  * resulting buffer will not be larger than this.
- *
- * It iterates over all items and child items, so therefore
- * this is a potentially expensive call.
  */
 uint32_t  AMF3::encodedSize()
 {
-    return 0;
+    if(!this->source) {
+        TDAMF_THROW(std::runtime_error(
+            "AMF3 can only be encoded as it was decoded"
+        ));
+    }
+
+    return this->sourceSize;
 }
 
 /*
@@ -75,19 +1108,24 @@ uint32_t  AMF3::propertySize(const Property& prop)
  * Requires a buffer that we will write to, with a size
  * parameter to say how much buffer is provided.  It will
  * return how many bytes of that buffer we actually consumed.
- *
- * You can use the "encodedSize" call to figure out the
- * minimum buffer size required to encode an object.
- * IMPLEMENTATION NOTE: The top level AMF0 object has no
- * type; it should be treated like a list.  encodeProperty
- * will use this method, but it will add the window dressing
- * (any pre-amble or post-amble bytes).
- *
- * The point is, only call this on a top-level AMF0 object.
  */
 uint32_t AMF3::encode(char* buf, uint32_t size)
 {
-    return 0;
+    FixedWriter out(buf, size);
+
+    return this->encode(out);
+}
+
+/*
+ * Copy out what we were decoded from.
+ */
+uint32_t AMF3::encode(Writer& out)
+{
+    uint32_t size = this->encodedSize();
+
+    out.append(this->source, size);
+
+    return size;
 }
 
 /*
@@ -95,6 +1133,33 @@ uint32_t AMF3::encode(char* buf, uint32_t size)
  */
 AMF3::~AMF3()
 {
+    // Arena objects get cleaned up by resetting the arena.
+    if(this->arena) {
+        return;
+    }
+
+    delete this->indexKeys;
+
+    // What decode made is freed all at once, by what it was decoded
+    // into.
+    if(this->decoded || this->owned) {
+        if(this->decoded) {
+            for(AMF3* node : *this->decoded) {
+                delete node;
+            }
+
+            delete this->decoded;
+        }
+
+        if(this->isMap) {
+            delete this->properties.propMap;
+        } else {
+            delete this->properties.propList;
+        }
+
+        return;
+    }
+
     if(this->isMap && this->properties.propMap) {
         // Iterate over map, delete what's an object type
         for(auto& kv: *this->properties.propMap) {
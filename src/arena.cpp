@@ -0,0 +1,107 @@
+/*
+ * arena.cpp
+ *
+ * Source code for the arena allocator used by the AMF decoders.
+ *
+ * @author sconley
+ * Copyright 2017
+ *********************************************************************
+ */
+
+#include "amf.hpp"
+
+using namespace Tigerdile;
+
+/*****************************************************************************
+ * Arena Definitions
+ ****************************************************************************/
+
+/*
+ * Nothing is allocated until the first request.
+ */
+Arena::Arena(size_t slabSize)
+{
+    this->slabSize = slabSize;
+}
+
+/*
+ * Free every slab we own.
+ */
+Arena::~Arena()
+{
+    Slab* slab = this->first;
+
+    while(slab) {
+        Slab* next = slab->next;
+
+        ::operator delete(slab);
+        slab = next;
+    }
+}
+
+/*
+ * Called when the current slab can't fit a request.  We first try any
+ * slabs left over from before a reset, and only go to the heap if none
+ * of them are big enough.
+ */
+void* Arena::allocateSlow(size_t size, size_t align)
+{
+    Slab* slab = this->current ? this->current->next : this->first;
+
+    // Worst case we lose (align - 1) bytes to alignment.
+    while(slab && (slab->size < size + align)) {
+        slab = slab->next;
+    }
+
+    if(!slab) {
+        size_t slabSize = MAX(this->slabSize, size + align);
+
+        slab = (Slab*)::operator new(sizeof(Slab) + slabSize);
+        slab->size = slabSize;
+
+        // Link it in right after our current slab so that slabs we
+        // skipped over are still found after a reset.
+        if(this->current) {
+            slab->next = this->current->next;
+            this->current->next = slab;
+        } else {
+            slab->next = this->first;
+            this->first = slab;
+        }
+    }
+
+    this->current = slab;
+    this->cur = (char*)(slab + 1);
+    this->end = this->cur + slab->size;
+
+    return this->allocate(size, align);
+}
+
+/*
+ * Rewind to the first slab.
+ */
+void Arena::reset()
+{
+    this->current = this->first;
+
+    if(this->first) {
+        this->cur = (char*)(this->first + 1);
+        this->end = this->cur + this->first->size;
+    } else {
+        this->cur = this->end = NULL;
+    }
+}
+
+/*
+ * Total bytes held by the arena across all slabs.
+ */
+size_t Arena::capacity() const
+{
+    size_t  result = 0;
+
+    for(Slab* slab = this->first; slab; slab = slab->next) {
+        result += slab->size;
+    }
+
+    return result;
+}
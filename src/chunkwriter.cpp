@@ -0,0 +1,252 @@
+/*
+ * chunkwriter.cpp
+ *
+ * Source code for the RTMP chunking Writer.
+ *
+ * @author sconley
+ * Copyright 2017
+ *********************************************************************
+ */
+
+#include "amf.hpp"
+
+using namespace Tigerdile;
+
+/*****************************************************************************
+ * ChunkWriter Definitions
+ ****************************************************************************/
+
+/*
+ * Nothing to write until begin.
+ */
+ChunkWriter::ChunkWriter(Writer& out, uint32_t chunkSize,
+                         uint32_t chunkStreamId) : out(out)
+{
+    if(!chunkSize) {
+        TDAMF_THROW(std::runtime_error("Chunk size can't be 0"));
+    }
+
+    if((chunkStreamId < 2) || (chunkStreamId > 65599)) {
+        TDAMF_THROW(std::runtime_error("Chunk stream ID must be 2 to 65599"));
+    }
+
+    this->chunkSize = chunkSize;
+    this->chunkStreamId = chunkStreamId;
+}
+
+/*
+ * Write the type 0 header.
+ */
+void ChunkWriter::begin(uint32_t length, unsigned char typeId,
+                        uint32_t messageStreamId, uint32_t timestamp)
+{
+    uint32_t    ts = MIN(timestamp, 0xFFFFFF);
+    uint32_t    used;
+    char*       p;
+
+    if(length > 0xFFFFFF) {
+        TDAMF_THROW(std::overflow_error("RTMP messages can't be over 16MB"));
+    }
+
+    this->settle();
+    this->timestamp = timestamp;
+
+    // Basic header, message header, extended timestamp.
+    p = this->out.reserve(18);
+    used = this->basicHeader(p, 0);
+
+    p[used] = (char)(ts >> 16);
+    p[used + 1] = (char)(ts >> 8);
+    p[used + 2] = (char)ts;
+    p[used + 3] = (char)(length >> 16);
+    p[used + 4] = (char)(length >> 8);
+    p[used + 5] = (char)length;
+    p[used + 6] = typeId;
+
+    // The one little endian field in RTMP.
+    p[used + 7] = (char)messageStreamId;
+    p[used + 8] = (char)(messageStreamId >> 8);
+    p[used + 9] = (char)(messageStreamId >> 16);
+    p[used + 10] = (char)(messageStreamId >> 24);
+    used += 11;
+
+    if(timestamp >= 0xFFFFFF) {
+        AMF::encodeInt32(timestamp, &p[used]);
+        used += 4;
+    }
+
+    this->out.commit(used);
+
+    this->messageLeft = length;
+    this->chunkLeft = MIN(this->chunkSize, length);
+    this->flushed = 0;
+}
+
+/*
+ * Make sure the whole message got written.
+ */
+void ChunkWriter::finish()
+{
+    this->settle();
+
+    if(this->messageLeft) {
+        TDAMF_THROW(std::runtime_error(
+            "Message is shorter than the length it was started with"
+        ));
+    }
+}
+
+/*
+ * Encode a whole message.  encodedSize comes in over if there are
+ * references, so we count what encode really writes first.
+ */
+uint32_t ChunkWriter::write(AMF0& message, unsigned char typeId,
+                            uint32_t messageStreamId, uint32_t timestamp)
+{
+    CountingWriter  counter;
+    uint32_t        length;
+
+    message.encode(counter);
+    length = counter.size();
+
+    this->begin(length, typeId, messageStreamId, timestamp);
+    message.encode(*this);
+    this->finish();
+
+    return length;
+}
+
+/*
+ * Our window is used up.  Give it to 'out' and get a new one: the rest
+ * of the current chunk if what's wanted fits, or scratch if it has to be
+ * split over two chunks.
+ */
+void ChunkWriter::flush(uint32_t need)
+{
+    this->settle();
+
+    if(need > this->messageLeft) {
+        TDAMF_THROW(std::overflow_error("Wrote more than the message length"));
+    }
+
+    if(!this->chunkLeft) {
+        this->nextChunk();
+    }
+
+    if(need <= this->chunkLeft) {
+        this->start = this->cur = this->out.reserve(this->chunkLeft);
+        this->end = this->start + this->chunkLeft;
+    } else {
+        // Only small things (type bytes and lengths) are reserved;
+        // bigger things come in through append.
+        if(need > sizeof(this->scratch)) {
+            TDAMF_THROW(std::runtime_error("Reserved too much to stage"));
+        }
+
+        this->staged = true;
+        this->start = this->cur = this->scratch;
+        this->end = this->scratch + need;
+    }
+}
+
+/*
+ * Copy straight into the chunks.
+ */
+void ChunkWriter::appendSlow(const char* data, uint32_t n)
+{
+    this->settle();
+    this->drain(data, n);
+}
+
+/*
+ * Hand our window over to 'out'.
+ */
+void ChunkWriter::settle()
+{
+    uint32_t used = this->cur - this->start;
+
+    if(this->staged) {
+        this->staged = false;
+        this->start = this->cur = this->end = NULL;
+        this->drain(this->scratch, used);
+    } else if(this->start) {
+        this->out.commit(used);
+        this->chunkLeft -= used;
+        this->messageLeft -= used;
+        this->flushed += used;
+        this->start = this->cur = this->end = NULL;
+    }
+}
+
+/*
+ * Copy data into the chunk stream, adding headers as needed.
+ */
+void ChunkWriter::drain(const char* data, uint32_t n)
+{
+    uint32_t    copy;
+    char*       p;
+
+    if(n > this->messageLeft) {
+        TDAMF_THROW(std::overflow_error("Wrote more than the message length"));
+    }
+
+    while(n) {
+        if(!this->chunkLeft) {
+            this->nextChunk();
+        }
+
+        copy = MIN(n, this->chunkLeft);
+
+        p = this->out.reserve(copy);
+        memcpy(p, data, copy);
+        this->out.commit(copy);
+
+        this->chunkLeft -= copy;
+        this->messageLeft -= copy;
+        this->flushed += copy;
+        data += copy;
+        n -= copy;
+    }
+}
+
+/*
+ * Write a basic header with format 'fmt'.  Returns the bytes used.
+ */
+uint32_t ChunkWriter::basicHeader(char* p, unsigned char fmt)
+{
+    uint32_t used;
+
+    if(this->chunkStreamId < 64) {
+        p[0] = (fmt << 6) | this->chunkStreamId;
+        used = 1;
+    } else if(this->chunkStreamId < 320) {
+        p[0] = fmt << 6;
+        p[1] = this->chunkStreamId - 64;
+        used = 2;
+    } else {
+        p[0] = (fmt << 6) | 1;
+        p[1] = (this->chunkStreamId - 64) & 0xff;
+        p[2] = (this->chunkStreamId - 64) >> 8;
+        used = 3;
+    }
+
+    return used;
+}
+
+/*
+ * Start the next chunk of the message with a type 3 header.
+ */
+void ChunkWriter::nextChunk()
+{
+    char*       p = this->out.reserve(7);
+    uint32_t    used = this->basicHeader(p, 3);
+
+    // Type 3 headers repeat the extended timestamp.
+    if(this->timestamp >= 0xFFFFFF) {
+        AMF::encodeInt32(this->timestamp, &p[used]);
+        used += 4;
+    }
+
+    this->out.commit(used);
+    this->chunkLeft = MIN(this->chunkSize, this->messageLeft);
+}
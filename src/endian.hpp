@@ -15,6 +15,10 @@
 #ifndef __ENDIAN_HPP__
 #define __ENDIAN_HPP__
 
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
 /*
  * Define byte order if not defined
  *
@@ -77,5 +81,120 @@
 #   define LOG(s)
 #endif
 
+namespace Tigerdile
+{
+/*****************************************************************************
+ * Endian
+ *
+ * Loads and stores of big endian (network order) integers, and the odd
+ * little endian one, at any address.  A memcpy of a constant size is
+ * just a load or store to the compiler, and __builtin_bswap is a single
+ * bswap (or movbe, where the CPU has it), so these cost the same as
+ * casting the pointer, without the trouble with unaligned addresses.
+ *****************************************************************************/
+
+    class Endian
+    {
+        public:
+            static inline uint16_t loadBE16(const char* data)
+            {
+                uint16_t val;
+
+                memcpy(&val, data, 2);
+
+                return fromBE16(val);
+            }
+
+            /*
+             * RTMP timestamps and lengths.
+             */
+            static inline uint32_t loadBE24(const char* data)
+            {
+                const unsigned char* p = (const unsigned char*)data;
+
+                return (p[0] << 16) | (p[1] << 8) | p[2];
+            }
+
+            static inline uint32_t loadBE32(const char* data)
+            {
+                uint32_t val;
+
+                memcpy(&val, data, 4);
+
+                return fromBE32(val);
+            }
+
+            static inline uint64_t loadBE64(const char* data)
+            {
+                uint64_t val;
+
+                memcpy(&val, data, 8);
+
+                return fromBE64(val);
+            }
+
+            static inline uint32_t loadLE32(const char* data)
+            {
+                uint32_t val;
+
+                memcpy(&val, data, 4);
+
+#               if __BYTE_ORDER == __BIG_ENDIAN
+                    val = __builtin_bswap32(val);
+#               endif
+
+                return val;
+            }
+
+            static inline void storeBE16(uint16_t val, char* data)
+            {
+                val = fromBE16(val);
+                memcpy(data, &val, 2);
+            }
+
+            static inline void storeBE32(uint32_t val, char* data)
+            {
+                val = fromBE32(val);
+                memcpy(data, &val, 4);
+            }
+
+            static inline void storeBE64(uint64_t val, char* data)
+            {
+                val = fromBE64(val);
+                memcpy(data, &val, 8);
+            }
+
+            /*
+             * Swapping is its own inverse, so these go both ways.
+             */
+            static inline uint16_t fromBE16(uint16_t val)
+            {
+#               if __BYTE_ORDER == __LITTLE_ENDIAN
+                    return __builtin_bswap16(val);
+#               else
+                    return val;
+#               endif
+            }
+
+            static inline uint32_t fromBE32(uint32_t val)
+            {
+#               if __BYTE_ORDER == __LITTLE_ENDIAN
+                    return __builtin_bswap32(val);
+#               else
+                    return val;
+#               endif
+            }
+
+            static inline uint64_t fromBE64(uint64_t val)
+            {
+#               if __BYTE_ORDER == __LITTLE_ENDIAN
+                    return __builtin_bswap64(val);
+#               else
+                    return val;
+#               endif
+            }
+    };
+}
+
 
 #endif
@@ -0,0 +1,365 @@
+/*
+ * writer.cpp
+ *
+ * Source code for the places encode can write to.
+ *
+ * @author sconley
+ * Copyright 2017
+ *********************************************************************
+ */
+
+#include "amf.hpp"
+
+using namespace Tigerdile;
+
+/*****************************************************************************
+ * Writer Definitions
+ ****************************************************************************/
+
+/*
+ * Make room for the whole thing, and copy it in.
+ */
+void Writer::appendSlow(const char* data, uint32_t n)
+{
+    this->flush(n);
+
+    memcpy(this->cur, data, n);
+    this->cur += n;
+}
+
+/*****************************************************************************
+ * FixedWriter Definitions
+ ****************************************************************************/
+
+/*
+ * There's no more room than what we were given.
+ */
+void FixedWriter::flush(uint32_t)
+{
+    TDAMF_THROW(std::overflow_error("Not enough buffer to encode into"));
+}
+
+/*****************************************************************************
+ * GrowableWriter Definitions
+ ****************************************************************************/
+
+/*
+ * Free our buffer.
+ */
+GrowableWriter::~GrowableWriter()
+{
+    free(this->start);
+}
+
+/*
+ * Double until we fit.
+ */
+void GrowableWriter::flush(uint32_t need)
+{
+    size_t  used = this->cur - this->start;
+    size_t  capacity = MAX((size_t)(this->end - this->start) * 2,
+                           this->initialSize);
+    char*   grown;
+
+    while(capacity - used < need) {
+        capacity *= 2;
+    }
+
+    if(capacity > UINT32_MAX) {
+        TDAMF_THROW(std::overflow_error("Can't encode more than 4GB"));
+    }
+
+    if(!(grown = (char*)realloc(this->start, capacity))) {
+        TDAMF_THROW(std::bad_alloc());
+    }
+
+    this->start = grown;
+    this->cur = grown + used;
+    this->end = grown + capacity;
+}
+
+/*****************************************************************************
+ * VectorWriter Definitions
+ ****************************************************************************/
+
+/*
+ * Our window starts out empty, at the end of 'out'.
+ */
+VectorWriter::VectorWriter(std::vector<char>& out) : out(out)
+{
+    this->base = out.size();
+    this->start = this->cur = this->end = out.data() + this->base;
+}
+
+/*
+ * Leave 'out' holding just what we wrote.
+ */
+VectorWriter::~VectorWriter()
+{
+    this->finish();
+}
+
+/*
+ * Drop the room we grew ahead of what we used.  Our window is left
+ * empty at the new end, so we can still be written to.
+ */
+void VectorWriter::finish()
+{
+    size_t  used = this->cur - this->start;
+
+    this->out.resize(this->base + used);
+    this->start = this->out.data() + this->base;
+    this->cur = this->end = this->start + used;
+}
+
+/*
+ * Double until we fit, like GrowableWriter.
+ */
+void VectorWriter::flush(uint32_t need)
+{
+    size_t  used = this->cur - this->start;
+    size_t  capacity = MAX((size_t)(this->end - this->start) * 2, 256);
+
+    while(capacity - used < need) {
+        capacity *= 2;
+    }
+
+    if(capacity > UINT32_MAX) {
+        TDAMF_THROW(std::overflow_error("Can't encode more than 4GB"));
+    }
+
+    this->out.resize(this->base + capacity);
+    this->start = this->out.data() + this->base;
+    this->cur = this->start + used;
+    this->end = this->start + capacity;
+}
+
+/*****************************************************************************
+ * CountingWriter Definitions
+ ****************************************************************************/
+
+/*
+ * Free our scratch.
+ */
+CountingWriter::~CountingWriter()
+{
+    delete[] this->scratch;
+}
+
+/*
+ * Count what was written in our window, and start over in scratch;
+ * bigger, if it has to be.  If we were writing into a buffer, we're
+ * counting from now on.
+ */
+void CountingWriter::flush(uint32_t need)
+{
+    this->flushed += this->cur - this->start;
+    this->counting = true;
+    this->copyLimit = 0;
+
+    if(need > this->scratchSize) {
+        delete[] this->scratch;
+
+        this->scratchSize = MAX(need, 64);
+        this->scratch = new char[this->scratchSize];
+    }
+
+    this->start = this->cur = this->scratch;
+    this->end = this->scratch + this->scratchSize;
+}
+
+/*
+ * Once we're counting, our copyLimit sends every append here, so
+ * nothing is copied.  Before that, this is what didn't fit.
+ */
+void CountingWriter::appendSlow(const char*, uint32_t n)
+{
+    if(!this->counting) {
+        this->flush(0);
+    }
+
+    this->flushed += n;
+}
+
+/*****************************************************************************
+ * CallbackWriter Definitions
+ ****************************************************************************/
+
+/*
+ * Set up our block.
+ */
+CallbackWriter::CallbackWriter(Callback callback, uint32_t blockSize)
+    : callback(callback)
+{
+    this->blockSize = blockSize;
+    this->start = this->cur = new char[blockSize];
+    this->end = this->start + blockSize;
+}
+
+/*
+ * We don't call finish() here; the callback may throw, and anything not
+ * finished by then was probably abandoned anyway.
+ */
+CallbackWriter::~CallbackWriter()
+{
+    delete[] this->start;
+}
+
+/*
+ * Hand off our block.  Our block can always fit anything reserve is
+ * asked for, but we grow it if we have to.
+ */
+void CallbackWriter::flush(uint32_t need)
+{
+    this->finish();
+
+    if(need > this->blockSize) {
+        delete[] this->start;
+
+        this->blockSize = need;
+        this->start = this->cur = new char[need];
+        this->end = this->start + need;
+    }
+}
+
+/*
+ * Big things go straight to the callback, rather than through our block.
+ */
+void CallbackWriter::appendSlow(const char* data, uint32_t n)
+{
+    this->finish();
+
+    if(n < this->blockSize) {
+        memcpy(this->cur, data, n);
+        this->cur += n;
+        return;
+    }
+
+    this->callback(data, n);
+    this->flushed += n;
+}
+
+/*
+ * Pass along whatever is in our block.
+ */
+void CallbackWriter::finish()
+{
+    if(this->cur > this->start) {
+        this->callback(this->start, this->cur - this->start);
+        this->flushed += this->cur - this->start;
+        this->cur = this->start;
+    }
+}
+
+/*****************************************************************************
+ * IovecWriter Definitions
+ ****************************************************************************/
+
+/*
+ * Nothing is allocated until the first write.
+ */
+IovecWriter::IovecWriter(uint32_t copyLimit, uint32_t blockSize)
+{
+    this->copyLimit = copyLimit;
+    this->blockSize = blockSize;
+    this->segments.reserve(16);
+}
+
+/*
+ * Free our blocks.
+ */
+IovecWriter::~IovecWriter()
+{
+    for(auto& block : this->blocks) {
+        delete[] block.first;
+    }
+}
+
+/*
+ * Out of room in this block; get another.  Whatever we wrote in this one
+ * becomes an iovec.  Blocks are never resized, since iovecs point into
+ * them.
+ */
+void IovecWriter::flush(uint32_t need)
+{
+    std::pair<char*, uint32_t>  block;
+    size_t                      i;
+
+    this->closeSegment();
+
+    // Re-use a block from before clear() if one is big enough.  Any we
+    // skip are still there for next time.
+    for(i = this->used; i < this->blocks.size(); i++) {
+        if(this->blocks[i].second >= need) {
+            break;
+        }
+    }
+
+    if(i == this->blocks.size()) {
+        block.second = MAX(this->blockSize, need);
+        block.first = new char[block.second];
+        this->blocks.push_back(block);
+    }
+
+    std::swap(this->blocks[i], this->blocks[this->used]);
+    block = this->blocks[this->used++];
+
+    this->start = this->cur = block.first;
+    this->end = block.first + block.second;
+}
+
+/*
+ * Big strings get their own iovec.
+ */
+void IovecWriter::appendSlow(const char* data, uint32_t n)
+{
+    struct iovec segment;
+
+    if(n <= this->copyLimit) {
+        Writer::appendSlow(data, n);
+        return;
+    }
+
+    this->closeSegment();
+
+    segment.iov_base = (void*)data;
+    segment.iov_len = n;
+    this->segments.push_back(segment);
+    this->flushed += n;
+}
+
+/*
+ * Close off the last iovec.
+ */
+void IovecWriter::finish()
+{
+    this->closeSegment();
+}
+
+/*
+ * Start over.
+ */
+void IovecWriter::clear()
+{
+    this->used = 0;
+    this->segments.clear();
+    this->start = this->cur = this->end = NULL;
+    this->flushed = 0;
+}
+
+/*
+ * Add what's been written since 'start' as an iovec.  The rest of the
+ * block is still ours to write to.
+ */
+void IovecWriter::closeSegment()
+{
+    struct iovec segment;
+
+    if(this->cur > this->start) {
+        segment.iov_base = this->start;
+        segment.iov_len = this->cur - this->start;
+        this->segments.push_back(segment);
+        this->flushed += segment.iov_len;
+        this->start = this->cur;
+    }
+}
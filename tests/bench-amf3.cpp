@@ -0,0 +1,246 @@
+/*
+ * bench-amf3.cpp
+ *
+ * Time the AMF3 decoder against the AMF0 one, on the same message in
+ * each encoding.  This isn't run by ctest; run it by hand after touching
+ * either decoder.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "amf.hpp"
+
+
+using namespace Tigerdile;
+
+/*
+ * A connect-like command object, then a list of keyframes, each an
+ * object with the same three members.  That's the kind of thing AMF3's
+ * string and trait tables are for.
+ */
+static const uint32_t   KEYFRAMES = 64;
+
+static const char*      fields[][2] = {
+    { "app", "live" },
+    { "flashVer", "FMLE/3.0 (compatible; FMSc/1.0)" },
+    { "swfUrl", "rtmp://example.com/live" },
+    { "tcUrl", "rtmp://example.com/live" },
+    { "type", "nonprivate" }
+};
+
+static void amf0String(std::vector<char>& out, const char* s)
+{
+    uint32_t len = strlen(s);
+
+    out.push_back(len >> 8);
+    out.push_back(len);
+    out.insert(out.end(), s, s + len);
+}
+
+static void amf0Number(std::vector<char>& out, double n)
+{
+    char bytes[8];
+
+    AMF::encodeNumber(n, bytes);
+    out.push_back(AMF0::Types::NUMBER);
+    out.insert(out.end(), bytes, bytes + 8);
+}
+
+static std::vector<char> makeAMF0()
+{
+    std::vector<char> out;
+
+    out.push_back(AMF0::Types::STRING);
+    amf0String(out, "connect");
+    amf0Number(out, 1);
+
+    out.push_back(AMF0::Types::OBJECT);
+
+    for(auto& field : fields) {
+        amf0String(out, field[0]);
+        out.push_back(AMF0::Types::STRING);
+        amf0String(out, field[1]);
+    }
+
+    amf0String(out, "capabilities");
+    amf0Number(out, 239);
+    amf0String(out, "objectEncoding");
+    amf0Number(out, 3);
+    out.insert(out.end(), { 0x00, 0x00, 0x09 });
+
+    out.insert(out.end(), { AMF0::Types::STRICT_ARRAY, 0, 0, 0,
+                            (char)KEYFRAMES });
+
+    for(uint32_t i = 0; i < KEYFRAMES; i++) {
+        out.push_back(AMF0::Types::OBJECT);
+        amf0String(out, "time");
+        amf0Number(out, i * 2.5);
+        amf0String(out, "offset");
+        amf0Number(out, i * 4096);
+        amf0String(out, "label");
+        out.push_back(AMF0::Types::STRING);
+        amf0String(out, "keyframe");
+        out.insert(out.end(), { 0x00, 0x00, 0x09 });
+    }
+
+    return out;
+}
+
+/*
+ * U29, for values under 2^21.
+ */
+static void amf3Int29(std::vector<char>& out, uint32_t n)
+{
+    if(n < 0x80) {
+        out.push_back(n);
+    } else if(n < 0x4000) {
+        out.push_back(0x80 | (n >> 7));
+        out.push_back(n & 0x7F);
+    } else {
+        out.push_back(0x80 | (n >> 14));
+        out.push_back(0x80 | ((n >> 7) & 0x7F));
+        out.push_back(n & 0x7F);
+    }
+}
+
+/*
+ * An AMF3 string, by reference if we've sent it before.
+ */
+static void amf3String(std::vector<char>& out,
+                       std::vector<std::string>& table, const char* s)
+{
+    uint32_t len = strlen(s);
+
+    for(uint32_t i = 0; i < table.size(); i++) {
+        if(table[i] == s) {
+            amf3Int29(out, i << 1);
+            return;
+        }
+    }
+
+    if(len) {
+        table.push_back(s);
+    }
+
+    amf3Int29(out, (len << 1) | 1);
+    out.insert(out.end(), s, s + len);
+}
+
+static std::vector<char> makeAMF3()
+{
+    std::vector<char>           out;
+    std::vector<std::string>    strings;
+    char                        bytes[8];
+
+    out.push_back(AMF3::Types::STRING);
+    amf3String(out, strings, "connect");
+    out.push_back(AMF3::Types::INTEGER);
+    amf3Int29(out, 1);
+
+    // Anonymous and dynamic, with no sealed members.
+    out.push_back(AMF3::Types::OBJECT);
+    out.push_back(0x0B);
+    amf3String(out, strings, "");
+
+    for(auto& field : fields) {
+        amf3String(out, strings, field[0]);
+        out.push_back(AMF3::Types::STRING);
+        amf3String(out, strings, field[1]);
+    }
+
+    amf3String(out, strings, "capabilities");
+    out.push_back(AMF3::Types::INTEGER);
+    amf3Int29(out, 239);
+    amf3String(out, strings, "objectEncoding");
+    out.push_back(AMF3::Types::INTEGER);
+    amf3Int29(out, 3);
+    amf3String(out, strings, "");
+
+    out.push_back(AMF3::Types::ARRAY);
+    amf3Int29(out, (KEYFRAMES << 1) | 1);
+    amf3String(out, strings, "");
+
+    for(uint32_t i = 0; i < KEYFRAMES; i++) {
+        out.push_back(AMF3::Types::OBJECT);
+
+        if(!i) {
+            // Sealed time, offset and label; the rest use these traits,
+            // which are second in the table after the command object's.
+            out.push_back(0x33);
+            amf3String(out, strings, "Keyframe");
+            amf3String(out, strings, "time");
+            amf3String(out, strings, "offset");
+            amf3String(out, strings, "label");
+        } else {
+            out.push_back(0x05);
+        }
+
+        AMF::encodeNumber(i * 2.5, bytes);
+        out.push_back(AMF3::Types::DOUBLE);
+        out.insert(out.end(), bytes, bytes + 8);
+        out.push_back(AMF3::Types::INTEGER);
+        amf3Int29(out, i * 4096);
+        out.push_back(AMF3::Types::STRING);
+        amf3String(out, strings, "keyframe");
+    }
+
+    return out;
+}
+
+/*
+ * Run 'loop' enough times to get a stable number, and print the time per
+ * message and throughput.
+ */
+template<typename F>
+static void timeIt(const char* name, uint32_t size, F loop)
+{
+    const int   rounds = 20000;
+    auto        start = std::chrono::steady_clock::now();
+
+    for(int i = 0; i < rounds; i++) {
+        loop();
+    }
+
+    std::chrono::duration<double, std::nano> took =
+        std::chrono::steady_clock::now() - start;
+
+    printf("%-24s %5u bytes %8.0f ns/message %7.1f MB/s\n", name, size,
+           took.count() / rounds, size * 1e3 * rounds / took.count());
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<char>   amf0 = makeAMF0();
+    std::vector<char>   amf3 = makeAMF3();
+    Arena               arena;
+
+    timeIt("AMF0 decode", amf0.size(), [&]() {
+        AMF0 decoded;
+
+        decoded.decode(amf0.data(), amf0.size());
+    });
+
+    timeIt("AMF3 decode", amf3.size(), [&]() {
+        AMF3 decoded;
+
+        decoded.decode(amf3.data(), amf3.size());
+    });
+
+    timeIt("AMF0 decode (arena)", amf0.size(), [&]() {
+        AMF0 decoded;
+
+        decoded.decode(amf0.data(), amf0.size(), arena);
+        arena.reset();
+    });
+
+    timeIt("AMF3 decode (arena)", amf3.size(), [&]() {
+        AMF3 decoded;
+
+        decoded.decode(amf3.data(), amf3.size(), arena);
+        arena.reset();
+    });
+
+    return (int) 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * bench-endian.cpp
+ *
+ * Time the primitive decoders and encoders against the byte-at-a-time
+ * versions they replaced.  This isn't run by ctest; run it by hand after
+ * touching endian.hpp or the primitives in amf.hpp.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include "amf.hpp"
+
+
+using namespace Tigerdile;
+
+/*
+ * The way decodeNumber and encodeNumber used to do it (from librtmp).
+ */
+static inline double oldDecodeNumber(const char* data)
+{
+    double ret;
+    unsigned char *ci, *co;
+    ci = (unsigned char *)data;
+    co = (unsigned char *)&ret;
+    co[0] = ci[7];
+    co[1] = ci[6];
+    co[2] = ci[5];
+    co[3] = ci[4];
+    co[4] = ci[3];
+    co[5] = ci[2];
+    co[6] = ci[1];
+    co[7] = ci[0];
+    return ret;
+}
+
+static inline void oldEncodeNumber(double val, char *data)
+{
+    unsigned char *ci, *co;
+    ci = (unsigned char *)&val;
+    co = (unsigned char *)data;
+    co[0] = ci[7];
+    co[1] = ci[6];
+    co[2] = ci[5];
+    co[3] = ci[4];
+    co[4] = ci[3];
+    co[5] = ci[2];
+    co[6] = ci[1];
+    co[7] = ci[0];
+}
+
+/*
+ * Run 'loop' enough times to get a stable number, and print the time per
+ * value.
+ */
+template<typename F>
+static void timeIt(const char* name, uint32_t values, F loop)
+{
+    const int   rounds = 2000;
+    auto        start = std::chrono::steady_clock::now();
+
+    for(int i = 0; i < rounds; i++) {
+        loop();
+    }
+
+    std::chrono::duration<double, std::nano> took =
+        std::chrono::steady_clock::now() - start;
+
+    printf("%-28s %6.3f ns/value\n", name,
+           took.count() / rounds / values);
+}
+
+int main(int argc, char** argv)
+{
+    // NUMBERs as they are in a message: a type byte, then 8 bytes, so
+    // every other one is at an odd address.
+    const uint32_t      count = 4096;
+    std::vector<char>   wire(count * 9);
+    std::vector<char>   packed(count * 8);
+    std::vector<double> numbers(count);
+    volatile double     sink = 0;
+
+    for(uint32_t i = 0; i < count; i++) {
+        numbers[i] = i * 1.5;
+        wire[i * 9] = AMF0::Types::NUMBER;
+        AMF::encodeNumber(numbers[i], &wire[i * 9 + 1]);
+    }
+
+    AMF::encodeNumbers(numbers.data(), count, packed.data());
+
+    timeIt("decodeNumber (bytewise)", count, [&]() {
+        double sum = 0;
+
+        for(uint32_t i = 0; i < count; i++) {
+            sum += oldDecodeNumber(&wire[i * 9 + 1]);
+        }
+
+        sink = sum;
+    });
+
+    timeIt("decodeNumber (bswap)", count, [&]() {
+        double sum = 0;
+
+        for(uint32_t i = 0; i < count; i++) {
+            sum += AMF::decodeNumber(&wire[i * 9 + 1]);
+        }
+
+        sink = sum;
+    });
+
+    timeIt("encodeNumber (bytewise)", count, [&]() {
+        for(uint32_t i = 0; i < count; i++) {
+            oldEncodeNumber(numbers[i], &wire[i * 9 + 1]);
+        }
+
+        sink = wire[count];
+    });
+
+    timeIt("encodeNumber (bswap)", count, [&]() {
+        for(uint32_t i = 0; i < count; i++) {
+            AMF::encodeNumber(numbers[i], &wire[i * 9 + 1]);
+        }
+
+        sink = wire[count];
+    });
+
+    timeIt("decodeNumbers (batch)", count, [&]() {
+        AMF::decodeNumbers(packed.data(), numbers.data(), count);
+        sink = numbers[count / 2];
+    });
+
+    timeIt("encodeNumbers (batch)", count, [&]() {
+        AMF::encodeNumbers(numbers.data(), count, packed.data());
+        sink = packed[count];
+    });
+
+    timeIt("decodeInt32 (unaligned)", count, [&]() {
+        uint32_t sum = 0;
+
+        for(uint32_t i = 0; i < count; i++) {
+            sum += AMF::decodeInt32(&wire[i * 9 + 1]);
+        }
+
+        sink = sum;
+    });
+
+    return (int) 0;
+}
@@ -15,6 +15,29 @@
 
 using namespace Tigerdile;
 
+/*
+ * For the binding test; this is the first object in our test message,
+ * plus something that isn't in there.
+ */
+struct BoundChild
+{
+    AMF::Value  key1;
+    AMF::Value  key2;
+    double      number = 0;
+    bool        missing = false;
+};
+
+static const AMF0Field boundFields[] = {
+    AMF0_FIELD(BoundChild, key1, AMF0Field::REQUIRED),
+    AMF0_FIELD(BoundChild, number, 0),
+    AMF0_FIELD_KEY(BoundChild, key2, "key2", AMF0Field::REQUIRED),
+    AMF0_FIELD(BoundChild, missing, 0)
+};
+
+static const AMF0Field requiredFields[] = {
+    AMF0_FIELD(BoundChild, missing, AMF0Field::REQUIRED)
+};
+
 int main(int argc, char** argv, char** envp)
 {
     /*
@@ -26,7 +49,7 @@ int main(int argc, char** argv, char** envp)
 
     // Let's put a little bit of everything in here.
     sourceAMF.isMap = false;
-    sourceAMF.properties.propList = new std::vector<AMF::Property>();
+    sourceAMF.properties.propList = new AMF::PropertyList();
 
     // Number
     tmp.type = AMF0::Types::NUMBER;
@@ -50,10 +73,9 @@ int main(int argc, char** argv, char** envp)
     AMF0* grandchildAMF = new AMF0();
 
     childAMF->isMap = true;
-    childAMF->properties.propMap = new std::map<AMF::Value, AMF::Property>();
+    childAMF->properties.propMap = new AMF::PropertyMap();
     grandchildAMF->isMap = true;
-    grandchildAMF->properties.propMap = 
-                                new std::map<AMF::Value, AMF::Property>();
+    grandchildAMF->properties.propMap = new AMF::PropertyMap();
     
 
     // Push a few things into child AMF
@@ -122,7 +144,7 @@ int main(int argc, char** argv, char** envp)
     // a little differently.
     childAMF = new AMF0();
     childAMF->isMap = 1;
-    childAMF->properties.propMap = new std::map<AMF::Value, AMF::Property>();
+    childAMF->properties.propMap = new AMF::PropertyMap();
 
     // we'll put a couple numbers in    
     key.len = 7;
@@ -147,7 +169,7 @@ int main(int argc, char** argv, char** envp)
     // STRICT_ARRAY, which is a list type.
     childAMF = new AMF0();
     childAMF->isMap = 0;
-    childAMF->properties.propList = new std::vector<AMF::Property>();
+    childAMF->properties.propList = new AMF::PropertyList();
 
     tmp.type = AMF0::Types::NUMBER;
     tmp.property.number = 27604;
@@ -181,7 +203,7 @@ int main(int argc, char** argv, char** envp)
     // Typed object, which we'll try here.
     childAMF = new AMF0("named", 5);
     childAMF->isMap = 1;
-    childAMF->properties.propMap = new std::map<AMF::Value, AMF::Property>();
+    childAMF->properties.propMap = new AMF::PropertyMap();
 
     key.len = 7;
     key.val = "number3";
@@ -306,6 +328,2135 @@ int main(int argc, char** argv, char** envp)
 
     // Do the rest :)
 
+    // Decode the same buffer into an arena.
+    Arena   arena(256); // small slabs so we exercise growing
+    AMF0    arenaAMF;
+
+    consumed = arenaAMF.decode(buf, totalSize, arena);
+
+    if(totalSize != consumed) {
+        std::cout << "Arena decode didn't consume the right amount of bytes!"
+                  << std::endl;
+        return (int) -1;
+    }
+
+    if((arenaAMF.properties.propList->at(3).type != AMF0::Types::OBJECT) ||
+       (arenaAMF.properties.propList->at(3).property.object->arena
+            != &arena)) {
+        std::cout << "Arena decode child OBJECT not in arena" << std::endl;
+        return (int) -1;
+    }
+
+    // Reset and decode again -- we should fit in the slabs we already have.
+    size_t arenaCapacity = arena.capacity();
+
+    arena.reset();
+    consumed = arenaAMF.decode(buf, totalSize, arena);
+
+    if((totalSize != consumed) || (arena.capacity() != arenaCapacity)) {
+        std::cout << "Arena grew on re-decode: " << arenaCapacity << " -> "
+                  << arena.capacity() << std::endl;
+        return (int) -1;
+    }
+
+    if(arenaAMF.properties.propList->at(0).property.number != 1337) {
+        std::cout << "Arena re-decode propList[0] not 1337" << std::endl;
+        return (int) -1;
+    }
+
+    // Lazy decode; nested objects shouldn't be loaded until we ask.
+    AMF0    lazyAMF;
+
+    consumed = lazyAMF.decode(buf, totalSize, AMF0::LAZY);
+
+    if(totalSize != consumed) {
+        std::cout << "Lazy decode didn't consume the right amount of bytes!"
+                  << std::endl;
+        return (int) -1;
+    }
+
+    AMF0* lazyChild =
+        (AMF0*)lazyAMF.properties.propList->at(3).property.object;
+
+    if(lazyChild->isLoaded()) {
+        std::cout << "Lazy decode loaded a child object" << std::endl;
+        return (int) -1;
+    }
+
+    lazyChild->load();
+    key.val = "grandchild";
+    key.len = 10;
+
+    auto lazyFound = lazyChild->properties.propMap->find(key);
+
+    if(!lazyChild->isLoaded() ||
+       (lazyFound == lazyChild->properties.propMap->end()) ||
+       (((AMF0*)lazyFound->second.property.object)->isLoaded())) {
+        std::cout << "Lazy child didn't load right" << std::endl;
+        return (int) -1;
+    }
+
+    // Re-encoding loads everything else, and should give us the same bytes.
+    char*   lazyBuf = (char*)malloc(totalSize);
+
+    if((lazyAMF.encodedSize() != totalSize) ||
+       (lazyAMF.encode(lazyBuf, totalSize) != totalSize) ||
+       memcmp(lazyBuf, buf, totalSize)) {
+        std::cout << "Lazy decode did not re-encode the same" << std::endl;
+        return (int) -1;
+    }
+
+    free(lazyBuf);
+
+    // Change the child, and its parent should get sized again; nothing
+    // remembers the old size, so there's no need to invalidate().
+    AMF::Property   extra;
+    std::vector<char>   lazyOut(2, 'x');
+
+    extra.type = AMF0::Types::NUMBER;
+    extra.property.number = 1;
+    key.val = "extra";
+    key.len = 5;
+
+    lazyChild->properties.propMap->insert(
+        std::pair<AMF::Value, AMF::Property>(key, extra)
+    );
+
+    if((lazyAMF.encodedSize() != totalSize + 16) ||
+       (lazyAMF.encode(lazyOut) != totalSize + 16) ||
+       (lazyOut.size() != totalSize + 18) || (lazyOut[1] != 'x') ||
+       (lazyOut[2] != AMF0::Types::NUMBER)) {
+        std::cout << "Invalidated size / vector encode is wrong" << std::endl;
+        return (int) -1;
+    }
+
+    // Walk it with the reader; nothing gets decoded.
+    AMF0Reader  reader(buf, totalSize);
+    const unsigned char expectTypes[] = {
+        AMF0::Types::NUMBER, AMF0::Types::BOOLEAN, AMF0::Types::STRING,
+        AMF0::Types::OBJECT, AMF0::Types::NILL, AMF0::Types::ECMA_ARRAY,
+        AMF0::Types::STRICT_ARRAY, AMF0::Types::DATE,
+        AMF0::Types::LONG_STRING, AMF0::Types::XML_DOC,
+        AMF0::Types::TYPED_OBJECT
+    };
+    uint32_t    readCount = 0;
+    double      readSum = 0;
+
+    while(reader.next()) {
+        if((readCount >= sizeof(expectTypes)) ||
+           (reader.type() != expectTypes[readCount])) {
+            std::cout << "Reader got type " << (int)reader.type()
+                      << " at " << readCount << std::endl;
+            return (int) -1;
+        }
+
+        if((reader.type() == AMF0::Types::OBJECT) ||
+           (reader.type() == AMF0::Types::STRICT_ARRAY)) {
+            reader.enterObject();
+
+            // Sum up the numbers, skipping the grandchild.
+            while(reader.next()) {
+                if(reader.type() == AMF0::Types::NUMBER) {
+                    readSum += reader.number();
+                }
+            }
+        }
+
+        readCount++;
+    }
+
+    if((readCount != sizeof(expectTypes)) || (reader.offset() != totalSize) ||
+       (readSum != 90210 + 27604 + 27540)) {
+        std::cout << "Reader walked " << readCount << " values, "
+                  << reader.offset() << " bytes, sum " << readSum
+                  << std::endl;
+        return (int) -1;
+    }
+
+    // leaveObject partway through, then carry on.
+    AMF0Reader  leaver(buf, totalSize);
+
+    for(int i = 0; i < 4; i++) {
+        leaver.next();
+    }
+
+    leaver.enterObject();
+    leaver.next();
+
+    if((leaver.depth() != 1) || (leaver.key().len != 4) ||
+       strncmp(leaver.key().val, "key1", 4) ||
+       strncmp(leaver.string().val, "moar", 4)) {
+        std::cout << "Reader didn't find key1 = moar" << std::endl;
+        return (int) -1;
+    }
+
+    leaver.leaveObject();
+
+    if(!leaver.next() || (leaver.type() != AMF0::Types::NILL) ||
+       leaver.depth()) {
+        std::cout << "Reader didn't get back to the top level" << std::endl;
+        return (int) -1;
+    }
+
+    // Errors can come back in a Result; the reader then stays at the
+    // end.
+    AMF0Reader  shortReader(buf, 12);
+    AMF::Result readResult;
+
+    while(shortReader.next(readResult)) {
+        if((shortReader.type() == AMF0::Types::OBJECT) &&
+           !shortReader.enterObject(readResult)) {
+            break;
+        }
+    }
+
+    if((readResult.status != AMF::NEED_MORE_DATA) ||
+       (readResult.bytes <= 12)) {
+        std::cout << "Reader Result is " << (int)readResult.status
+                  << " for " << readResult.bytes << " bytes" << std::endl;
+        return (int) -1;
+    }
+
+    readResult = AMF::Result();
+
+    if(shortReader.next(readResult) || readResult.status) {
+        std::cout << "Reader carried on after an error" << std::endl;
+        return (int) -1;
+    }
+
+    // A reference into a lazy object: { a: { b: 1 } }, then reference 0,
+    // which is the inner object.
+    const char refBytes[] = {
+        0x03, 0x00, 0x01, 'a', 0x03, 0x00, 0x01, 'b',
+        0x00, 0x3f, (char)0xf0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x09, 0x00, 0x00, 0x09, 0x07, 0x00, 0x00
+    };
+    AMF0    refAMF;
+
+    if(refAMF.decode(refBytes, sizeof(refBytes), AMF0::LAZY)
+            != sizeof(refBytes)) {
+        std::cout << "Lazy reference decode wrong size" << std::endl;
+        return (int) -1;
+    }
+
+    key.val = "a";
+    key.len = 1;
+
+    if((refAMF.properties.propList->at(1).type != AMF0::Types::OBJECT) ||
+       (refAMF.properties.propList->at(1).property.object !=
+            refAMF.properties.propList->at(0).property.object->properties
+                .propMap->find(key)->second.property.object)) {
+        std::cout << "Lazy reference resolved to the wrong thing"
+                  << std::endl;
+        return (int) -1;
+    }
+
+    // Clear it and decode again.  The same two nodes should be re-used,
+    // even though one of them was in the tree twice.
+    AMF*                refOuter = refAMF.properties.propList->at(0)
+                                                        .property.object;
+    AMF*                refInner = refAMF.properties.propList->at(1)
+                                                        .property.object;
+
+    refAMF.clear();
+
+    if(!refAMF.properties.propList->empty() ||
+       (refAMF.decode(refBytes, sizeof(refBytes)) != sizeof(refBytes)) ||
+       (refAMF.properties.propList->size() != 2)) {
+        std::cout << "Decode after clear is wrong" << std::endl;
+        return (int) -1;
+    }
+
+    AMF*    againOuter = refAMF.properties.propList->at(0).property.object;
+    AMF*    againInner = refAMF.properties.propList->at(1).property.object;
+
+    key.val = "a";
+    key.len = 1;
+
+    if((againOuter == againInner) ||
+       ((againOuter != refOuter) && (againOuter != refInner)) ||
+       ((againInner != refOuter) && (againInner != refInner)) ||
+       (againOuter->properties.propMap->find(key)->second.property.object
+            != againInner)) {
+        std::cout << "Decode after clear didn't re-use its nodes"
+                  << std::endl;
+        return (int) -1;
+    }
+
+    // Encode through the growable and callback writers, with tiny
+    // starting sizes so that they have to grow / call back a lot.
+    GrowableWriter      growable(16);
+    std::vector<char>   called;
+    CallbackWriter      callback([&called](const char* data, uint32_t size) {
+                            called.insert(called.end(), data, data + size);
+                        }, 32);
+
+    if((sourceAMF.encode(growable) != totalSize) ||
+       (growable.size() != totalSize) ||
+       memcmp(growable.data(), buf, totalSize)) {
+        std::cout << "GrowableWriter encode is wrong" << std::endl;
+        return (int) -1;
+    }
+
+    sourceAMF.encode(callback);
+    callback.finish();
+
+    if((called.size() != totalSize) || memcmp(called.data(), buf, totalSize)) {
+        std::cout << "CallbackWriter encode is wrong" << std::endl;
+        return (int) -1;
+    }
+
+    try {
+        char        tooSmallBuf[16];
+        FixedWriter tooSmall(tooSmallBuf, sizeof(tooSmallBuf));
+
+        sourceAMF.encode(tooSmall);
+        std::cout << "FixedWriter didn't overflow" << std::endl;
+        return (int) -1;
+    } catch(std::overflow_error& e) {
+    }
+
+    // Gather into iovecs.  Anything over 3 bytes is referenced, so
+    // "long" should come straight from our property; small blocks make
+    // it go through several.  Do it twice to re-use the blocks.
+    IovecWriter     gathered(3, 8);
+
+    for(int pass = 0; pass < 2; pass++) {
+        std::vector<char>   joined;
+        bool                referenced = false;
+
+        gathered.clear();
+        sourceAMF.encode(gathered);
+        gathered.finish();
+
+        for(int i = 0; i < gathered.iovcnt(); i++) {
+            const struct iovec& segment = gathered.iov()[i];
+
+            joined.insert(joined.end(), (char*)segment.iov_base,
+                          (char*)segment.iov_base + segment.iov_len);
+
+            if((const void*)segment.iov_base ==
+               sourceAMF.properties.propList->at(8)
+                                            .property.value.val) {
+                referenced = true;
+            }
+        }
+
+        if((gathered.size() != totalSize) || (joined.size() != totalSize) ||
+           memcmp(joined.data(), buf, totalSize) || !referenced) {
+            std::cout << "IovecWriter encode is wrong" << std::endl;
+            return (int) -1;
+        }
+    }
+
+    // Chunk it as we encode.  Chunk stream 3 gets one byte basic
+    // headers; chunk stream 100 gets two, and a big timestamp gets an
+    // extended timestamp on every chunk.
+    struct {
+        uint32_t    chunkStreamId;
+        uint32_t    timestamp;
+        uint32_t    basicSize;
+        uint32_t    extraSize;
+    } chunkTests[] = { { 3, 1000, 1, 0 }, { 100, 0x1000000, 2, 4 } };
+
+    for(auto& chunkTest : chunkTests) {
+        GrowableWriter  chunked;
+        ChunkWriter     chunker(chunked, 16, chunkTest.chunkStreamId);
+        const char*     c;
+        std::vector<char>   payload;
+
+        chunker.write(sourceAMF, 20, 1, chunkTest.timestamp);
+        c = chunked.data();
+
+        if(((chunkTest.basicSize == 1) && (c[0] != 3)) ||
+           ((chunkTest.basicSize == 2) && (c[0] || (c[1] != 100 - 64))) ||
+           ((AMF::decodeInt32(&c[chunkTest.basicSize + 2]) & 0xFFFFFF) !=
+                totalSize) ||
+           (c[chunkTest.basicSize + 6] != 20) ||
+           (c[chunkTest.basicSize + 7] != 1)) {
+            std::cout << "Chunk type 0 header is wrong" << std::endl;
+            return (int) -1;
+        }
+
+        c += chunkTest.basicSize + 11 + chunkTest.extraSize;
+
+        while(payload.size() < totalSize) {
+            uint32_t n = MIN(16, totalSize - payload.size());
+
+            if(payload.size()) {
+                if((chunkTest.basicSize == 1) && (c[0] != (char)0xc3)) {
+                    std::cout << "Chunk type 3 header is wrong" << std::endl;
+                    return (int) -1;
+                }
+
+                c += chunkTest.basicSize + chunkTest.extraSize;
+            }
+
+            payload.insert(payload.end(), c, c + n);
+            c += n;
+        }
+
+        if((c != chunked.data() + chunked.size()) ||
+           memcmp(payload.data(), buf, totalSize)) {
+            std::cout << "Chunked payload is wrong" << std::endl;
+            return (int) -1;
+        }
+    }
+
+    // An object that shows up twice, the second time deeper down, is
+    // sent as a reference the second time.
+    AMF0                shareAMF;
+    AMF0*               shared = new AMF0();
+    AMF0*               holder = new AMF0();
+    AMF::Property       shareProp;
+    std::vector<char>   shareOut;
+
+    shareAMF.isMap = false;
+    shareAMF.properties.propList = new AMF::PropertyList();
+    shared->isMap = holder->isMap = true;
+    shared->properties.propMap = new AMF::PropertyMap();
+    holder->properties.propMap = new AMF::PropertyMap();
+
+    shareProp.type = AMF0::Types::OBJECT;
+    shareProp.property.object = shared;
+    shareAMF.properties.propList->push_back(shareProp);
+
+    key.val = "x";
+    key.len = 1;
+    holder->properties.propMap->insert(
+        std::pair<AMF::Value, AMF::Property>(key, shareProp)
+    );
+
+    shareProp.property.object = holder;
+    shareAMF.properties.propList->push_back(shareProp);
+
+    // { } { x: ref 0 }
+    const char shareBytes[] = {
+        0x03, 0x00, 0x00, 0x09, 0x03, 0x00, 0x01, 'x', 0x07, 0x00, 0x00,
+        0x00, 0x00, 0x09
+    };
+
+    if((shareAMF.encode(shareOut) != sizeof(shareBytes)) ||
+       memcmp(shareOut.data(), shareBytes, sizeof(shareBytes))) {
+        std::cout << "Nested reference didn't encode right" << std::endl;
+        return (int) -1;
+    }
+
+    // Only one of them gets to delete it.
+    holder->properties.propMap->clear();
+
+    // Decoding that and encoding it again copies the first object, and
+    // has to keep the reference in the second one right.
+    AMF0                shareDecoded;
+    std::vector<char>   shareAgain;
+
+    shareDecoded.decode(shareBytes, sizeof(shareBytes));
+    shareDecoded.encode(shareAgain);
+
+    if((shareAgain.size() != sizeof(shareBytes)) ||
+       memcmp(shareAgain.data(), shareBytes, sizeof(shareBytes))) {
+        std::cout << "Decoded reference didn't encode right" << std::endl;
+        return (int) -1;
+    }
+
+    // encodedSize counts the reference as the whole object again, so
+    // chunking has to count it for real.
+    GrowableWriter  shareChunked;
+    ChunkWriter     shareChunker(shareChunked, 128, 3);
+
+    if((shareChunker.write(shareDecoded, 20, 1, 0) != sizeof(shareBytes)) ||
+       (shareChunked.size() != 12 + sizeof(shareBytes)) ||
+       ((AMF::decodeInt32(&shareChunked.data()[3]) & 0xFFFFFF) !=
+            sizeof(shareBytes)) ||
+       memcmp(&shareChunked.data()[12], shareBytes, sizeof(shareBytes))) {
+        std::cout << "Chunked reference got the wrong length" << std::endl;
+        return (int) -1;
+    }
+
+    // With KEEP_SOURCE, unchanged objects are copied as they were
+    // decoded, so this ECMA array keeps its (wrong) count of 0.  The
+    // object we change gets encoded again.
+    const char editBytes[] = {
+        0x08, 0, 0, 0, 0, 0, 1, 'a', 0x05, 0, 0, 9,
+        0x03, 0, 1, 'b', 0x02, 0, 1, 'x', 0, 0, 9
+    };
+    const char editedBytes[] = {
+        0x08, 0, 0, 0, 0, 0, 1, 'a', 0x05, 0, 0, 9,
+        0x03, 0, 1, 'b', 0x02, 0, 2, 'y', 'z', 0, 0, 9
+    };
+    AMF0                edit;
+    std::vector<char>   editOut;
+
+    edit.decode(editBytes, sizeof(editBytes), AMF0::KEEP_SOURCE);
+
+    AMF*    editObject = edit.properties.propList->at(1).property.object;
+
+    key.val = "b";
+    key.len = 1;
+    editObject->properties.propMap->find(key)->second.property.value.val =
+                                                                    "yz";
+    editObject->properties.propMap->find(key)->second.property.value.len = 2;
+    editObject->invalidate();
+
+    if((edit.encodedSize() != sizeof(editedBytes)) ||
+       (edit.encode(editOut) != sizeof(editedBytes)) ||
+       memcmp(editOut.data(), editedBytes, sizeof(editedBytes))) {
+        std::cout << "Edited message didn't encode right" << std::endl;
+        return (int) -1;
+    }
+
+    // Without it, a change shows up even if nobody calls invalidate().
+    {
+        const char      twoNumbers[] = {
+            0x00, 0x3F, (char)0xF0, 0, 0, 0, 0, 0, 0,          // 1.0
+            0x00, 0x40, 0, 0, 0, 0, 0, 0, 0                     // 2.0
+        };
+        const char      three[] = { 0x00, 0x40, 0x08, 0, 0, 0, 0, 0, 0 };
+        AMF0            changed;
+        AMF0            kept;
+
+        changed.decode(twoNumbers, sizeof(twoNumbers));
+        changed.properties.propList->at(0).property.number = 42;
+        editOut.clear();
+        changed.encode(editOut);
+
+        if(AMF::decodeNumber(&editOut[1]) != 42) {
+            std::cout << "Encode sent what we decoded, not what we have"
+                      << std::endl;
+            return (int) -1;
+        }
+
+        // Nor one made after it has been sized.
+        AMF::Property   third;
+
+        third.type = AMF0::Types::NUMBER;
+        third.property.number = 3;
+        changed.properties.propList->push_back(third);
+        editOut.clear();
+
+        if((changed.encode(editOut) != sizeof(twoNumbers) + 9) ||
+           (editOut.size() != sizeof(twoNumbers) + 9) ||
+           (AMF::decodeNumber(&editOut[19]) != 3)) {
+            std::cout << "Encode sent the size we had before" << std::endl;
+            return (int) -1;
+        }
+
+        // Decoding again appends, and encode has to send it all.
+        for(uint32_t flags : { 0u, (uint32_t)AMF0::KEEP_SOURCE }) {
+            AMF0 appended;
+
+            appended.decode(twoNumbers, sizeof(twoNumbers), flags);
+            appended.decode(three, sizeof(three), flags);
+            editOut.clear();
+
+            if((appended.properties.propList->size() != 3) ||
+               (appended.encodedSize() != sizeof(twoNumbers) + 9) ||
+               (appended.encode(editOut) != sizeof(twoNumbers) + 9) ||
+               (AMF::decodeNumber(&editOut[19]) != 3)) {
+                std::cout << "Appending decode didn't encode it all"
+                          << std::endl;
+                return (int) -1;
+            }
+        }
+
+        // A decode that fails mustn't leave the last one's source size
+        // behind with its own (smaller) buffer.
+        std::vector<char>   cut(twoNumbers, twoNumbers + 5);
+
+        kept.decode(twoNumbers, sizeof(twoNumbers), AMF0::KEEP_SOURCE);
+
+        try {
+            kept.decode(cut.data(), cut.size(), AMF0::KEEP_SOURCE);
+            std::cout << "Cut short decode didn't throw" << std::endl;
+            return (int) -1;
+        } catch(std::underflow_error& e) {
+        }
+
+        editOut.clear();
+
+        if((kept.encode(editOut) != sizeof(twoNumbers)) ||
+           memcmp(editOut.data(), twoNumbers, sizeof(twoNumbers))) {
+            std::cout << "Failed decode left a source" << std::endl;
+            return (int) -1;
+        }
+    }
+
+    // Patch the encoded message: the first NUMBER in place, a string in
+    // the first object to something longer, and a STRICT_ARRAY element.
+    std::vector<char>   patched(buf, buf + totalSize);
+    AMF::Property       patchValue;
+    AMF0                patchedAMF;
+
+    patchValue.type = AMF0::Types::NUMBER;
+    patchValue.property.number = 42;
+    AMF0::patch(patched, { 0 }, patchValue);
+
+    patchValue.property.number = 7;
+    AMF0::patch(patched, { 6, 1 }, patchValue);
+
+    patchValue.type = AMF0::Types::STRING;
+    patchValue.property.value.val = "a longer string";
+    patchValue.property.value.len = 15;
+    AMF0::patch(patched, { 3, "key1" }, patchValue);
+
+    patchedAMF.decode(patched.data(), patched.size());
+
+    key.val = "key1";
+    key.len = 4;
+
+    AMF::PropertyList*  patchedList = patchedAMF.properties.propList;
+    const AMF::Value&   patchedString = patchedList->at(3).property.object
+                            ->properties.propMap->find(key)->second
+                            .property.value;
+
+    if((patched.size() != totalSize + 11) ||
+       (patchedList->at(0).property.number != 42) ||
+       (patchedList->at(6).property.object->properties.propList->at(1)
+            .property.number != 7) ||
+       (patchedString.len != 15) ||
+       memcmp(patchedString.val, "a longer string", 15) ||
+       (patchedList->at(8).property.value.len != 4) ||
+       memcmp(patchedList->at(8).property.value.val, "long", 4)) {
+        std::cout << "Patched message is wrong" << std::endl;
+        return (int) -1;
+    }
+
+    // And back again, in a buffer this time; it should match the
+    // original but for the first NUMBER.
+    patchValue.type = AMF0::Types::NUMBER;
+    patchValue.property.number = 27540;
+    AMF0::patch(patched, { 6, 1 }, patchValue);
+
+    patchValue.type = AMF0::Types::STRING;
+    patchValue.property.value.val = "moar";
+    patchValue.property.value.len = 4;
+
+    if((AMF0::patch(patched.data(), patched.size(), patched.size(),
+                    { 3, "key1" }, patchValue) != totalSize) ||
+       memcmp(patched.data() + 9, buf + 9, totalSize - 9)) {
+        std::cout << "Patching back is wrong" << std::endl;
+        return (int) -1;
+    }
+
+    try {
+        AMF0::patch(patched, { 3, "nope" }, patchValue);
+        std::cout << "Patched something that isn't there" << std::endl;
+        return (int) -1;
+    } catch(std::out_of_range& e) {
+    }
+
+    try {
+        AMF0::patch(patched, { 3 }, patchValue);
+        std::cout << "Patched over an object" << std::endl;
+        return (int) -1;
+    } catch(std::runtime_error& e) {
+    }
+
+    // Bind the first object straight into a struct.
+    BoundChild  bound;
+    uint32_t    boundAt = 0;
+
+    for(int i = 0; i < 3; i++) {
+        boundAt += AMF0::skipValue(&buf[boundAt], totalSize - boundAt);
+    }
+
+    if((AMF0Binding::decode(&buf[boundAt], totalSize - boundAt,
+                            boundFields, bound) !=
+        AMF0::skipValue(&buf[boundAt], totalSize - boundAt)) ||
+       (bound.key1.len != 4) || memcmp(bound.key1.val, "moar", 4) ||
+       (bound.key2.len != 4) || memcmp(bound.key2.val, "data", 4) ||
+       (bound.number != 90210) || bound.missing) {
+        std::cout << "Binding decoded the wrong thing" << std::endl;
+        return (int) -1;
+    }
+
+    try {
+        AMF0Binding::decode(&buf[boundAt], totalSize - boundAt,
+                            requiredFields, bound);
+        std::cout << "Binding didn't notice a missing field" << std::endl;
+        return (int) -1;
+    } catch(std::runtime_error& e) {
+    }
+
+    // And the same without exceptions.
+    AMF::Result bindResult = AMF0Binding::tryDecode(&buf[boundAt],
+                                                    totalSize - boundAt,
+                                                    boundFields, bound);
+
+    if(bindResult.status ||
+       (bindResult.bytes != AMF0::skipValue(&buf[boundAt],
+                                            totalSize - boundAt))) {
+        std::cout << "Binding tryDecode got " << (int)bindResult.status
+                  << std::endl;
+        return (int) -1;
+    }
+
+    if((AMF0Binding::tryDecode(&buf[boundAt], totalSize - boundAt,
+                               requiredFields, bound).status !=
+        AMF::BAD_DATA) ||
+       (AMF0Binding::tryDecode(&buf[boundAt], 10, boundFields,
+                               bound).status != AMF::NEED_MORE_DATA)) {
+        std::cout << "Binding tryDecode missed an error" << std::endl;
+        return (int) -1;
+    }
+
+    // Measure it, all at once and a value at a time.
+    uint32_t    skipped = 0;
+    uint32_t    skipCount = 0;
+    uint32_t    skipValues = 0;
+
+    while(skipped < totalSize) {
+        skipped += AMF0::skipValue(&buf[skipped], totalSize - skipped,
+                                   skipCount);
+        skipValues++;
+    }
+
+    if((AMF0::measure(buf, totalSize) != totalSize) ||
+       (skipped != totalSize) || (skipValues != sizeof(expectTypes)) ||
+       (AMF0::measure(refBytes, sizeof(refBytes)) != sizeof(refBytes))) {
+        std::cout << "measure / skipValue got the wrong size" << std::endl;
+        return (int) -1;
+    }
+
+    // A reference to an object that comes later is no good, nor is one
+    // to the object we are still in.
+    const char badRefBytes[] = {
+        0x07, 0x00, 0x00, 0x03, 0x00, 0x01, 'a', 0x07, 0x00, 0x00,
+        0x00, 0x00, 0x09
+    };
+
+    try {
+        AMF0::measure(badRefBytes, sizeof(badRefBytes));
+        std::cout << "Bad reference measured fine" << std::endl;
+        return (int) -1;
+    } catch(std::out_of_range& e) {
+    }
+
+    try {
+        AMF0::skipValue(&badRefBytes[3], sizeof(badRefBytes) - 3);
+        std::cout << "Self reference skipped fine" << std::endl;
+        return (int) -1;
+    } catch(std::out_of_range& e) {
+    }
+
+    // Objects nested 'depth' deep: { a: { a: ... } }.
+    auto nested = [](uint32_t depth) {
+        std::vector<char> out;
+
+        for(uint32_t i = 0; i < depth; i++) {
+            if(i) {
+                out.insert(out.end(), { 0x00, 0x01, 'a' });
+            }
+
+            out.push_back(AMF0::Types::OBJECT);
+        }
+
+        for(uint32_t i = 0; i < depth; i++) {
+            out.insert(out.end(), { 0x00, 0x00, 0x09 });
+        }
+
+        return out;
+    };
+
+    std::vector<char>   deepest = nested(AMF0::MAX_DEPTH);
+    std::vector<char>   tooDeep = nested(AMF0::MAX_DEPTH + 1);
+    std::vector<char>   hostile = nested(100000);
+    AMF0                deepAMF;
+
+    if((deepAMF.decode(deepest.data(), deepest.size()) != deepest.size()) ||
+       (AMF0::measure(deepest.data(), deepest.size()) != deepest.size())) {
+        std::cout << "Couldn't decode MAX_DEPTH objects" << std::endl;
+        return (int) -1;
+    }
+
+    for(std::vector<char>* deep : { &tooDeep, &hostile }) {
+        for(uint32_t flags : { 0u, (uint32_t)AMF0::LAZY }) {
+            try {
+                AMF0 tooDeepAMF;
+
+                tooDeepAMF.decode(deep->data(), deep->size(), flags);
+                std::cout << "Decoded objects nested too deep" << std::endl;
+                return (int) -1;
+            } catch(std::runtime_error& e) {
+            }
+        }
+
+        try {
+            AMF0::measure(deep->data(), deep->size());
+            std::cout << "Measured objects nested too deep" << std::endl;
+            return (int) -1;
+        } catch(std::runtime_error& e) {
+        }
+
+        // And through the incremental decoder, in two pieces.
+        struct iovec    deepPieces[2];
+        AMF0            deepPieceAMF;
+
+        deepPieces[0].iov_base = deep->data();
+        deepPieces[0].iov_len = deep->size() / 2;
+        deepPieces[1].iov_base = deep->data() + deep->size() / 2;
+        deepPieces[1].iov_len = deep->size() - deep->size() / 2;
+
+        try {
+            deepPieceAMF.decode(deepPieces, 2);
+            std::cout << "Decoded pieces nested too deep" << std::endl;
+            return (int) -1;
+        } catch(std::runtime_error& e) {
+        }
+    }
+
+    // Each limit on its own.  nested(5) is 5 values, 5 deep, 32 bytes.
+    std::vector<char>   five = nested(5);
+    AMF0::Limits        limits;
+
+    for(int which = 0; which < 3; which++) {
+        AMF0    limitedAMF;
+
+        limits = AMF0::Limits();
+
+        if(limitedAMF.decode(five.data(), five.size(), limits) !=
+           five.size()) {
+            std::cout << "Decode with Limits is wrong" << std::endl;
+            return (int) -1;
+        }
+
+        limitedAMF.clear();
+
+        switch(which) {
+            case 0:
+                limits.maxDepth = 4;
+                break;
+            case 1:
+                limits.maxNodes = 4;
+                break;
+            default:
+                limits.maxBytes = 31;
+                break;
+        }
+
+        try {
+            limitedAMF.decode(five.data(), five.size(), limits);
+            std::cout << "Decode went over limit " << which << std::endl;
+            return (int) -1;
+        } catch(std::runtime_error& e) {
+        }
+    }
+
+    // A STRICT_ARRAY that says it has 2 billion elements, in 6 bytes.
+    const char hugeCountBytes[] = {
+        0x0a, 0x7f, (char)0xff, (char)0xff, (char)0xff, 0x05
+    };
+
+    try {
+        AMF0 hugeCountAMF;
+
+        hugeCountAMF.decode(hugeCountBytes, sizeof(hugeCountBytes));
+        std::cout << "Decoded an impossible STRICT_ARRAY count" << std::endl;
+        return (int) -1;
+    } catch(std::underflow_error& e) {
+    }
+
+    try {
+        AMF0::measure(hugeCountBytes, sizeof(hugeCountBytes));
+        std::cout << "Measured an impossible STRICT_ARRAY count" << std::endl;
+        return (int) -1;
+    } catch(std::underflow_error& e) {
+    }
+
+    // tryDecode says what decode would have thrown, for every way our
+    // message can be cut short; and what it needs is never more than
+    // the whole message.
+    for(uint32_t flags : { 0u, (uint32_t)AMF0::LAZY }) {
+        for(uint32_t i = 0; i <= totalSize; i++) {
+            AMF0        tryAMF;
+            AMF0        throwAMF;
+            AMF::Result result = tryAMF.tryDecode(buf, i, flags);
+            bool        underflow = false;
+            uint32_t    res = 0;
+
+            try {
+                res = throwAMF.decode(buf, i, flags);
+            } catch(std::underflow_error& e) {
+                underflow = true;
+            }
+
+            if(underflow ? ((result.status != AMF::NEED_MORE_DATA) ||
+                            (result.bytes <= i) ||
+                            (result.bytes > totalSize)) :
+                           ((result.status != AMF::OK) ||
+                            (result.bytes != res))) {
+                std::cout << "tryDecode doesn't match decode at " << i
+                          << std::endl;
+                return (int) -1;
+            }
+        }
+    }
+
+    {
+        AMF0        tryAMF;
+        AMF::Result result = tryAMF.tryDecode(buf, totalSize);
+        const char  badReference[] = { 0x07, 0x00, 0x05 };
+
+        if((result.status != AMF::OK) || (result.bytes != totalSize) ||
+           (tryAMF.encodedSize() != totalSize)) {
+            std::cout << "tryDecode didn't decode our message" << std::endl;
+            return (int) -1;
+        }
+
+        tryAMF.clear();
+
+        if((tryAMF.tryDecode(tooDeep.data(), tooDeep.size()).status !=
+            AMF::BAD_DATA) ||
+           (tryAMF.tryDecode(five.data(), five.size(), limits).status !=
+            AMF::BAD_DATA) ||
+           (tryAMF.tryDecode(hugeCountBytes, sizeof(hugeCountBytes)).status
+            != AMF::NEED_MORE_DATA) ||
+           (tryAMF.tryDecode(badReference, sizeof(badReference)).status !=
+            AMF::BAD_REFERENCE)) {
+            std::cout << "tryDecode got an error wrong" << std::endl;
+            return (int) -1;
+        }
+
+        try {
+            AMF::raise(tryAMF.tryDecode(badReference, sizeof(badReference)));
+            std::cout << "raise didn't throw" << std::endl;
+            return (int) -1;
+        } catch(std::out_of_range& e) {
+        }
+    }
+
+    // tryEncode only writes if it all fits.
+    {
+        char*       tryBuf = (char*)malloc(totalSize);
+        AMF::Result result;
+
+        memset(tryBuf, 0, totalSize);
+        result = sourceAMF.tryEncode(tryBuf, totalSize - 1);
+
+        if((result.status != AMF::NEED_MORE_ROOM) ||
+           (result.bytes != totalSize) || tryBuf[0]) {
+            std::cout << "tryEncode overflowed wrong" << std::endl;
+            return (int) -1;
+        }
+
+        result = sourceAMF.tryEncode(tryBuf, totalSize);
+
+        if((result.status != AMF::OK) || (result.bytes != totalSize) ||
+           memcmp(tryBuf, buf, totalSize)) {
+            std::cout << "tryEncode didn't encode our message" << std::endl;
+            return (int) -1;
+        }
+
+        AMF0            badTypeAMF;
+        AMF::Property   badType;
+
+        badTypeAMF.isMap = false;
+        badTypeAMF.properties.propList = new AMF::PropertyList();
+        badType.type = AMF0::Types::MOVIECLIP;
+        badTypeAMF.properties.propList->push_back(badType);
+
+        if(badTypeAMF.tryEncode(tryBuf, totalSize).status != AMF::BAD_DATA) {
+            std::cout << "tryEncode encoded a MOVIECLIP" << std::endl;
+            return (int) -1;
+        }
+
+        // encodedSize is over for a reference, but it fits anyway.
+        memset(tryBuf, 0, totalSize);
+        result = shareDecoded.tryEncode(tryBuf, sizeof(shareBytes) - 1);
+
+        if((result.status != AMF::NEED_MORE_ROOM) ||
+           (result.bytes != sizeof(shareBytes)) || tryBuf[0]) {
+            std::cout << "tryEncode overflowed a reference wrong"
+                      << std::endl;
+            return (int) -1;
+        }
+
+        result = shareDecoded.tryEncode(tryBuf, sizeof(shareBytes));
+
+        if((shareDecoded.encodedSize() <= sizeof(shareBytes)) ||
+           (result.status != AMF::OK) ||
+           (result.bytes != sizeof(shareBytes)) ||
+           memcmp(tryBuf, shareBytes, sizeof(shareBytes))) {
+            std::cout << "tryEncode didn't fit a reference" << std::endl;
+            return (int) -1;
+        }
+
+        // What tryEncode encodes into: it stops writing when it runs
+        // out, but keeps counting.
+        CountingWriter  bounded(tryBuf, 10);
+        CountingWriter  roomy(tryBuf, totalSize);
+
+        sourceAMF.encode(bounded);
+        sourceAMF.encode(roomy);
+
+        if(!bounded.overflowed() || (bounded.size() != totalSize) ||
+           roomy.overflowed() || (roomy.size() != totalSize) ||
+           memcmp(tryBuf, buf, totalSize)) {
+            std::cout << "CountingWriter counted wrong" << std::endl;
+            return (int) -1;
+        }
+
+        free(tryBuf);
+    }
+
+    // AMF3, by hand.  Every type, and a reference of each kind.  The
+    // string table ends up "hi", "Pt", "x", "y", "self", "ab", "k".
+    const unsigned char amf3Bytes[] = {
+        0x04, 0xFF, 0xFF, 0xFF, 0xFF,               // INTEGER -1
+        0x04, 0x82, 0x2C,                           // INTEGER 300
+        0x05, 0x3F, 0xF8, 0, 0, 0, 0, 0, 0,         // DOUBLE 1.5
+        0x06, 0x05, 'h', 'i',                       // STRING "hi"
+        0x06, 0x00,                                 // STRING ref "hi"
+        0x03, 0x02, 0x01, 0x00,                     // TRUE FALSE NILL UNDEF
+        0x0A, 0x2B, 0x05, 'P', 't',                 // OBJECT 0: Pt, dynamic,
+        0x03, 'x', 0x03, 'y',                       //   sealed x, y
+        0x04, 0x01, 0x06, 0x00,                     //   x: 1, y: "hi"
+        0x09, 's', 'e', 'l', 'f', 0x0A, 0x00,       //   self: object 0
+        0x01,
+        0x0A, 0x01,                                 // OBJECT 1: traits 0
+        0x04, 0x02, 0x06, 0x05, 'a', 'b', 0x01,     //   x: 2, y: "ab"
+        0x09, 0x05, 0x01, 0x04, 0x01, 0x06, 0x00,   // ARRAY 2: [1, "hi"]
+        0x09, 0x03, 0x03, 'k', 0x03, 0x01, 0x01,    // ARRAY 3: k: TRUE, NILL
+        0x08, 0x01, 0x40, 0x8F, 0x40, 0, 0, 0, 0, 0,// DATE 4: 1000
+        0x08, 0x08,                                 // DATE ref 4
+        0x0C, 0x07, 0x01, 0x02, 0x03,               // BYTE_ARRAY 5
+        0x0B, 0x09, '<', 'a', '/', '>',             // XML 6
+        0x0D, 0x05, 0x00, 0xFF, 0xFF, 0xFF, 0xFE,   // VECTOR_INT 7: -2, 7
+        0x00, 0x00, 0x00, 0x07,
+        0x0E, 0x03, 0x00, 0xFF, 0xFF, 0xFF, 0xFF,   // VECTOR_UINT 8
+        0x0F, 0x03, 0x00,                           // VECTOR_DOUBLE 9: 1.5
+        0x3F, 0xF8, 0, 0, 0, 0, 0, 0,
+        0x10, 0x03, 0x00, 0x02, 0x0A, 0x00,         // VECTOR_OBJECT 10
+        0x11, 0x03, 0x00, 0x06, 0x0C, 0x04, 0x05,   // DICTIONARY 11: k, 5
+        0x09, 0x04,                                 // ARRAY ref 2
+        0x07, 0x01                                  // XML_DOC 12: ""
+    };
+    const char*     amf3Buf = (const char*)amf3Bytes;
+    uint32_t        amf3Size = sizeof(amf3Bytes);
+
+    {
+        AMF3                amf3;
+        AMF::PropertyList*  values;
+        AMF::PropertyList*  list;
+        AMF::PropertyMap*   map;
+        AMF3*               point;
+        AMF::Value          selfKey = { "self", 4 };
+        AMF::Value          xKey = { "x", 1 };
+        AMF::Value          yKey = { "y", 1 };
+        AMF::Value          kKey = { "k", 1 };
+        AMF::Value          zeroKey = { "0", 1 };
+
+        if(amf3.decode(amf3Buf, amf3Size) != amf3Size) {
+            std::cout << "AMF3 didn't consume its message" << std::endl;
+            return (int) -1;
+        }
+
+        values = amf3.properties.propList;
+
+        if((values->size() != 24) ||
+           ((*values)[0].property.number != -1) ||
+           ((*values)[1].property.number != 300) ||
+           ((*values)[2].property.number != 1.5) ||
+           ((*values)[3].property.value.val != &amf3Buf[19]) ||
+           ((*values)[4].property.value.val != &amf3Buf[19]) ||
+           ((*values)[5].type != AMF3::Types::TRUE) ||
+           ((*values)[6].property.number != 0) ||
+           ((*values)[8].type != AMF3::Types::UNDEFINED)) {
+            std::cout << "AMF3 decoded its scalars wrong" << std::endl;
+            return (int) -1;
+        }
+
+        point = (AMF3*)(*values)[9].property.object;
+        map = point->properties.propMap;
+
+        if(((*values)[9].type != AMF3::Types::OBJECT) || !point->isMap ||
+           (point->name.len != 2) || memcmp(point->name.val, "Pt", 2) ||
+           (map->size() != 3) ||
+           (map->find(xKey)->second.property.number != 1) ||
+           (map->find(yKey)->second.property.value.len != 2) ||
+           (map->find(selfKey)->second.property.object != point)) {
+            std::cout << "AMF3 decoded an OBJECT wrong" << std::endl;
+            return (int) -1;
+        }
+
+        map = (*values)[10].property.object->properties.propMap;
+
+        if(((*values)[10].property.object->name.val != point->name.val) ||
+           (map->size() != 2) ||
+           (map->find(xKey)->second.property.number != 2) ||
+           memcmp(map->find(yKey)->second.property.value.val, "ab", 2)) {
+            std::cout << "AMF3 decoded a trait reference wrong"
+                      << std::endl;
+            return (int) -1;
+        }
+
+        list = (*values)[11].property.object->properties.propList;
+        map = (*values)[12].property.object->properties.propMap;
+
+        if((*values)[11].property.object->isMap || (list->size() != 2) ||
+           ((*list)[1].property.value.len != 2) ||
+           !(*values)[12].property.object->isMap || (map->size() != 2) ||
+           (map->find(kKey)->second.type != AMF3::Types::TRUE) ||
+           (map->find(zeroKey)->second.type != AMF3::Types::NILL) ||
+           ((*values)[22].property.object !=
+            (*values)[11].property.object)) {
+            std::cout << "AMF3 decoded an ARRAY wrong" << std::endl;
+            return (int) -1;
+        }
+
+        if(((*values)[13].property.number != 1000) ||
+           ((*values)[14].type != AMF3::Types::DATE) ||
+           ((*values)[14].property.number != 1000) ||
+           ((*values)[15].property.value.len != 3) ||
+           memcmp((*values)[15].property.value.val, "\x01\x02\x03", 3) ||
+           ((*values)[16].property.value.len != 4) ||
+           ((*values)[23].type != AMF3::Types::XML_DOC) ||
+           ((*values)[23].property.value.len != 0)) {
+            std::cout << "AMF3 decoded a DATE, XML or BYTE_ARRAY wrong"
+                      << std::endl;
+            return (int) -1;
+        }
+
+        if(((*(*values)[17].property.object->properties.propList)[0]
+            .property.number != -2) ||
+           ((*(*values)[17].property.object->properties.propList)[1]
+            .property.number != 7) ||
+           ((*(*values)[18].property.object->properties.propList)[0]
+            .property.number != 4294967295.0) ||
+           ((*(*values)[19].property.object->properties.propList)[0]
+            .type != AMF3::Types::DOUBLE)) {
+            std::cout << "AMF3 decoded a number VECTOR wrong" << std::endl;
+            return (int) -1;
+        }
+
+        list = (*values)[20].property.object->properties.propList;
+
+        if(((*values)[20].property.object->name.val != point->name.val) ||
+           (list->size() != 1) || ((*list)[0].property.object != point)) {
+            std::cout << "AMF3 decoded a VECTOR_OBJECT wrong" << std::endl;
+            return (int) -1;
+        }
+
+        list = (*values)[21].property.object->properties.propList;
+
+        if((list->size() != 2) || ((*list)[0].property.value.len != 1) ||
+           ((*list)[1].property.number != 5)) {
+            std::cout << "AMF3 decoded a DICTIONARY wrong" << std::endl;
+            return (int) -1;
+        }
+
+        // We can't encode AMF3 yet, but we can copy it out.
+        std::vector<char>   copied(amf3Size);
+
+        if((amf3.encode(copied.data(), amf3Size) != amf3Size) ||
+           memcmp(copied.data(), amf3Buf, amf3Size)) {
+            std::cout << "AMF3 didn't copy out what it decoded" << std::endl;
+            return (int) -1;
+        }
+    }
+
+    // The same into an arena, which is where everything should be.
+    {
+        Arena   amf3Arena(256);
+        AMF3    amf3;
+
+        if((amf3.decode(amf3Buf, amf3Size, amf3Arena) != amf3Size) ||
+           (amf3.properties.propList->size() != 24) ||
+           ((*amf3.properties.propList)[12].property.object->arena !=
+            &amf3Arena)) {
+            std::cout << "AMF3 arena decode went wrong" << std::endl;
+            return (int) -1;
+        }
+    }
+
+    // Cut short anywhere, we want more; unless it's between values.
+    for(uint32_t i = 0; i < amf3Size; i++) {
+        AMF3        amf3;
+        AMF::Result result = amf3.tryDecode(amf3Buf, i);
+
+        if((result.status == AMF::OK) ? (result.bytes != i) :
+           ((result.status != AMF::NEED_MORE_DATA) ||
+            (result.bytes <= i) || (result.bytes > amf3Size))) {
+            std::cout << "AMF3 tryDecode got cut short wrong at " << i
+                      << std::endl;
+            return (int) -1;
+        }
+    }
+
+    {
+        AMF3                amf3;
+        std::vector<char>   amf3Deep;
+        const char          badString[] = { 0x06, 0x02 };
+        const char          badObject[] = { 0x0A, 0x02 };
+        const char          badTraits[] = { 0x0A, 0x05 };
+        const char          externalizable[] = { 0x0A, 0x07, 0x01 };
+        const char          unknown[] = { 0x12 };
+        const char          hugeArray[] = { 0x09, (char)0xFF, (char)0xFF,
+                                            (char)0xFF, (char)0xFF };
+
+        // One-element ARRAYs, nested too deep.
+        for(uint32_t i = 0; i <= AMF3::MAX_DEPTH; i++) {
+            amf3Deep.insert(amf3Deep.end(), { 0x09, 0x03, 0x01 });
+        }
+
+        amf3Deep.push_back(0x01);
+
+        if((amf3.tryDecode(badString, 2).status != AMF::BAD_REFERENCE) ||
+           (amf3.tryDecode(badObject, 2).status != AMF::BAD_REFERENCE) ||
+           (amf3.tryDecode(badTraits, 2).status != AMF::BAD_REFERENCE) ||
+           (amf3.tryDecode(externalizable, 3).status != AMF::BAD_DATA) ||
+           (amf3.tryDecode(unknown, 1).status != AMF::BAD_DATA) ||
+           (amf3.tryDecode(hugeArray, 5).status != AMF::NEED_MORE_DATA) ||
+           (amf3.tryDecode(amf3Deep.data(), amf3Deep.size()).status !=
+            AMF::BAD_DATA)) {
+            std::cout << "AMF3 got an error wrong" << std::endl;
+            return (int) -1;
+        }
+
+        try {
+            amf3.decode(badObject, 2);
+            std::cout << "AMF3 decode didn't throw" << std::endl;
+            return (int) -1;
+        } catch(std::out_of_range& e) {
+        }
+    }
+
+    // AVMPLUS in AMF0 is one AMF3 value, then we're back in AMF0.
+    {
+        const char  avmplus[] = {
+            0x02, 0x00, 0x01, 'x',                  // STRING "x"
+            0x11, 0x0A, 0x0B, 0x01,                 // AVMPLUS, anonymous
+            0x03, 'a', 0x04, 0x01, 0x01,            //   { a: 1 }
+            0x05                                    // NILL
+        };
+        AMF0                avmAMF;
+        AMF3*               amf3;
+        AMF::Value          aKey = { "a", 1 };
+        std::vector<char>   avmOut;
+
+        if((avmAMF.decode(avmplus, sizeof(avmplus)) != sizeof(avmplus)) ||
+           (avmAMF.properties.propList->size() != 3) ||
+           ((*avmAMF.properties.propList)[2].type != AMF0::Types::NILL)) {
+            std::cout << "AVMPLUS didn't decode" << std::endl;
+            return (int) -1;
+        }
+
+        amf3 = (AMF3*)(*avmAMF.properties.propList)[1].property.object;
+
+        if((amf3->properties.propList->size() != 1) ||
+           ((*amf3->properties.propList)[0].property.object
+            ->properties.propMap->find(aKey)->second.property.number != 1)) {
+            std::cout << "AVMPLUS decoded the wrong thing" << std::endl;
+            return (int) -1;
+        }
+
+        avmAMF.encode(avmOut);
+
+        if((avmOut.size() != sizeof(avmplus)) ||
+           memcmp(avmOut.data(), avmplus, sizeof(avmplus))) {
+            std::cout << "AVMPLUS didn't encode back the same" << std::endl;
+            return (int) -1;
+        }
+
+        for(uint32_t i = 5; i < 13; i++) {
+            AMF::Result result = avmAMF.tryDecode(avmplus, i);
+
+            if((result.status != AMF::NEED_MORE_DATA) ||
+               (result.bytes <= i) || (result.bytes > 13)) {
+                std::cout << "AVMPLUS got cut short wrong at " << i
+                          << std::endl;
+                return (int) -1;
+            }
+        }
+
+        // The AMF3 counts against our Limits: four values (the marker
+        // doesn't count), and an object one deep.
+        AMF0::Limits    avmLimits;
+        AMF0            avmLimitAMF;
+
+        avmLimits.maxNodes = 4;
+        avmLimits.maxDepth = 1;
+
+        if(avmLimitAMF.tryDecode(avmplus, sizeof(avmplus), avmLimits)
+                .status) {
+            std::cout << "AVMPLUS went over Limits it fits in" << std::endl;
+            return (int) -1;
+        }
+
+        for(int which = 0; which < 2; which++) {
+            AMF0    overAMF;
+
+            avmLimits = AMF0::Limits();
+
+            if(which) {
+                avmLimits.maxDepth = 0;
+            } else {
+                avmLimits.maxNodes = 3;
+            }
+
+            if(overAMF.tryDecode(avmplus, sizeof(avmplus), avmLimits)
+                    .status != AMF::BAD_DATA) {
+                std::cout << "AVMPLUS got past limit " << which << std::endl;
+                return (int) -1;
+            }
+        }
+    }
+
+    // The other ways in take AVMPLUS too.  This one has a string long
+    // enough that the incremental decoder has to collect it, and
+    // references back into it.
+    {
+        std::vector<char>   avmBig = {
+            0x02, 0x00, 0x01, 'x',                  // STRING "x"
+            0x11, 0x09, 0x07, 0x01,                 // AVMPLUS, ARRAY of 3
+            0x06, 0x51                              //   40 byte STRING
+        };
+
+        avmBig.insert(avmBig.end(), 40, 'a');
+        avmBig.insert(avmBig.end(), {
+            0x0A, 0x0B, 0x01,                       //   anonymous object
+            0x03, 'a', 0x04, 0x01,                  //     a: 1
+            0x03, 'b', 0x06, 0x00,                  //     b: string 0
+            0x01,
+            0x0A, 0x02,                             //   object 1
+            0x05,                                   // NILL
+            0x02, 0x00, 0x02, 'h', 'i'              // STRING "hi"
+        });
+
+        const char*         avmBuf = avmBig.data();
+        uint32_t            avmSize = avmBig.size();
+        uint32_t            avmLen = avmSize - 4 - 1 - 1 - 5;
+        AMF0Decoder         avmDecoder;
+        std::vector<char>   avmOut;
+
+        // Every piece size, so it's split everywhere, and what we collect
+        // past the end of the AMF3 has to be gone over again.
+        for(uint32_t piece = 1; piece <= avmSize; piece++) {
+            AMF0    avmAMF;
+
+            avmDecoder.begin(avmAMF, avmSize);
+
+            for(uint32_t i = 0; i < avmSize; i += piece) {
+                AMF0Decoder::Status status =
+                    avmDecoder.feed(&avmBuf[i], MIN(piece, avmSize - i));
+
+                if(status != ((i + piece < avmSize) ?
+                              AMF0Decoder::NEED_MORE_DATA :
+                              AMF0Decoder::DONE)) {
+                    std::cout << "AVMPLUS feed got status " << status
+                              << " at " << i << " by " << piece
+                              << std::endl;
+                    return (int) -1;
+                }
+            }
+
+            avmOut.clear();
+            avmAMF.encode(avmOut);
+
+            if((avmOut.size() != avmSize) ||
+               memcmp(avmOut.data(), avmBuf, avmSize)) {
+                std::cout << "AVMPLUS fed by " << piece
+                          << " didn't encode back the same" << std::endl;
+                return (int) -1;
+            }
+        }
+
+        // A message that ends inside the AMF3 is bad, however it's fed.
+        for(uint32_t piece = 1; piece <= 30; piece++) {
+            AMF0        avmShortAMF;
+            AMF::Result result;
+
+            avmDecoder.begin(avmShortAMF, 30);
+
+            for(uint32_t i = 0; i < 30; i += piece) {
+                result = avmDecoder.tryFeed(&avmBuf[i], MIN(piece, 30 - i));
+
+                if(result.status != AMF::NEED_MORE_DATA) {
+                    break;
+                }
+            }
+
+            if(result.status != AMF::BAD_DATA) {
+                std::cout << "AVMPLUS fed by " << piece << " got status "
+                          << (int)result.status << " cut short"
+                          << std::endl;
+                return (int) -1;
+            }
+        }
+
+        // In RTMP chunks.
+        struct iovec    avmIov[128];
+        Arena           avmArena;
+
+        for(uint32_t chunkSize = 1; chunkSize <= 16; chunkSize++) {
+            AMF0    avmIovAMF;
+            int     avmIovcnt = 0;
+
+            for(uint32_t i = 0; i < avmSize; i += chunkSize) {
+                avmIov[avmIovcnt].iov_base = (void*)&avmBuf[i];
+                avmIov[avmIovcnt].iov_len = MIN(chunkSize, avmSize - i);
+                avmIovcnt++;
+            }
+
+            if(avmIovAMF.tryDecode(avmIov, avmIovcnt, avmArena).bytes !=
+               avmSize) {
+                std::cout << "AVMPLUS iovec decode by " << chunkSize
+                          << " didn't consume its message" << std::endl;
+                return (int) -1;
+            }
+
+            avmOut.clear();
+            avmIovAMF.encode(avmOut);
+
+            if((avmOut.size() != avmSize) ||
+               memcmp(avmOut.data(), avmBuf, avmSize)) {
+                std::cout << "AVMPLUS iovec decode by " << chunkSize
+                          << " didn't encode back the same" << std::endl;
+                return (int) -1;
+            }
+
+            avmArena.reset();
+        }
+
+        // Skipping and reading step over it.
+        AMF0Reader  avmReader(avmBuf, avmSize);
+
+        if((AMF0::measure(avmBuf, avmSize) != avmSize) ||
+           (AMF0::skipValue(&avmBuf[4], avmSize - 4) != 1 + avmLen) ||
+           !avmReader.next() || !avmReader.next() ||
+           (avmReader.type() != AMF0::Types::AVMPLUS) ||
+           (avmReader.string().val != &avmBuf[5]) ||
+           (avmReader.string().len != avmLen) ||
+           !avmReader.next() ||
+           (avmReader.type() != AMF0::Types::NILL) ||
+           !avmReader.next() || avmReader.next() ||
+           (avmReader.offset() != avmSize)) {
+            std::cout << "AVMPLUS didn't skip right" << std::endl;
+            return (int) -1;
+        }
+
+        const AMF0Compact&  avmCompact = AMF0Compact::decode(avmBuf,
+                                                             avmSize,
+                                                             avmArena);
+
+        if((avmCompact.size() != 4) ||
+           (avmCompact[1].type() != AMF0::Types::AVMPLUS) ||
+           (avmCompact.string(avmCompact[1]).len != avmLen) ||
+           (avmCompact[2].type() != AMF0::Types::NILL) ||
+           (avmCompact.string(avmCompact[3]).len != 2)) {
+            std::cout << "AVMPLUS didn't compact right" << std::endl;
+            return (int) -1;
+        }
+    }
+
+    // Feed it to the incremental decoder a byte at a time, so every
+    // string gets split, then 7 bytes at a time into an arena.
+    AMF0Decoder decoder;
+    AMF0        pieceAMF;
+    AMF0        pieceArenaAMF;
+    char*       pieceBuf = (char*)malloc(totalSize);
+
+    decoder.begin(pieceAMF, totalSize);
+
+    for(uint32_t i = 0; i < totalSize; i++) {
+        AMF0Decoder::Status status = decoder.feed(&buf[i], 1);
+
+        if(status != ((i == totalSize - 1) ? AMF0Decoder::DONE
+                                           : AMF0Decoder::NEED_MORE_DATA)) {
+            std::cout << "Incremental decode got status " << status
+                      << " at byte " << i << std::endl;
+            return (int) -1;
+        }
+    }
+
+    if((pieceAMF.encode(pieceBuf, totalSize) != totalSize) ||
+       memcmp(pieceBuf, buf, totalSize)) {
+        std::cout << "Byte-at-a-time decode did not re-encode the same"
+                  << std::endl;
+        return (int) -1;
+    }
+
+    decoder.begin(pieceArenaAMF, totalSize, arena);
+
+    for(uint32_t i = 0; i < totalSize; i += 7) {
+        if(decoder.feed(&buf[i], MIN(7, totalSize - i))
+                == AMF0Decoder::DONE) {
+            if(i + 7 < totalSize) {
+                std::cout << "Incremental decode finished early"
+                          << std::endl;
+                return (int) -1;
+            }
+        }
+    }
+
+    memset(pieceBuf, 0, totalSize);
+
+    if((pieceArenaAMF.encode(pieceBuf, totalSize) != totalSize) ||
+       memcmp(pieceBuf, buf, totalSize)) {
+        std::cout << "7-byte arena decode did not re-encode the same"
+                  << std::endl;
+        return (int) -1;
+    }
+
+    // A message that's cut short is an error, not NEED_MORE_DATA.
+    try {
+        AMF0    shortAMF;
+
+        decoder.begin(shortAMF, 4);
+        decoder.feed(buf, 4);
+
+        std::cout << "Short message didn't throw" << std::endl;
+        return (int) -1;
+    } catch(std::underflow_error& e) {
+    }
+
+    // Same thing through the iovec decode, in RTMP-sized chunks and in
+    // 3 byte chunks so that lots of strings get split.
+    struct iovec    iov[256];
+    uint32_t        chunkSizes[] = { 128, 3 };
+
+    for(uint32_t chunkSize : chunkSizes) {
+        AMF0    iovAMF;
+        int     iovcnt = 0;
+
+        for(uint32_t i = 0; i < totalSize; i += chunkSize) {
+            iov[iovcnt].iov_base = &buf[i];
+            iov[iovcnt].iov_len = MIN(chunkSize, totalSize - i);
+            iovcnt++;
+        }
+
+        memset(pieceBuf, 0, totalSize);
+
+        if((iovAMF.decode(iov, iovcnt) != totalSize) ||
+           (iovAMF.encode(pieceBuf, totalSize) != totalSize) ||
+           memcmp(pieceBuf, buf, totalSize)) {
+            std::cout << "iovec decode with " << chunkSize
+                      << " byte chunks did not re-encode the same"
+                      << std::endl;
+            return (int) -1;
+        }
+    }
+
+    // The same errors without exceptions, from tryFeed and the iovec
+    // tryDecode.  A REFERENCE to nothing is BAD_REFERENCE rather than
+    // out of range of the reference table.
+    const char      badRef[] = { 0x07, 0x00, 0x05 };
+    AMF0            tryAMF;
+    AMF::Result     feedResult;
+
+    decoder.begin(tryAMF, sizeof(badRef));
+    feedResult = decoder.tryFeed(badRef, 1);
+
+    if((feedResult.status != AMF::NEED_MORE_DATA) ||
+       (feedResult.bytes != 2)) {
+        std::cout << "tryFeed wanted " << feedResult.bytes << " more bytes"
+                  << std::endl;
+        return (int) -1;
+    }
+
+    if((decoder.tryFeed(&badRef[1], 2).status != AMF::BAD_REFERENCE) ||
+       (decoder.tryFeed(&badRef[1], 2).status != AMF::BAD_DATA)) {
+        std::cout << "tryFeed missed a bad reference" << std::endl;
+        return (int) -1;
+    }
+
+    try {
+        AMF0    refTarget;
+
+        decoder.begin(refTarget, sizeof(badRef));
+        decoder.feed(badRef, sizeof(badRef));
+
+        std::cout << "Bad reference didn't throw" << std::endl;
+        return (int) -1;
+    } catch(std::out_of_range& e) {
+    }
+
+    // A message that's cut short can't be fixed by feeding more.
+    AMF0    tryShortAMF;
+
+    decoder.begin(tryShortAMF, 4);
+
+    if(decoder.tryFeed(buf, 4).status != AMF::BAD_DATA) {
+        std::cout << "tryFeed took a short message" << std::endl;
+        return (int) -1;
+    }
+
+    AMF0    tryPieceAMF;
+
+    decoder.begin(tryPieceAMF, totalSize);
+
+    for(uint32_t i = 0; i < totalSize; i += 5) {
+        feedResult = decoder.tryFeed(&buf[i], MIN(5, totalSize - i));
+
+        if(feedResult.status != ((i + 5 < totalSize) ? AMF::NEED_MORE_DATA
+                                                     : AMF::OK)) {
+            std::cout << "tryFeed got status " << (int)feedResult.status
+                      << " at byte " << i << std::endl;
+            return (int) -1;
+        }
+    }
+
+    if(feedResult.bytes != totalSize) {
+        std::cout << "tryFeed consumed " << feedResult.bytes << std::endl;
+        return (int) -1;
+    }
+
+    AMF0    tryIovAMF;
+    AMF0    tryIovShortAMF;
+    AMF0    tryIovRefAMF;
+
+    iov[0].iov_base = buf;
+    iov[0].iov_len = 20;
+    iov[1].iov_base = &buf[20];
+    iov[1].iov_len = totalSize - 20;
+
+    feedResult = tryIovAMF.tryDecode(iov, 2);
+
+    if(feedResult.status || (feedResult.bytes != totalSize)) {
+        std::cout << "iovec tryDecode got " << (int)feedResult.status
+                  << std::endl;
+        return (int) -1;
+    }
+
+    iov[1].iov_len = 2;
+
+    if(tryIovShortAMF.tryDecode(iov, 2, arena).status != AMF::NEED_MORE_DATA) {
+        std::cout << "iovec tryDecode took a short message" << std::endl;
+        return (int) -1;
+    }
+
+    iov[0].iov_base = (void*)badRef;
+    iov[0].iov_len = 1;
+    iov[1].iov_base = (void*)&badRef[1];
+    iov[1].iov_len = 2;
+
+    if(tryIovRefAMF.tryDecode(iov, 2).status != AMF::BAD_REFERENCE) {
+        std::cout << "iovec tryDecode missed a bad reference" << std::endl;
+        return (int) -1;
+    }
+
+    free(pieceBuf);
+    free(buf);
+
+    // Big objects get a hash index; make sure lookups and ordering
+    // still work past the threshold.
+    AMF0            bigAMF;
+    char            keyNames[40][4];
+
+    bigAMF.isMap = false;
+    bigAMF.properties.propList = new AMF::PropertyList();
+    childAMF = new AMF0();
+    childAMF->isMap = true;
+    childAMF->properties.propMap = new AMF::PropertyMap();
+
+    for(int i = 0; i < 40; i++) {
+        snprintf(keyNames[i], sizeof(keyNames[i]), "k%d", 39 - i);
+        key.val = keyNames[i];
+        key.len = strlen(keyNames[i]);
+        tmp.type = AMF0::Types::NUMBER;
+        tmp.property.number = 39 - i;
+        childAMF->properties.propMap->insert(
+            std::pair<AMF::Value, AMF::Property>(key, tmp)
+        );
+    }
+
+    // Duplicate keys don't overwrite.
+    tmp.property.number = 1000;
+    if(childAMF->properties.propMap->insert(
+            std::pair<AMF::Value, AMF::Property>(key, tmp)).second ||
+       (childAMF->properties.propMap->size() != 40)) {
+        std::cout << "Duplicate key was inserted into PropertyMap"
+                  << std::endl;
+        return (int) -1;
+    }
+
+    tmp.type = AMF0::Types::ECMA_ARRAY;
+    tmp.property.object = childAMF;
+    bigAMF.properties.propList->push_back(tmp);
+
+    totalSize = bigAMF.encodedSize();
+    buf = (char*)malloc(totalSize);
+    bigAMF.encode(buf, totalSize);
+
+    AMF0    bigTarget;
+
+    if(bigTarget.decode(buf, totalSize) != totalSize) {
+        std::cout << "Didn't consume the right amount of bytes for big map!"
+                  << std::endl;
+        return (int) -1;
+    }
+
+    AMF::PropertyMap* bigMap =
+        bigTarget.properties.propList->at(0).property.object
+                                                    ->properties.propMap;
+
+    // Wire order is preserved
+    if((bigMap->size() != 40) ||
+       (bigMap->begin()->second.property.number != 39)) {
+        std::cout << "Big map decoded out of order" << std::endl;
+        return (int) -1;
+    }
+
+    for(int i = 0; i < 40; i++) {
+        key.val = keyNames[i];
+        key.len = strlen(keyNames[i]);
+
+        auto found = bigMap->find(key);
+
+        if((found == bigMap->end()) ||
+           (found->second.property.number != 39 - i)) {
+            std::cout << "Big map lookup failed for " << keyNames[i]
+                      << std::endl;
+            return (int) -1;
+        }
+    }
+
+    key.val = "nope";
+    key.len = 4;
+
+    if(bigMap->find(key) != bigMap->end()) {
+        std::cout << "Big map found a key that isn't there" << std::endl;
+        return (int) -1;
+    }
+
+    free(buf);
+
+    // Build an onStatus with the builder, plus an array of objects that
+    // share a key, and enough keys to make the key table grow.
+    Arena       builderArena;
+    AMF0Builder status(builderArena, 4);
+    char        keyCopy[2] = { 'k', 0 };
+
+    status.add("onStatus").add(0).addNull();
+    status.addObject(2)
+          .add("level", "status")
+          .add("code", "X");
+
+    AMF0Builder list = status.addStrictArray(NULL, 2);
+
+    list.addObject(1).add(keyCopy, 1);
+    list.addObject().add(keyCopy, 2);
+
+    AMF0Builder many = status.addObject(40);
+
+    for(int i = 0; i < 40; i++) {
+        many.add(keyNames[i], i);
+    }
+
+    const unsigned char builtBytes[] = {
+        0x02, 0, 8, 'o','n','S','t','a','t','u','s',
+        0x00, 0, 0, 0, 0, 0, 0, 0, 0,
+        0x05,
+        0x03, 0, 5, 'l','e','v','e','l', 0x02, 0, 6, 's','t','a','t','u','s',
+              0, 4, 'c','o','d','e', 0x02, 0, 1, 'X', 0, 0, 9,
+        0x0a, 0, 0, 0, 2,
+              0x03, 0, 1, 'k', 0x00, 0x3f, 0xf0, 0, 0, 0, 0, 0, 0, 0, 0, 9,
+              0x03, 0, 1, 'k', 0x00, 0x40, 0, 0, 0, 0, 0, 0, 0, 0, 0, 9
+    };
+    std::vector<char>   built;
+
+    status.get().encode(built);
+
+    AMF::PropertyList* builtList = status.get().properties.propList;
+    AMF::PropertyMap* builtMany = builtList->at(5).property.object
+                                                ->properties.propMap;
+
+    key.val = "k";
+    key.len = 1;
+
+    if((built.size() < sizeof(builtBytes)) ||
+       memcmp(built.data(), builtBytes, sizeof(builtBytes)) ||
+       (built.size() != status.get().encodedSize()) ||
+       (builtList->at(4).property.object->properties.propList->at(0)
+            .property.object->properties.propMap->find(key)->first.val !=
+        builtList->at(4).property.object->properties.propList->at(1)
+            .property.object->properties.propMap->find(key)->first.val) ||
+       (builtMany->begin()->first.val == keyNames[0]) ||
+       (builtMany->size() != 40)) {
+        std::cout << "Builder made the wrong thing" << std::endl;
+        return (int) -1;
+    }
+
+    for(int i = 0; i < 40; i++) {
+        key.val = keyNames[i];
+        key.len = strlen(keyNames[i]);
+
+        if(builtMany->find(key)->second.property.number != i) {
+            std::cout << "Builder lost " << keyNames[i] << std::endl;
+            return (int) -1;
+        }
+    }
+
+    // Every known key is found in its own slot, and the builder and the
+    // decoder both use our copy of them.
+    char        knownCopy[32];
+
+    for(uint32_t i = 0; i < AMF::KNOWN_KEY_SLOTS; i++) {
+        if(!AMF::knownKeys[i].val) {
+            continue;
+        }
+
+        memcpy(knownCopy, AMF::knownKeys[i].val, AMF::knownKeys[i].len);
+
+        if(AMF::knownKey(knownCopy, AMF::knownKeys[i].len) !=
+           &AMF::knownKeys[i]) {
+            std::cout << "Known key " << AMF::knownKeys[i].val
+                      << " isn't in its slot" << std::endl;
+            return (int) -1;
+        }
+    }
+
+    AMF0                knownTarget;
+    AMF::PropertyMap*   knownMap;
+
+    knownTarget.decode(built.data(), built.size());
+    knownMap = knownTarget.properties.propList->at(3).property.object
+                                                    ->properties.propMap;
+    strcpy(knownCopy, "code");
+    key.val = knownCopy;
+    key.len = 4;
+
+    if((AMF::knownKeyId(builtList->at(3).property.object->properties
+                            .propMap->begin()->first) != AMF::KEY_LEVEL) ||
+       (AMF::knownKeyId(knownMap->begin()->first) != AMF::KEY_LEVEL) ||
+       (knownMap->find(key) == knownMap->end()) ||
+       (knownMap->find(key)->first.val != AMF::knownKeys[AMF::KEY_CODE].val) ||
+       (AMF::knownKeyId(key) != -1) ||
+       AMF::knownKey("codes", 5) || AMF::knownKey("c", 1)) {
+        std::cout << "Known keys weren't used" << std::endl;
+        return (int) -1;
+    }
+
+    key.val = "k";
+    key.len = 1;
+
+    if(knownTarget.properties.propList->at(4).property.object
+            ->properties.propList->at(1).property.object
+            ->properties.propMap->find(key)->second.property.number != 2) {
+        std::cout << "Lost a key that isn't known" << std::endl;
+        return (int) -1;
+    }
+
+    // Keyframe indexes come out as plain doubles with DENSE_NUMBERS, as
+    // long as they're all NUMBERs.  37 of them, so the bulk swap has
+    // some left over.
+    AMF0Builder metaData(builderArena);
+
+    metaData.add("onMetaData");
+
+    AMF0Builder keyframes = metaData.addEcmaArray(NULL, 1)
+                                    .addObject("keyframes", 3);
+    AMF0Builder times = keyframes.addStrictArray("times", 37);
+    AMF0Builder positions = keyframes.addStrictArray("filepositions", 37);
+
+    for(int i = 0; i < 37; i++) {
+        times.add(i * 2.5);
+        positions.add(i * 100000.0 + 13);
+    }
+
+    keyframes.addStrictArray("mixed", 2).add(1).add("x");
+
+    std::vector<char>   metaBytes;
+    std::vector<char>   denseBytes;
+
+    metaData.get().encode(metaBytes);
+
+    for(int pass = 0; pass < 2; pass++) {
+        AMF0    denseTarget;
+        Arena   denseArena;
+
+        if(pass) {
+            denseTarget.decode(metaBytes.data(), metaBytes.size(), denseArena,
+                               AMF0::DENSE_NUMBERS | AMF0::LAZY);
+        } else {
+            denseTarget.decode(metaBytes.data(), metaBytes.size(),
+                               AMF0::DENSE_NUMBERS);
+        }
+
+        AMF0* denseMeta = (AMF0*)denseTarget.properties.propList->at(1)
+                                                .property.object;
+
+        denseMeta->load();
+
+        AMF0* denseFrames = (AMF0*)denseMeta->properties.propMap
+                                                ->begin()->second
+                                                .property.object;
+
+        denseFrames->load();
+
+        AMF::PropertyMap::iterator kv = denseFrames->properties.propMap
+                                                            ->begin();
+        AMF0* denseTimes = (AMF0*)kv[0].second.property.object;
+        AMF0* densePositions = (AMF0*)kv[1].second.property.object;
+        AMF0* denseMixed = (AMF0*)kv[2].second.property.object;
+
+        denseTimes->load();
+        densePositions->load();
+        denseMixed->load();
+
+        if(!denseTimes->isDense() || !densePositions->isDense() ||
+           denseMixed->isDense() || denseFrames->isDense() ||
+           (denseTimes->numberCount() != 37) ||
+           !denseTimes->properties.propList->empty() ||
+           (denseMixed->properties.propList->size() != 2)) {
+            std::cout << "Didn't decode dense arrays right" << std::endl;
+            return (int) -1;
+        }
+
+        for(int i = 0; i < 37; i++) {
+            if((denseTimes->numbers()[i] != i * 2.5) ||
+               (densePositions->numbers()[i] != i * 100000.0 + 13)) {
+                std::cout << "Dense array has the wrong number at " << i
+                          << std::endl;
+                return (int) -1;
+            }
+        }
+
+        // Make encode do it the long way.
+        denseTimes->invalidate();
+        densePositions->invalidate();
+        denseBytes.clear();
+        denseTarget.encode(denseBytes);
+
+        if(denseBytes != metaBytes) {
+            std::cout << "Dense arrays re-encoded wrong" << std::endl;
+            return (int) -1;
+        }
+    }
+
+    // The same keyframes, built from arrays of doubles, come out the
+    // same.
+    double              timeSpan[37];
+    double              positionSpan[37];
+    AMF0Builder         spanData(builderArena);
+    std::vector<char>   spanBytes;
+
+    for(int i = 0; i < 37; i++) {
+        timeSpan[i] = i * 2.5;
+        positionSpan[i] = i * 100000.0 + 13;
+    }
+
+    spanData.add("onMetaData");
+
+    AMF0Builder spanFrames = spanData.addEcmaArray(NULL, 1)
+                                     .addObject("keyframes", 3);
+
+    spanFrames.addNumbers("times", timeSpan, 37)
+              .addNumbers("filepositions", positionSpan, 37);
+    spanFrames.addStrictArray("mixed", 2).add(1).add("x");
+
+    spanData.get().encode(spanBytes);
+
+    if((spanBytes != metaBytes) ||
+       (spanData.get().encodedSize() != metaBytes.size())) {
+        std::cout << "Builder encoded dense arrays wrong" << std::endl;
+        return (int) -1;
+    }
+
+    // And on their own, through a writer with a small window so that
+    // they're written a few at a time.
+    std::vector<char>   spanExpected(5 + 37 * 9);
+    std::vector<char>   spanCalled;
+    CallbackWriter      spanCallback([&spanCalled](const char* data,
+                                                   uint32_t size) {
+                            spanCalled.insert(spanCalled.end(), data,
+                                              data + size);
+                        }, 40);
+
+    spanExpected[0] = AMF0::Types::STRICT_ARRAY;
+    AMF::encodeInt32(37, &spanExpected[1]);
+
+    for(int i = 0; i < 37; i++) {
+        spanExpected[5 + i * 9] = AMF0::Types::NUMBER;
+        AMF::encodeNumber(positionSpan[i], &spanExpected[6 + i * 9]);
+    }
+
+    if(AMF0::encodeStrictArray(spanCallback, positionSpan, 37) !=
+       spanExpected.size()) {
+        std::cout << "encodeStrictArray returned the wrong size"
+                  << std::endl;
+        return (int) -1;
+    }
+
+    spanCallback.finish();
+
+    if(spanCalled != spanExpected) {
+        std::cout << "encodeStrictArray wrote the wrong thing" << std::endl;
+        return (int) -1;
+    }
+
+    // The compact decode should see the same onStatus the builder made,
+    // and resolve references to the same node.
+    Arena               compactArena;
+    const AMF0Compact&  compact = AMF0Compact::decode(built.data(),
+                                                      built.size(),
+                                                      compactArena);
+    const AMF0Compact*  compactInfo = compact[3].object();
+    const AMF0Compact*  compactList = compact[4].object();
+
+    if((compact.size() != 6) || compact.isMap() ||
+       (compact[0].type() != AMF0::Types::STRING) ||
+       (compact.string(compact[0]).len != 8) ||
+       memcmp(compact.string(compact[0]).val, "onStatus", 8) ||
+       !compact[1].isNumber() || (compact[1].number() != 0) ||
+       (compact[2].type() != AMF0::Types::NILL) ||
+       !compactInfo || !compactInfo->isMap() ||
+       (compactInfo->key(1).len != 4) ||
+       memcmp(compactInfo->key(1).val, "code", 4) ||
+       !compactInfo->find("level") || compactInfo->find("nope") ||
+       memcmp(compactInfo->string(*compactInfo->find("level")).val,
+              "status", 6) ||
+       !compactList || (compactList->type() != AMF0::Types::STRICT_ARRAY) ||
+       (compactList->size() != 2) ||
+       (compactList->operator[](1).object()->find("k")->number() != 2) ||
+       (compact[5].object()->size() != 40) ||
+       (compact[5].object()->find(keyNames[39])->number() != 39)) {
+        std::cout << "Compact decode got the onStatus wrong" << std::endl;
+        return (int) -1;
+    }
+
+    const AMF0Compact&  compactRefs = AMF0Compact::decode(refBytes,
+                                                          sizeof(refBytes),
+                                                          compactArena);
+
+    if((compactRefs.size() != 2) ||
+       (compactRefs[1].object() !=
+        compactRefs[0].object()->find("a")->object()) ||
+       (compactRefs[1].type() != AMF0::Types::OBJECT)) {
+        std::cout << "Compact decode got the REFERENCE wrong" << std::endl;
+        return (int) -1;
+    }
+
+    // Doubles that look like tags, booleans, and a long string.
+    char            oddBytes[28 + 70000] = {
+        0x00, 0x7f, (char)0xf8, 0, 0, 0, 0, 0, 1,
+        0x00, (char)0xbf, (char)0xf0, 0, 0, 0, 0, 0, 0,
+        0x01, 0x01, 0x01, 0x00, 0x06,
+        0x0c, 0x00, 0x01, 0x11, 0x70
+    };
+    const AMF0Compact&  compactOdd = AMF0Compact::decode(oddBytes,
+                                                         sizeof(oddBytes),
+                                                         compactArena);
+
+    if((compactOdd.size() != 6) ||
+       (compactOdd[0].number() == compactOdd[0].number()) ||
+       (compactOdd[1].number() != -1) ||
+       !compactOdd[2].boolean() || compactOdd[3].boolean() ||
+       (compactOdd[3].type() != AMF0::Types::BOOLEAN) ||
+       (compactOdd[4].type() != AMF0::Types::NILL) ||
+       (compactOdd[5].type() != AMF0::Types::LONG_STRING) ||
+       (compactOdd.string(compactOdd[5]).len != 70000) ||
+       (compactOdd.string(compactOdd[5]).val != &oddBytes[28])) {
+        std::cout << "Compact decode got odd values wrong" << std::endl;
+        return (int) -1;
+    }
+
+    try {
+        AMF0Compact::decode(badRefBytes, sizeof(badRefBytes), compactArena);
+        std::cout << "Compact decode took a bad reference" << std::endl;
+        return (int) -1;
+    } catch(std::out_of_range& e) {
+    }
+
+    // Make a template out of a _result, with the transaction ID and
+    // description as slots, and check it renders the same thing as
+    // building the message would.
+    AMF0Builder resultSample(builderArena, 4);
+
+    resultSample.add("_result").add(0).addNull();
+    resultSample.addObject(3)
+                .add("level", "status")
+                .add("description", "")
+                .add("code", "NetStream.Play.Start");
+
+    AMF::PropertyList&  resultTop = *resultSample.get().properties.propList;
+
+    key.val = "description";
+    key.len = 11;
+
+    AMF0Template        resultTemplate(resultSample.get(), {
+        &resultTop[3].property.object->properties.propMap->find(key)->second,
+        &resultTop[1]
+    });
+    AMF::Property       slotValues[2];
+    GrowableWriter      rendered;
+
+    for(int i = 1; i <= 2; i++) {
+        AMF0Builder         expected(builderArena, 4);
+        std::vector<char>   expectedBytes;
+
+        expected.add("_result").add(i).addNull();
+        expected.addObject(3)
+                .add("level", "status")
+                .add("description", i == 1 ? "Playing" : "Still playing")
+                .add("code", "NetStream.Play.Start");
+        expected.get().encode(expectedBytes);
+
+        slotValues[0].property.value.val = i == 1 ? "Playing" :
+                                                    "Still playing";
+        slotValues[0].property.value.len = i == 1 ? 7 : 13;
+        slotValues[1].property.number = i;
+
+        rendered.clear();
+
+        if((resultTemplate.render(rendered, slotValues) !=
+            expectedBytes.size()) ||
+           (resultTemplate.encodedSize(slotValues) != expectedBytes.size()) ||
+           memcmp(rendered.data(), expectedBytes.data(),
+                  expectedBytes.size())) {
+            std::cout << "Template rendered the wrong thing" << std::endl;
+            return (int) -1;
+        }
+    }
+
+    try {
+        AMF0Template    badTemplate(resultSample.get(), { &tmp });
+
+        std::cout << "Template took a slot that isn't there" << std::endl;
+        return (int) -1;
+    } catch(std::runtime_error& e) {
+    }
+
+    // The primitives, at odd addresses, and 24 bit values with the top
+    // bit set (which aren't sign extended).
+    {
+        char        odd[1 + 8 * 4];
+        double      numbers[4] = { 1.5, -0.25, 1e300, 0 };
+        double      decoded[4];
+        const char  allOnes[] = { (char)0xff, (char)0xff, (char)0xff };
+        const char  topBit[] = { (char)0x80, 0x00, 0x00 };
+
+        if((AMF::decodeInt24(allOnes) != 0xffffff) ||
+           (AMF::decodeInt24(topBit) != 0x800000)) {
+            std::cout << "decodeInt24 sign extended" << std::endl;
+            return (int) -1;
+        }
+
+        Endian::storeBE16(0xbeef, &odd[1]);
+        Endian::storeBE32(0xdeadbeef, &odd[3]);
+        Endian::storeBE64(0x0123456789abcdefULL, &odd[7]);
+
+        if((Endian::loadBE16(&odd[1]) != 0xbeef) ||
+           ((unsigned char)odd[1] != 0xbe) ||
+           (Endian::loadBE32(&odd[3]) != 0xdeadbeef) ||
+           ((unsigned char)odd[3] != 0xde) ||
+           (Endian::loadBE64(&odd[7]) != 0x0123456789abcdefULL) ||
+           (odd[7] != 0x01) || ((unsigned char)odd[14] != 0xef) ||
+           (Endian::loadLE32(&odd[3]) != 0xefbeadde)) {
+            std::cout << "Endian got an odd address wrong" << std::endl;
+            return (int) -1;
+        }
+
+        AMF::encodeNumbers(numbers, 4, &odd[1]);
+        AMF::decodeNumbers(&odd[1], decoded, 4);
+
+        if(memcmp(numbers, decoded, sizeof(numbers)) ||
+           ((unsigned char)odd[1] != 0x3f) || (odd[2] != (char)0xf8) ||
+           (AMF::decodeNumber(&odd[9]) != -0.25)) {
+            std::cout << "Batch numbers didn't round trip" << std::endl;
+            return (int) -1;
+        }
+    }
 
     return (int) 0;
 }